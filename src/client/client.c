@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/tcp.h>
@@ -14,48 +15,93 @@
 #include "../common/common.h"
 #include "../common/cdf.h"
 #include "../common/conn.h"
+#include "../common/receiver.h"
+#include "../common/hist.h"
+#include "../common/fctlog.h"
+#include "../common/trace.h"
+#include "../common/sampler.h"
+
+/* flow size ranges of FCT statistics (same as result.py) */
+#define TG_FCT_SIZE_RANGES 3
+
+/* a request generator thread, which owns the servers whose IDs are equal to its ID modulo the number of shards */
+struct generator_shard
+{
+    unsigned int id;
+    struct server_stream *streams;  /* streams of its servers */
+    unsigned int num_streams;
+    struct stream_heap heap;    /* streams with requests left */
+    struct arrival_schedule schedule;   /* absolute deadlines of its request arrivals */
+    unsigned long long elapsed_us;  /* scheduled time of its latest request arrival */
+    pthread_t thread;
+};
+
+/* state of an outstanding flow. A slot is reused by a new flow once the flow completes. */
+struct flow_slot
+{
+    unsigned int req_id;    /* sequence number of the request */
+    unsigned int server_id; /* server ID */
+    unsigned long long size;    /* flow size (in bytes) */
+    unsigned int dscp;  /* DSCP of flow */
+    unsigned int rate;  /* sending rate of flow */
+    struct timeval start_time;  /* start time of flow */
+    bool in_use;
+    unsigned int next_free; /* ID of the next free slot (0 if none) */
+};
 
 bool verbose_mode = false;  /* by default, we don't give more detailed output */
+unsigned int num_receivers = TG_RECEIVER_THREADS;   /* number of threads to receive traffic */
 
 char config_file_name[80] = {0};    /* configuration file */
-char dist_file_name[80] = {0};  /* flow size distribution file */
 char fct_log_name[80] = "flows.txt";    /* default log file */
+bool binary_log = false;    /* write binary records instead of text lines into the log file */
 int seed = 0;   /* random seed */
 char result_script_name[80] = {0};  /* script file to parse final results */
-unsigned int usleep_overhead_us = 0;    /* usleep overhead in microsecond */
+double link_capacity = TG_LINK_CAPACITY;   /* capacity of the client link (Mbps) to size connection pools */
+int rcvbuf_size = 0;    /* SO_RCVBUF of connections (0: kernel autotuning) */
+unsigned int spin_us = 0;   /* busy-wait before each request arrival (in microseconds) */
+unsigned int num_shards = 1;    /* number of request generator threads */
+struct generator_shard *shards = NULL;
+unsigned int req_issued = 0;    /* number of requests generated by all shards */
+unsigned int pipeline_depth = 1;    /* maximum number of outstanding flows per connection */
 struct timeval tv_start, tv_end;    /* start and end time of traffic */
 unsigned int num_new_conn = 0;  /* new established connections */
 
-/* per-server variables */
-unsigned int num_server = 0;    /* total number of servers */
-unsigned int *server_port = NULL;   /* ports of servers */
-char (*server_addr)[20] = NULL; /* IP addresses of servers */
+struct client_config config;    /* servers, request size distribution, DSCP values and sending rates */
 unsigned int *server_req_count = NULL;  /* numbers of flows generated by different servers */
 
-unsigned int num_dscp = 0;  /* number of DSCP */
-unsigned int *dscp_value = NULL;
-unsigned int *dscp_prob = NULL;
-unsigned int dscp_prob_total = 0;
-
-unsigned int num_rate = 0;  /* number of sending rates */
-unsigned int *rate_value = NULL;
-unsigned int *rate_prob = NULL;
-unsigned int rate_prob_total = 0;
-
 double load = -1;   /* network load (Mbps) */
 unsigned int req_total_num = 0; /* total number of requests to generate */
 unsigned int req_total_time = 0;    /* total time to generate requests (in seconds) */
-struct cdf_table *req_size_dist = NULL;
 unsigned int period_us; /* average request arrival interval (in microseconds) */
-
-/* per-request variables */
-unsigned int *req_size = NULL;  /* flow size (in bytes) */
-unsigned int *req_server_id = NULL; /* server ID */
-unsigned int *req_dscp = NULL;  /* DSCP of flow */
-unsigned int *req_rate = NULL;  /* sending rate of flow */
-unsigned int *req_sleep_us = NULL;  /* sleep time interval */
-struct timeval *req_start_time; /* start time of flow */
-struct timeval *req_stop_time;  /* stop time of flow */
+char trace_file_name[80] = {0};  /* trace to replay instead of sampling requests */
+double trace_scale = 1; /* arrival times of the trace are multiplied by this factor */
+struct flow_trace trace;
+struct trace_splitter trace_splitter;   /* hands the flows of the trace to the shards owning their servers */
+
+/* per-request variables. Requests are generated just in time, and only outstanding flows have state. */
+struct flow_slot *flow_slots = NULL;    /* slot ID (flow ID) - 1 -> outstanding flow */
+unsigned int free_slot = 0; /* ID of the first free slot (0 if all slots are in use) */
+pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;  /* protects free slots */
+/* per-server FIFO of slots waiting for a new connection, linked by next_free */
+unsigned int *pending_head = NULL;  /* ID of the first waiting slot (0 if none) */
+unsigned int *pending_tail = NULL;  /* ID of the last waiting slot */
+pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;   /* protects pending_head and pending_tail */
+struct fct_log fct_log; /* log file with flow completion times */
+unsigned int req_finished = 0;  /* number of completed flows */
+unsigned int req_failed = 0;    /* number of requests which cannot be sent */
+unsigned long long req_size_total = 0;  /* total size of generated requests (in bytes) */
+unsigned long long req_dscp_total = 0;
+unsigned long long req_rate_total = 0;
+
+/*
+ * FCT histograms. Each receiver thread records completed flows into its own tables
+ * (receiver i uses entries i * N to i * N + N - 1), which are merged into those of receiver 0 at exit.
+ */
+struct hist_table *size_fct_hists = NULL;   /* per flow size range (N = TG_FCT_SIZE_RANGES) */
+struct hist_table *dscp_fct_hists = NULL;   /* per DSCP value (N = TG_DSCP_VALUES) */
+struct hist_table *server_fct_hists = NULL; /* per server (N = config.num_server) */
+char *size_range_name[TG_FCT_SIZE_RANGES] = {"(0, 100KB)", "[100KB, 10MB)", "[10MB, )"};
 
 struct conn_list *connection_lists = NULL;  /* connection pool */
 
@@ -67,12 +113,32 @@ void read_args(int argc, char *argv[]);
 void read_config(char *file_name);
 /* set request variables */
 void set_req_variables();
-/* receive traffic from established connections */
-void *listen_connection(void *ptr);
-/* generate flow requests */
+/* record the completion of a flow (called by receiver threads) */
+bool finish_flow(unsigned int receiver_id, struct flow_metadata *flow, struct timeval *resp_time, struct timeval *stop_time);
+/* get the flow size range of FCT statistics */
+unsigned int get_size_range(unsigned long long size);
+/* merge the FCT histograms of all receivers */
+void merge_fct_hists();
+/* print FCT percentiles */
+void print_fct_hists();
+/* generate flow requests with all shards */
 void run_requests();
-/* generate a flow request to the server */
-void run_request(unsigned int req_id);
+/* generate flow requests to servers owned by a shard */
+void *run_shard_requests(void *ptr);
+/* replay the flows of the trace to servers owned by a shard */
+void *run_shard_trace(void *ptr);
+/* send a flow request at its arrival time, sleep_us after the previous request of the shard */
+void issue_request(struct generator_shard *shard, unsigned int server_id, unsigned long long size, unsigned int dscp, unsigned int rate, unsigned int sleep_us);
+/* take a free flow slot and return its ID (0 if all slots are in use) */
+unsigned int alloc_flow_slot();
+/* return a flow slot to the free list */
+void free_flow_slot(unsigned int slot_id);
+/* generate a flow request of a slot to the server and return true if it succeeds */
+bool run_request(unsigned int slot_id);
+/* send the flow request of a slot on a connection and return true if it succeeds */
+bool send_request(unsigned int slot_id, struct conn_node *node);
+/* take a new connection from the pool manager */
+void prepare_conn(struct conn_list *list, struct conn_node *node);
 /* terminate all existing connections */
 void exit_connections();
 /* terminate a connection */
@@ -86,6 +152,9 @@ int main(int argc, char *argv[])
 {
     unsigned int i = 0;
     struct conn_node *ptr = NULL;
+    struct conn_plan plan;
+    /* initial number of connections per server, enough that the first requests do not wake the pool manager up */
+    unsigned int num_conn = max(TG_PAIR_INIT_CONN, TG_CONN_LOW_WATER + TG_CONN_GROW);
 
     /* read program arguments */
     read_args(argc, argv);
@@ -94,71 +163,86 @@ int main(int argc, char *argv[])
     if (seed == 0)
     {
         gettimeofday(&tv_start, NULL);
-        srand((tv_start.tv_sec*1000000) + tv_start.tv_usec);
+        seed = (tv_start.tv_sec*1000000) + tv_start.tv_usec;
     }
-    else
-        srand(seed);
 
     /* read configuration file */
     read_config(config_file_name);
     /* set request variables */
     set_req_variables();
 
-    /* calculate usleep overhead */
-    usleep_overhead_us = get_usleep_overhead(20);
-    if (verbose_mode)
-    {
-        printf("===========================================\n");
-        printf("The usleep overhead is %u us\n", usleep_overhead_us);
-        printf("===========================================\n");
-    }
-
     /* we use calloc here to implicitly initialize struct conn_list as 0 */
-    connection_lists = (struct conn_list*)calloc(num_server, sizeof(struct conn_list));
+    connection_lists = (struct conn_list*)calloc(config.num_server, sizeof(struct conn_list));
     if (!connection_lists)
     {
         cleanup();
         error("Error: calloc connection_lists");
     }
 
+    /* size connection pools for the outstanding flows predicted by the load model of the link */
+    printf("===========================================\n");
+    if (strlen(trace_file_name) > 0)
+        printf("Connection pools: %u per server (no load model for traces)\n", num_conn);
+    else if (plan_conn_pool(&plan, avg_cdf(config.req_size_dist), period_us, link_capacity, 1.0 / config.num_server,
+                            1, config.rate_value, config.rate_prob, config.num_rate))
+    {
+        num_conn = max((plan.max_flows + pipeline_depth - 1) / pipeline_depth, num_conn);
+        print_conn_plan(&plan, config.num_server, num_conn, rcvbuf_size);
+    }
+    else
+        printf("Warning: the link is overloaded (%.1f%% of %.0f Mbps), %u connections per server at first\n", plan.load * 100, link_capacity, num_conn);
+
     /* initialize connection pool and establish connections to servers */
-    for (i = 0; i < num_server; i++)
+    for (i = 0; i < config.num_server; i++)
     {
         /* initialize server IP and port information */
-        if (!init_conn_list(&connection_lists[i], i, server_addr[i], server_port[i]))
+        if (!init_conn_list(&connection_lists[i], i, config.server_addr[i], config.server_port[i]))
         {
             cleanup();
             error("Error: init_conn_list");
         }
-        /* establish TG_PAIR_INIT_CONN connections to server_addr[i]:server_port[i] */
-        if (!insert_conn_list(&connection_lists[i], TG_PAIR_INIT_CONN))
+        connection_lists[i].depth = pipeline_depth;
+        connection_lists[i].rcvbuf = rcvbuf_size;
+        /* establish num_conn connections to server_addr[i]:server_port[i] */
+        if (!insert_conn_list(&connection_lists[i], num_conn))
         {
             cleanup();
             error("Error: insert_conn_list");
         }
     }
 
-    /* start threads to receive traffic */
-    for (i = 0; i < num_server; i++)
+    /* start threads to receive traffic on established connections */
+    if (!start_receivers(num_receivers, finish_flow))
     {
-        ptr = connection_lists[i].head;
-        while (true)
+        cleanup();
+        error("Error: start_receivers");
+    }
+    for (i = 0; i < config.num_server; i++)
+    {
+        for (ptr = connection_lists[i].head; ptr != NULL; ptr = ptr->next)
         {
-            if (!ptr)
-                break;
-            else
+            if (!add_receiver_conn(ptr))
             {
-                pthread_create(&(ptr->thread), NULL, listen_connection, (void*)ptr);
-                ptr = ptr->next;
+                cleanup();
+                error("Error: add_receiver_conn");
             }
         }
     }
 
+    /* open new connections in the background when pools run low */
+    if (!start_conn_manager(connection_lists, config.num_server, prepare_conn))
+    {
+        cleanup();
+        error("Error: start_conn_manager");
+    }
+
     printf("===========================================\n");
     printf("Start to generate requests\n");
     printf("===========================================\n");
     gettimeofday(&tv_start, NULL);
     run_requests();
+    /* requests waiting for new connections are sent before the manager stops */
+    stop_conn_manager();
 
     /* close existing connections */
     printf("===========================================\n");
@@ -168,7 +252,7 @@ int main(int argc, char *argv[])
     gettimeofday(&tv_end, NULL);
 
     printf("===========================================\n");
-    for (i = 0; i < num_server; i++)
+    for (i = 0; i < config.num_server; i++)
         print_conn_list(&connection_lists[i]);
     printf("===========================================\n");
     print_statistic();
@@ -177,7 +261,9 @@ int main(int argc, char *argv[])
     cleanup();
 
     /* parse results */
-    if (strlen(result_script_name) > 0)
+    if (strlen(result_script_name) > 0 && binary_log)
+        printf("Convert %s with log2text to parse it with %s\n", fct_log_name, result_script_name);
+    else if (strlen(result_script_name) > 0)
     {
         printf("===========================================\n");
         printf("Flow completion times (FCT) results\n");
@@ -199,8 +285,17 @@ void print_usage(char *program)
     printf("-n <number>     number of requests (instead of -t)\n");
     printf("-t <time>       time in seconds (instead of -n)\n");
     printf("-l <file>       log file with flow completion times (default %s)\n", fct_log_name);
+    printf("-f <format>     log file format, text or binary (default text)\n");
     printf("-s <seed>       seed to generate random numbers (default current time)\n");
     printf("-r <file>       python script to parse result files\n");
+    printf("-w <number>     number of threads to receive traffic (default %d)\n", TG_RECEIVER_THREADS);
+    printf("-d <number>     maximum number of pipelined requests per connection (default 1, at most %d)\n", TG_CONN_MAX_DEPTH);
+    printf("-g <number>     number of threads to generate requests (default 1)\n");
+    printf("-L <capacity>   capacity of the client link in Mbits/sec to size connection pools (default %d)\n", TG_LINK_CAPACITY);
+    printf("-m <bytes>      SO_RCVBUF of connections (default 0: kernel autotuning)\n");
+    printf("-u <us>         busy-wait for the last microseconds before each request arrival (default 0)\n");
+    printf("-T <file>       replay a binary or CSV trace instead of sampling requests (-b is not needed)\n");
+    printf("-k <factor>     multiply arrival times of the trace by a factor (default 1)\n");
     printf("-v              give more detailed output (verbose)\n");
     printf("-h              display help information\n");
 }
@@ -295,6 +390,20 @@ void read_args(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
         }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-f") == 0)
+        {
+            if (i+1 < argc && (strcmp(argv[i+1], "text") == 0 || strcmp(argv[i+1], "binary") == 0))
+            {
+                binary_log = (strcmp(argv[i+1], "binary") == 0);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read log file format\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
         else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-s") == 0)
         {
             if (i+1 < argc)
@@ -323,6 +432,154 @@ void read_args(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
         }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-w") == 0)
+        {
+            if (i+1 < argc)
+            {
+                num_receivers = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                if (num_receivers == 0)
+                {
+                    printf("Invalid number of receiver threads\n");
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read number of receiver threads\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-d") == 0)
+        {
+            if (i+1 < argc)
+            {
+                pipeline_depth = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                if (pipeline_depth == 0 || pipeline_depth > TG_CONN_MAX_DEPTH)
+                {
+                    printf("Invalid pipeline depth\n");
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read pipeline depth\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-g") == 0)
+        {
+            if (i+1 < argc)
+            {
+                num_shards = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                if (num_shards == 0)
+                {
+                    printf("Invalid number of generator threads\n");
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read number of generator threads\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-L") == 0)
+        {
+            if (i+1 < argc)
+            {
+                link_capacity = atof(argv[i+1]);
+                if (link_capacity <= 0)
+                {
+                    printf("Invalid link capacity: %f\n", link_capacity);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read link capacity\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-m") == 0)
+        {
+            if (i+1 < argc)
+            {
+                rcvbuf_size = atoi(argv[i+1]);
+                if (rcvbuf_size < 0)
+                {
+                    printf("Invalid receive buffer size\n");
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read receive buffer size\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-u") == 0)
+        {
+            if (i+1 < argc)
+            {
+                spin_us = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read busy-wait time\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-T") == 0)
+        {
+            if (i+1 < argc && strlen(argv[i+1]) < sizeof(trace_file_name))
+            {
+                sprintf(trace_file_name, "%s", argv[i+1]);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read trace file name\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-k") == 0)
+        {
+            if (i+1 < argc)
+            {
+                trace_scale = atof(argv[i+1]);
+                if (trace_scale <= 0)
+                {
+                    printf("Invalid time scale of the trace: %f\n", trace_scale);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read time scale of the trace\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
         else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-v") == 0)
         {
             verbose_mode = true;
@@ -341,13 +598,14 @@ void read_args(int argc, char *argv[])
         }
     }
 
-    if (load < 0)
+    if (load < 0 && strlen(trace_file_name) == 0)
     {
         printf("You need to specify the average RX bandwidth (-b)\n");
         error = true;
     }
 
-    if (req_total_num == 0 && req_total_time == 0)
+    /* a trace is replayed to its end by default */
+    if (req_total_num == 0 && req_total_time == 0 && strlen(trace_file_name) == 0)
     {
         printf("You need to specify either the number of requests (-n) or the time to generate requests (-t)\n");
         error = true;
@@ -368,370 +626,640 @@ void read_args(int argc, char *argv[])
 /* read configuration file */
 void read_config(char *file_name)
 {
-    FILE *fd = NULL;
-    char key[80] = {0};
-    char line[256] = {0};
-    num_server = 0; /* number of senders */
-    unsigned int num_dist = 0;  /* number of flow size distributions */
-    num_dscp = 0;   /* number of DSCP (optional) */
-    num_rate = 0;   /* number of sending rates (optional) */
-
     printf("===========================================\n");
     printf("Reading configuration file %s\n", file_name);
     printf("===========================================\n");
 
-    /* parse configuration file for the first time */
-    fd = fopen(file_name, "r");
-    if (!fd)
-        error("Error: open configuration file for the first time");
-
-    while (fgets(line, sizeof(line), fd) != NULL)
-    {
-        sscanf(line, "%s", key);
-        if (!strcmp(key, "server"))
-            num_server++;
-        else if (!strcmp(key, "req_size_dist"))
-            num_dist++;
-        else if (!strcmp(key, "dscp"))
-            num_dscp++;
-        else if (!strcmp(key, "rate"))
-            num_rate++;
-    }
-
-    fclose(fd);
-
-    if (num_server < 1)
-        error("Error: configuration file should provide at least one server");
-    if (num_dist != 1)
-        error("Error: configuration file should provide exactly one request size distribution");
-
-    /* initialize configuration */
-    /* per-server variables */
-    server_port = (unsigned int*)calloc(num_server, sizeof(unsigned int));
-    server_addr = (char (*)[20])calloc(num_server, sizeof(char[20]));
-    server_req_count = (unsigned int*)calloc(num_server, sizeof(unsigned int));
-    /* DSCP and probability */
-    dscp_value = (unsigned int*)calloc(max(num_dscp, 1), sizeof(unsigned int));
-    dscp_prob = (unsigned int*)calloc(max(num_dscp, 1), sizeof(unsigned int));
-    /* sending rate value and probability */
-    rate_value = (unsigned int*)calloc(max(num_rate, 1), sizeof(unsigned int));
-    rate_prob = (unsigned int*)calloc(max(num_rate, 1), sizeof(unsigned int));
-
-    if (!server_port || !server_addr || !server_req_count || !dscp_value || !dscp_prob || !rate_value || !rate_prob)
+    if (!read_client_config(&config, file_name, strlen(trace_file_name) == 0, verbose_mode))
     {
         cleanup();
-        error("Error: calloc per-server variables");
+        exit(EXIT_FAILURE);
     }
 
-    /* second time */
-    num_server = 0;
-    num_dscp = 0;
-    num_rate = 0;
-
-    fd = fopen(file_name, "r");
-    if (!fd)
+    server_req_count = (unsigned int*)calloc(config.num_server, sizeof(unsigned int));
+    if (!server_req_count)
     {
         cleanup();
-        error("Error: open configuration file for the second time");
+        error("Error: calloc server_req_count");
     }
+}
 
-    while (fgets(line, sizeof(line), fd) != NULL)
-    {
-        remove_newline(line);
-        sscanf(line, "%s", key);
-
-        if (!strcmp(key, "server"))
-        {
-            sscanf(line, "%s %s %u", key, server_addr[num_server], &server_port[num_server]);
-            if (verbose_mode)
-                printf("Server[%u]: %s, Port: %u\n", num_server, server_addr[num_server], server_port[num_server]);
-            num_server++;
-        }
-        else if (!strcmp(key, "req_size_dist"))
-        {
-            sscanf(line, "%s %s", key, dist_file_name);
-            if (verbose_mode)
-                printf("Loading request size distribution: %s\n", dist_file_name);
-
-            req_size_dist = (struct cdf_table*)malloc(sizeof(struct cdf_table));
-            if (!req_size_dist)
-            {
-                cleanup();
-                error("Error: malloc req_size_dist");
-            }
+/* set request variables */
+void set_req_variables()
+{
+    unsigned int i = 0;
 
-            init_cdf(req_size_dist);
-            load_cdf(req_size_dist, dist_file_name);
-            if (verbose_mode)
-            {
-                printf("===========================================\n");
-                print_cdf(req_size_dist);
-                printf("Average request size: %.2f bytes\n", avg_cdf(req_size_dist));
-                printf("===========================================\n");
-            }
-        }
-        else if (!strcmp(key, "dscp"))
+    /* sizes and arrival times come from the trace */
+    if (strlen(trace_file_name) > 0)
+    {
+        if (!open_trace(&trace, trace_file_name, config.server_addr, config.server_port, config.num_server))
         {
-            sscanf(line, "%s %u %u", key, &dscp_value[num_dscp], &dscp_prob[num_dscp]);
-            if (dscp_value[num_dscp] < 0 || dscp_value[num_dscp] >= 64)
-            {
-                cleanup();
-                error("Invalid DSCP value");
-            }
-            else if (dscp_prob[num_dscp] < 0)
-            {
-                cleanup();
-                error("Invalid DSCP probability value");
-            }
-            dscp_prob_total += dscp_prob[num_dscp];
-            if (verbose_mode)
-                printf("DSCP: %u, Prob: %u\n", dscp_value[num_dscp], dscp_prob[num_dscp]);
-            num_dscp++;
+            cleanup();
+            error("Error: open the trace file");
         }
-        else if (!strcmp(key, "rate"))
+    }
+    /* calculate average request arrival interval */
+    else if (load > 0)
+    {
+        period_us = avg_cdf(config.req_size_dist) * 8 / load / TG_GOODPUT_RATIO;
+        if (period_us <= 0)
         {
-            sscanf(line, "%s %uMbps %u", key, &rate_value[num_rate], &rate_prob[num_rate]);
-            if (rate_value[num_rate] < 0)
-            {
-                cleanup();
-                error("Invalid sending rate value");
-            }
-            else if (rate_prob[num_rate] < 0)
-            {
-                cleanup();
-                error("Invalid sending rate probability value");
-            }
-            rate_prob_total += rate_prob[num_rate];
-            if (verbose_mode)
-                printf("Rate: %uMbps, Prob: %u\n", rate_value[num_rate], rate_prob[num_rate]);
-            num_rate++;
+            cleanup();
+            error("Error: period_us is not positive");
         }
     }
+    else
+    {
+        cleanup();
+        error("Error: load is not positive");
+    }
 
-    fclose(fd);
+    /* all slots are free at the beginning */
+    flow_slots = (struct flow_slot*)calloc(TG_MAX_OUTSTANDING_FLOWS, sizeof(struct flow_slot));
+    if (!flow_slots)
+    {
+        cleanup();
+        error("Error: calloc flow_slots");
+    }
+    for (i = 0; i < TG_MAX_OUTSTANDING_FLOWS; i++)
+        flow_slots[i].next_free = (i + 1 < TG_MAX_OUTSTANDING_FLOWS) ? i + 2 : 0;
+    free_slot = 1;
 
-    /* by default, DSCP value is 0 */
-    if (num_dscp == 0)
+    pending_head = (unsigned int*)calloc(config.num_server, sizeof(unsigned int));
+    pending_tail = (unsigned int*)calloc(config.num_server, sizeof(unsigned int));
+    if (!pending_head || !pending_tail)
     {
-        num_dscp = 1;
-        dscp_value[0] = 0;
-        dscp_prob[0] = 100;
-        dscp_prob_total = dscp_prob[0];
-        if (verbose_mode)
-            printf("DSCP: %u, Prob: %u\n", dscp_value[0], dscp_prob[0]);
+        cleanup();
+        error("Error: calloc pending slots");
     }
 
-    /* by default, no rate limiting */
-    if (num_rate == 0)
+    size_fct_hists = (struct hist_table*)malloc(num_receivers * TG_FCT_SIZE_RANGES * sizeof(struct hist_table));
+    dscp_fct_hists = (struct hist_table*)malloc(num_receivers * TG_DSCP_VALUES * sizeof(struct hist_table));
+    server_fct_hists = (struct hist_table*)malloc(num_receivers * config.num_server * sizeof(struct hist_table));
+    if (!size_fct_hists || !dscp_fct_hists || !server_fct_hists)
     {
-        num_rate = 1;
-        rate_value[0] = 0;
-        rate_prob[0] = 100;
-        rate_prob_total = rate_prob[0];
-        if (verbose_mode)
-            printf("Rate: %uMbps, Prob: %u\n", rate_value[0], rate_prob[0]);
+        cleanup();
+        error("Error: malloc FCT histograms");
+    }
+    for (i = 0; i < num_receivers * TG_FCT_SIZE_RANGES; i++)
+        init_hist(&size_fct_hists[i]);
+    for (i = 0; i < num_receivers * TG_DSCP_VALUES; i++)
+        init_hist(&dscp_fct_hists[i]);
+    for (i = 0; i < num_receivers * config.num_server; i++)
+        init_hist(&server_fct_hists[i]);
+
+    /* flows are logged once they complete */
+    if (!open_fct_log(&fct_log, fct_log_name, binary_log, TG_RECORD_FLOW))
+    {
+        cleanup();
+        error("Error: open the FCT result file");
     }
 
+    printf("===========================================\n");
+    if (strlen(trace_file_name) > 0 && trace.binary)
+        printf("We replay %llu flows of the binary trace %s\n", trace.num_records, trace_file_name);
+    else if (strlen(trace_file_name) > 0)
+        printf("We replay flows of the CSV trace %s\n", trace_file_name);
+    if (strlen(trace_file_name) > 0 && trace_scale != 1)
+        printf("Arrival times of the trace are scaled by %.3f\n", trace_scale);
+
+    if (req_total_num > 0)
+        printf("We generate %u requests in total\n", req_total_num);
+    else if (req_total_time > 0)
+        printf("We generate requests for %u s\n", req_total_time);
+    if (strlen(trace_file_name) == 0)
+        printf("The average request arrival interval is %u us\n", period_us);
+    printf("At most %u flows can be outstanding\n", TG_MAX_OUTSTANDING_FLOWS);
 }
 
-/* set request variables */
-void set_req_variables()
+/* record the completion of a flow (called by receiver threads). Return false if the flow is not outstanding. */
+bool finish_flow(unsigned int receiver_id, struct flow_metadata *flow, struct timeval *resp_time, struct timeval *stop_time)
 {
-    int i = 0;
-    unsigned long req_size_total = 0;
-    unsigned long req_interval_total = 0;
-    unsigned long rate_total = 0;
-    double dscp_total = 0;
-
-    /* calculate average request arrival interval */
-    if (load > 0)
+    struct flow_slot *slot = NULL;
+    struct fct_record_ext r = {{0}};
+    unsigned long long fct_us;
+    unsigned long long start_us;
+    long long transit_us, queue_us;
+    bool in_use = false;
+
+    /* the flow ID is echoed by the server */
+    if (flow->id < 1 || flow->id > TG_MAX_OUTSTANDING_FLOWS)
+        return false;
+    slot = &flow_slots[flow->id - 1];
+    pthread_mutex_lock(&slot_lock);
+    in_use = slot->in_use;
+    slot->in_use = false;
+    pthread_mutex_unlock(&slot_lock);
+    if (!in_use)
+        return false;
+
+    start_us = (unsigned long long)slot->start_time.tv_sec * 1000000 + slot->start_time.tv_usec;
+    fct_us = (stop_time->tv_sec - slot->start_time.tv_sec) * 1000000 + stop_time->tv_usec - slot->start_time.tv_usec;
+
+    r.base.type = TG_RECORD_FLOW;
+    r.base.start_s = slot->start_time.tv_sec;
+    r.base.start_us = slot->start_time.tv_usec;
+    r.base.fct_us = fct_us;
+    r.base.size = slot->size;
+    r.base.req_id = slot->req_id;
+    r.base.server_id = slot->server_id;
+    r.base.rate = slot->rate;
+    r.base.dscp = slot->dscp;
+    r.resp_fct_us = (stop_time->tv_sec - resp_time->tv_sec) * 1000000 + stop_time->tv_usec - resp_time->tv_usec;
+
+    /*
+     * Split FCT with the timestamps of the server (the clocks should be synchronized).
+     * With skewed clocks, the split does not fit in the FCT and is left out.
+     */
+    if (flow->server_recv_us > 0)
     {
-        period_us = avg_cdf(req_size_dist) * 8 / load / TG_GOODPUT_RATIO;
-        if (period_us <= 0)
+        transit_us = (long long)(flow->server_recv_us - start_us);
+        queue_us = (long long)(flow->server_send_us - flow->server_recv_us);
+        if (transit_us >= 0 && queue_us >= 0 && transit_us + queue_us <= (long long)fct_us &&
+            transit_us <= INT_MAX && queue_us <= INT_MAX)
         {
-            cleanup();
-            error("Error: period_us is not positive");
+            r.base.type |= TG_RECORD_SERVER_TIME;
+            r.transit_us = (int)transit_us;
+            r.queue_us = (int)queue_us;
         }
     }
-    else
-    {
-        cleanup();
-        error("Error: load is not positive");
-    }
 
-    /* transfer time to the number of requests */
-    if (req_total_num == 0 && req_total_time > 0)
-        req_total_num = max((unsigned long)req_total_time * 1000000 / period_us, 1);
+    append_fct_log(&fct_log, &r.base);
 
-    /* request variables */
-    req_size = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
-    req_server_id = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
-    req_dscp = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
-    req_rate = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
-    req_sleep_us = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
-    req_start_time = (struct timeval*)calloc(req_total_num, sizeof(struct timeval));
-    req_stop_time = (struct timeval*)calloc(req_total_num, sizeof(struct timeval));
+    record_hist(&size_fct_hists[receiver_id * TG_FCT_SIZE_RANGES + get_size_range(slot->size)], fct_us);
+    record_hist(&dscp_fct_hists[receiver_id * TG_DSCP_VALUES + slot->dscp % TG_DSCP_VALUES], fct_us);
+    record_hist(&server_fct_hists[receiver_id * config.num_server + slot->server_id], fct_us);
+    __atomic_fetch_add(&req_finished, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&slot_lock);
+    slot->next_free = free_slot;
+    free_slot = flow->id;
+    pthread_mutex_unlock(&slot_lock);
+    return true;
+}
 
-    if (!req_size || !req_server_id || !req_dscp || !req_rate || !req_sleep_us || !req_start_time || !req_stop_time)
+/* get the flow size range of FCT statistics */
+unsigned int get_size_range(unsigned long long size)
+{
+    if (size < 100 * 1024)
+        return 0;
+    else if (size < 10 * 1024 * 1024)
+        return 1;
+    else
+        return 2;
+}
+
+/* merge the FCT histograms of all receivers into those of receiver 0 (after receivers stop recording) */
+void merge_fct_hists()
+{
+    unsigned int i = 0, j = 0;
+
+    for (i = 1; i < num_receivers; i++)
     {
-        cleanup();
-        error("Error: calloc per-request variables");
+        for (j = 0; j < TG_FCT_SIZE_RANGES; j++)
+            merge_hist(&size_fct_hists[j], &size_fct_hists[i * TG_FCT_SIZE_RANGES + j]);
+        for (j = 0; j < TG_DSCP_VALUES; j++)
+            merge_hist(&dscp_fct_hists[j], &dscp_fct_hists[i * TG_DSCP_VALUES + j]);
+        for (j = 0; j < config.num_server; j++)
+            merge_hist(&server_fct_hists[j], &server_fct_hists[i * config.num_server + j]);
     }
+}
 
-    for (i = 0; i < req_total_num; i++)
-    {
-        req_size[i] = gen_random_cdf(req_size_dist);    /* flow size */
-        req_server_id[i] = rand() % num_server; /* server ID */
-        server_req_count[req_server_id[i]]++;   /* per-server request number */
-        req_dscp[i] = gen_value_weight(dscp_value, dscp_prob, num_dscp, dscp_prob_total);    /* flow DSCP */
-        req_rate[i] = gen_value_weight(rate_value, rate_prob, num_rate, rate_prob_total);   /* flow sending rate */
-        req_sleep_us[i] = poission_gen_interval(1.0/period_us); /* sleep interval based on poission process */
+/* print FCT percentiles (of receiver 0 after merge_fct_hists()) */
+void print_fct_hists()
+{
+    struct hist_table *total = (struct hist_table*)malloc(sizeof(struct hist_table));
+    char name[80] = {0};
+    unsigned int i = 0, j = 0;
 
-        req_size_total += req_size[i];
-        req_interval_total += req_sleep_us[i];
-        dscp_total += req_dscp[i];
-        rate_total += req_rate[i];
+    if (!total)
+    {
+        perror("Error: malloc FCT histogram");
+        return;
     }
 
     printf("===========================================\n");
-    printf("We generate %u requests in total\n", req_total_num);
+    printf("Flow completion times (FCT) percentiles\n");
+    printf("===========================================\n");
 
-    for (i = 0; i < num_server; i++)
-        printf("%s:%u    %u requests\n", server_addr[i], server_port[i], server_req_count[i]);
+    init_hist(total);
+    for (i = 0; i < TG_FCT_SIZE_RANGES; i++)
+        merge_hist(total, &size_fct_hists[i]);
+    print_hist(total, "Overall");
 
-    printf("===========================================\n");
-    printf("The average request arrival interval is %lu us\n", req_interval_total/req_total_num);
-    printf("The average request size is %lu bytes\n", req_size_total/req_total_num);
-    printf("The average DSCP value is %.2f\n", dscp_total/req_total_num);
-    printf("The average flow sending rate is %lu Mbps\n", rate_total/req_total_num);
-    printf("The expected experiment duration is %lu s\n", req_interval_total/1000000);
+    for (i = 0; i < TG_FCT_SIZE_RANGES; i++)
+        print_hist(&size_fct_hists[i], size_range_name[i]);
+
+    /* DSCP values of the configuration file, and other values of the trace */
+    for (i = 0; i < TG_DSCP_VALUES; i++)
+    {
+        for (j = 0; j < config.num_dscp && config.dscp_value[j] != i; j++);
+        if (j == config.num_dscp && dscp_fct_hists[i].num_value == 0)
+            continue;
+        snprintf(name, sizeof(name), "DSCP %u", i);
+        print_hist(&dscp_fct_hists[i], name);
+    }
+
+    for (i = 0; i < config.num_server; i++)
+    {
+        snprintf(name, sizeof(name), "Server %s:%u", config.server_addr[i], config.server_port[i]);
+        print_hist(&server_fct_hists[i], name);
+    }
+
+    free(total);
 }
 
-/* receive traffic from established connections */
-void *listen_connection(void *ptr)
+/*
+ * Generate flow requests with all shards. Each server is owned by one shard, so
+ * each shard sends the requests to its servers, and only one thread takes
+ * connections from each connection pool.
+ */
+void run_requests()
 {
-    struct conn_node *node = (struct conn_node*)ptr;
-    struct flow_metadata flow;
-    char read_buf[TG_MAX_READ] = {0};
+    unsigned int i = 0, j = 0;
+    struct arrival_schedule schedule;
+    void *(*run_shard)(void*) = (strlen(trace_file_name) > 0) ? run_shard_trace : run_shard_requests;
+
+    /* a shard without any server would be idle */
+    if (num_shards > config.num_server)
+    {
+        printf("Use %u generator threads (one per server)\n", config.num_server);
+        num_shards = config.num_server;
+    }
+
+    shards = (struct generator_shard*)calloc(num_shards, sizeof(struct generator_shard));
+    if (!shards)
+    {
+        cleanup();
+        error("Error: calloc shards");
+    }
+
+    /*
+     * The requests to each server are sampled from its own random stream of the seed. With -n,
+     * each server gets an equal share of the requests. Hence, the generated requests do not
+     * depend on the number of shards.
+     */
+    if (strlen(trace_file_name) > 0 && !init_trace_splitter(&trace_splitter, &trace, num_shards, req_total_num))
+    {
+        cleanup();
+        error("Error: init_trace_splitter");
+    }
 
-    while (true)
+    for (i = 0; i < num_shards; i++)
     {
-        if (!read_flow_metadata(node->sockfd, &flow))
+        shards[i].id = i;
+        if (strlen(trace_file_name) > 0)
+            continue;
+
+        shards[i].num_streams = (config.num_server - i + num_shards - 1) / num_shards;   /* servers ID, ID + num_shards, ... */
+        shards[i].streams = (struct server_stream*)calloc(shards[i].num_streams, sizeof(struct server_stream));
+        if (!shards[i].streams)
         {
-            perror("Error: read meatadata");
-            break;
+            cleanup();
+            error("Error: calloc server streams");
         }
 
-        if (read_exact(node->sockfd, read_buf, flow.size, TG_MAX_READ, true) != flow.size)
+        for (j = 0; j < shards[i].num_streams; j++)
+            init_server_stream(&(shards[i].streams[j]), i + j * num_shards, seed, 1.0 / config.num_server / period_us, config.num_server, req_total_num);
+
+        if (!init_stream_heap(&(shards[i].heap), shards[i].streams, shards[i].num_streams, req_total_num > 0))
         {
-            perror("Error: receive flow");
-            break;
+            cleanup();
+            exit(EXIT_FAILURE);
         }
+    }
 
-        node->busy = false;
-        pthread_mutex_lock(&(node->list->lock));
-        /* not the special flow ID */
-        if (flow.id != 0)
+    /* all shards share the start of the schedule */
+    for (i = 0; i < num_shards; i++)
+        init_arrival_schedule(&(shards[i].schedule), spin_us);
+
+    /* the main thread runs the only shard */
+    if (num_shards == 1)
+        run_shard((void*)&shards[0]);
+    else
+    {
+        for (i = 0; i < num_shards; i++)
         {
-            node->list->flow_finished++;
-            node->list->available_len++;
+            if (pthread_create(&(shards[i].thread), NULL, run_shard, (void*)&shards[i]) != 0)
+            {
+                cleanup();
+                error("Error: create generator pthread");
+            }
         }
-        /* Ohterwise, it's a special flow ID to terminate connection.
-           So this connection will no longer be available. */
-        pthread_mutex_unlock(&(node->list->lock));
+        for (i = 0; i < num_shards; i++)
+            pthread_join(shards[i].thread, NULL);
+    }
+    if (!verbose_mode)
+        printf("\n");
 
-        /* a special flow ID to terminate persistent connection */
-        if (flow.id == 0)
-            break;
-        else
-            gettimeofday(&req_stop_time[flow.id - 1], NULL);
+    memset(&schedule, 0, sizeof(schedule));
+    for (i = 0; i < num_shards; i++)
+    {
+        if (verbose_mode && num_shards > 1)
+        {
+            printf("Generator %u: ", i);
+            print_arrival_schedule(&(shards[i].schedule));
+        }
+        merge_arrival_schedule(&schedule, &(shards[i].schedule));
     }
+    print_arrival_schedule(&schedule);
+}
 
-    close(node->sockfd);
-    node->connected = false;
-    node->busy = false;
+/*
+ * Generate flow requests to servers owned by a shard. Each request is sampled just before it is
+ * sent. The requests to each server form a Poisson process whose rate is 1 / num_server of the
+ * total, and the shard sends the earliest request of its servers, which is on top of its heap.
+ */
+void *run_shard_requests(void *ptr)
+{
+    struct generator_shard *shard = (struct generator_shard*)ptr;
+    double avg_rate = 1.0 / config.num_server / period_us;
+    unsigned long long total_us = (unsigned long long)req_total_time * 1000000;
+    struct sampled_request req;
+    unsigned int sleep_us;
+
+    /* the request of the server with the earliest arrival */
+    while (sample_request(&(shard->heap), &config, avg_rate, total_us, &req))
+    {
+        sleep_us = req.time_us - shard->elapsed_us;
+        issue_request(shard, req.server_id, req.size, req.dscp, req.rate, sleep_us);
+    }
 
     return (void*)0;
 }
 
-/* generate flow requests */
-void run_requests()
+/*
+ * Replay the flows of the trace to servers owned by a shard. The trace is parsed once by the
+ * splitter, which queues each flow for the shard owning its server. With -n, only the first -n
+ * flows of the trace are replayed.
+ */
+void *run_shard_trace(void *ptr)
 {
-    unsigned int i = 0;
-    unsigned int k = 1;
-    unsigned int sleep_us = 0;
-
-    for (i = 0; i < req_total_num; i++)
+    struct generator_shard *shard = (struct generator_shard*)ptr;
+    unsigned long long total_us = (unsigned long long)req_total_time * 1000000;
+    unsigned long long arrival_us;
+    struct trace_batch batch = {NULL, 0, 0};
+    struct trace_record *r = NULL;
+    unsigned int i;
+
+    while (take_trace_batch(&trace_splitter, shard->id, &batch))
     {
-        sleep_us += req_sleep_us[i];
-        if (sleep_us > usleep_overhead_us)
+        for (i = 0; i < batch.len; i++)
         {
-            usleep(sleep_us - usleep_overhead_us);
-            sleep_us = 0;
-        }
-        run_request(i);
+            r = &(batch.records[i]);
+            arrival_us = (unsigned long long)(r->time_ns * trace_scale / 1000);
+            if (req_total_time > 0 && arrival_us > total_us)
+                break;
 
-        if (!verbose_mode && i + 1 >= k * req_total_num / 100)
-        {
-            display_progress(i + 1, req_total_num);
-            k++;
+            /* flows out of order are sent at once */
+            arrival_us = max(arrival_us, shard->elapsed_us);
+            issue_request(shard, r->server_id % config.num_server, r->size, r->dscp, r->rate,
+                          arrival_us - shard->elapsed_us);
         }
+
+        if (i < batch.len)
+            break;
     }
-    if (!verbose_mode)
-        printf("\n");
+
+    /* the other generator threads must not wait for records of this one */
+    leave_trace_splitter(&trace_splitter, shard->id);
+    free(batch.records);
+    return (void*)0;
 }
 
-/* generate a flow request to the server */
-void run_request(unsigned int req_id)
+/* send a flow request at its arrival time, sleep_us after the previous request of the shard */
+void issue_request(struct generator_shard *shard, unsigned int server_id, unsigned long long size, unsigned int dscp, unsigned int rate, unsigned int sleep_us)
 {
-    unsigned int server_id = req_server_id[req_id];
-    int sockfd;
-    struct flow_metadata flow;
-    struct conn_node* node = search_conn_list(&connection_lists[server_id]);
+    unsigned int req_id, slot_id;
+    unsigned int n = 0;
+
+    shard->elapsed_us += sleep_us;
+    req_id = __atomic_fetch_add(&req_issued, 1, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&server_req_count[server_id], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&req_size_total, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&req_dscp_total, dscp, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&req_rate_total, rate, __ATOMIC_RELAXED);
+
+    wait_arrival(&(shard->schedule), sleep_us);
+    slot_id = alloc_flow_slot();
+    if (slot_id == 0)
+    {
+        if (verbose_mode)
+            printf("Too many outstanding flows to send request %u\n", req_id);
+        __atomic_fetch_add(&req_failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    flow_slots[slot_id - 1].req_id = req_id;
+    flow_slots[slot_id - 1].server_id = server_id;
+    flow_slots[slot_id - 1].size = size;
+    flow_slots[slot_id - 1].dscp = dscp;
+    flow_slots[slot_id - 1].rate = rate;
+    if (!run_request(slot_id))
+    {
+        free_flow_slot(slot_id);
+        __atomic_fetch_add(&req_failed, 1, __ATOMIC_RELAXED);
+    }
+
+    /* the shard which generates the request crossing a percentage displays progress */
+    if (verbose_mode)
+        return;
+    if (req_total_num > 0)
+    {
+        n = req_id + 1;
+        if (n * 100ULL / req_total_num != (n - 1) * 100ULL / req_total_num)
+            display_progress(n, req_total_num);
+    }
+    else if (shard->id == 0 && shard->elapsed_us / 1000000 != (shard->elapsed_us - sleep_us) / 1000000)
+    {
+        if (req_total_time > 0)
+            printf("Generate requests %llu / %u s\r", shard->elapsed_us / 1000000, req_total_time);
+        else
+            printf("Replay requests %llu s\r", shard->elapsed_us / 1000000);
+        fflush(stdout);
+    }
+}
+
+/* take a free flow slot and return its ID (0 if all slots are in use) */
+unsigned int alloc_flow_slot()
+{
+    unsigned int slot_id;
+
+    pthread_mutex_lock(&slot_lock);
+    slot_id = free_slot;
+    if (slot_id > 0)
+    {
+        free_slot = flow_slots[slot_id - 1].next_free;
+        flow_slots[slot_id - 1].in_use = true;
+    }
+    pthread_mutex_unlock(&slot_lock);
+
+    return slot_id;
+}
+
+/* return a flow slot to the free list */
+void free_flow_slot(unsigned int slot_id)
+{
+    pthread_mutex_lock(&slot_lock);
+    flow_slots[slot_id - 1].in_use = false;
+    flow_slots[slot_id - 1].next_free = free_slot;
+    free_slot = slot_id;
+    pthread_mutex_unlock(&slot_lock);
+}
+
+/* generate a flow request of a slot to the server and return true if it succeeds */
+bool run_request(unsigned int slot_id)
+{
+    struct flow_slot *slot = &flow_slots[slot_id - 1];
+    unsigned int server_id = slot->server_id;
+    struct conn_node* node = pop_conn_list(&connection_lists[server_id]);
     unsigned int active_connections = 0;
     unsigned int i = 0;
 
-    flow.id = req_id + 1;   /* we reserve flow ID 0 for special usage */
-    flow.size = req_size[req_id];
-    flow.tos = req_dscp[req_id] << 2;   /* ToS = DSCP * 4 */
-    flow.rate = req_rate[req_id];
-
-    /* cannot find available connection. Need to establish new connections. */
+    /*
+     * Cannot find available connection. The request waits for the pool manager to
+     * establish a new connection, so that the generator never blocks on a handshake.
+     */
     if (!node)
     {
-        if (insert_conn_list(&connection_lists[server_id], 1))
-        {
-            node = connection_lists[server_id].tail;
-            if (verbose_mode)
-                printf("[%u] Establish a new connection to %s:%u (available/total = %u/%u)\n", ++num_new_conn, server_addr[server_id], server_port[server_id], node->list->available_len, node->list->len);
-            pthread_create(&(node->thread), NULL, listen_connection, (void*)node);
-        }
+        pthread_mutex_lock(&pending_lock);
+        slot->next_free = 0;
+        if (pending_head[server_id] == 0)
+            pending_head[server_id] = slot_id;
         else
-        {
-            if (verbose_mode)
-                printf("Cannot establish a new connection to %s:%u\n", server_addr[server_id], server_port[server_id]);
-            return;
-        }
+            flow_slots[pending_tail[server_id] - 1].next_free = slot_id;
+        pending_tail[server_id] = slot_id;
+        pthread_mutex_unlock(&pending_lock);
+
+        request_conn_list(&connection_lists[server_id]);
+        return true;
     }
 
-    if (verbose_mode && (req_id % 100 == 0))
+    if (verbose_mode && (slot->req_id % 100 == 0))
     {
         active_connections = 0;
-        for (i = 0; i< num_server; i++)
-            active_connections += connection_lists[i].len - connection_lists[i].available_len;
+        for (i = 0; i< config.num_server; i++)
+            active_connections += connection_lists[i].len - get_available_conn_list(&connection_lists[i]);
         printf("Concurrent active connections: %u\n", active_connections);
     }
 
+    return send_request(slot_id, node);
+}
+
+/* send the flow request of a slot on a connection and return true if it succeeds */
+bool send_request(unsigned int slot_id, struct conn_node *node)
+{
+    struct flow_slot *slot = &flow_slots[slot_id - 1];
+    struct flow_metadata flow = {0};
+
+    flow.id = slot_id;  /* we reserve flow ID 0 for special usage */
+    flow.size = slot->size;
+    flow.tos = slot->dscp << 2;    /* ToS = DSCP * 4 */
+    flow.rate = slot->rate;
+
     /* Send request and record start time */
-    gettimeofday(&req_start_time[req_id], NULL);
-    sockfd = node->sockfd;
-    node->busy = true;
-    pthread_mutex_lock(&(node->list->lock));
-    node->list->available_len--;
-    pthread_mutex_unlock(&(node->list->lock));
+    gettimeofday(&(slot->start_time), NULL);
 
-    if (!write_flow_req(sockfd, &flow))
+    if (!write_flow_req(node->sockfd, &flow, node->version))
+    {
         perror("Error: generate request");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Take a new connection from the pool manager (NULL if it cannot be established).
+ * It starts receiving flows first, then requests waiting for a connection to the server
+ * are sent on it before it joins the pool. The requests are taken from the queue first
+ * and sent without pending_lock, so that generators are not stalled by the writes.
+ */
+void prepare_conn(struct conn_list *list, struct conn_node *node)
+{
+    unsigned int server_id = list->index;
+    unsigned int slot_id, next = 0, last = 0, num_taken = 0, num_flows = 0;
+    bool broken = false, more = false;
+
+    /* the responses of requests sent on a connection which cannot receive flows would never come */
+    if (node && !add_receiver_conn(node))
+    {
+        printf("Error: cannot receive flows on a new connection to %s:%u\n", list->ip, list->port);
+        drop_conn_node(node);
+        node = NULL;
+    }
+
+    /* take the waiting requests this connection can carry (all of them if there is no connection) */
+    pthread_mutex_lock(&pending_lock);
+    next = pending_head[server_id];
+    for (slot_id = next; slot_id > 0 && (!node || num_taken < list->depth); slot_id = flow_slots[slot_id - 1].next_free)
+    {
+        last = slot_id;
+        num_taken++;
+    }
+    pending_head[server_id] = slot_id;
+    if (last > 0)
+        flow_slots[last - 1].next_free = 0;
+    pthread_mutex_unlock(&pending_lock);
+
+    for (slot_id = next; slot_id > 0; slot_id = next)
+    {
+        next = flow_slots[slot_id - 1].next_free;
+        if (node && send_request(slot_id, node))
+        {
+            num_flows++;
+            continue;
+        }
+
+        free_flow_slot(slot_id);
+        __atomic_fetch_add(&req_failed, 1, __ATOMIC_RELAXED);
+        /* do not send the other requests on a broken connection: they wait for a new one */
+        if (node)
+        {
+            broken = true;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&pending_lock);
+    if (broken && next > 0)
+    {
+        flow_slots[last - 1].next_free = pending_head[server_id];
+        if (pending_head[server_id] == 0)
+            pending_tail[server_id] = last;
+        pending_head[server_id] = next;
+    }
+    more = (pending_head[server_id] > 0);
+    pthread_mutex_unlock(&pending_lock);
+
+    /* a connection cannot take all waiting requests */
+    if (more)
+        request_conn_list(list);
+
+    if (!node)
+    {
+        if (verbose_mode)
+            printf("Cannot establish a new connection to %s:%u\n", list->ip, list->port);
+        return;
+    }
+
+    /*
+     * A broken connection joins the list only to be closed by its receiver, which the shutdown
+     * wakes up. It never becomes available, even when the flows sent on it complete.
+     */
+    if (broken)
+    {
+        printf("Error: drop a new connection to %s:%u which cannot send requests\n", list->ip, list->port);
+        shutdown(node->sockfd, SHUT_RDWR);
+        add_conn_list(list, node, list->depth + num_flows);
+        request_conn_list(list);
+        return;
+    }
+
+    add_conn_list(list, node, num_flows);
+    if (verbose_mode)
+        printf("[%u] Establish a new connection to %s:%u (available/total = %u/%u)\n", __atomic_add_fetch(&num_new_conn, 1, __ATOMIC_RELAXED), list->ip, list->port, get_available_conn_list(list), list->len);
 }
 
 /* Terminate all existing connections */
@@ -742,7 +1270,7 @@ void exit_connections()
     unsigned int num = 0;
 
     /* Start threads to receive traffic */
-    for (i = 0; i < num_server; i++)
+    for (i = 0; i < config.num_server; i++)
     {
         num = 0;
         ptr = connection_lists[i].head;
@@ -762,7 +1290,7 @@ void exit_connections()
         }
         wait_conn_list(&connection_lists[i]);
         if (verbose_mode)
-            printf("Exit %u/%u connections to %s:%u\n", num, connection_lists[i].len, server_addr[i], server_port[i]);
+            printf("Exit %u/%u connections to %s:%u\n", num, connection_lists[i].len, config.server_addr[i], config.server_port[i]);
     }
 }
 
@@ -770,7 +1298,7 @@ void exit_connections()
 void exit_connection(struct conn_node *node)
 {
     int sockfd;
-    struct flow_metadata flow;
+    struct flow_metadata flow = {0};
     flow.id = 0;   /* a special flow ID to terminate connection */
     flow.size = 100;
     flow.tos = 0;
@@ -780,51 +1308,56 @@ void exit_connection(struct conn_node *node)
         return;
 
     sockfd = node->sockfd;
-    pthread_mutex_lock(&(node->list->lock));
-    node->list->available_len--;
-    pthread_mutex_unlock(&(node->list->lock));
+    /* this connection will no longer be available */
+    __atomic_fetch_sub(&(node->list->available_len), 1, __ATOMIC_RELAXED);
 
-    if (!write_flow_req(sockfd, &flow))
+    if (!write_flow_req(sockfd, &flow, node->version))
         perror("Error: generate request");
 }
 
 void print_statistic()
 {
     unsigned long long duration_us = (tv_end.tv_sec - tv_start.tv_sec) * 1000000 + tv_end.tv_usec - tv_start.tv_usec;
-    unsigned long long req_size_total = 0;
-    unsigned long long fct_us;
-    unsigned int flow_goodput_mbps;    /* per-flow goodput (Mbps) */
+    unsigned long long elapsed_us = 0;  /* scheduled time of the last request arrival */
+    unsigned int req_num = req_finished + req_failed;   /* number of generated requests */
     unsigned int goodput_mbps; /* total goodput (Mbps) */
     unsigned int i = 0;
-    FILE *fd = NULL;
 
-    fd = fopen(fct_log_name, "w");
-    if (!fd)
-        error("Error: open the FCT result file");
-
-    for (i = 0; i < req_total_num; i++)
+    /* flows which are still outstanding never complete */
+    for (i = 0; i < TG_MAX_OUTSTANDING_FLOWS; i++)
     {
-        req_size_total += req_size[i];
-        if ((req_stop_time[i].tv_sec == 0) && (req_stop_time[i].tv_usec == 0))
+        if (flow_slots[i].in_use)
         {
-            printf("Unfinished flow request %u\n", i);
-            continue;
+            printf("Unfinished flow request %u\n", flow_slots[i].req_id);
+            req_num++;
         }
+    }
+    if (req_failed > 0)
+        printf("%u flow requests cannot be sent\n", req_failed);
 
-        fct_us = (req_stop_time[i].tv_sec - req_start_time[i].tv_sec) * 1000000 + req_stop_time[i].tv_usec - req_start_time[i].tv_usec;
-        if (fct_us > 0)
-            flow_goodput_mbps = req_size[i] * 8 / fct_us;
-        else
-            flow_goodput_mbps = 0;
+    close_fct_log(&fct_log);
+
+    for (i = 0; i < num_shards; i++)
+        elapsed_us = max(elapsed_us, shards[i].elapsed_us);
+
+    printf("We generated %u requests in total\n", req_num);
+    for (i = 0; i < config.num_server; i++)
+        printf("%s:%u    %u requests\n", config.server_addr[i], config.server_port[i], server_req_count[i]);
 
-        /* size (bytes), FCT(us), DSCP, sending rate (Mbps), goodput (Mbps) */
-        fprintf(fd, "%u %llu %u %u %u\n", req_size[i], fct_us, req_dscp[i], req_rate[i], flow_goodput_mbps);
+    if (req_num > 0)
+    {
+        printf("The average request arrival interval is %llu us\n", elapsed_us / req_num);
+        printf("The average request size is %llu bytes\n", req_size_total / req_num);
+        printf("The average DSCP value is %.2f\n", (double)req_dscp_total / req_num);
+        printf("The average flow sending rate is %llu Mbps\n", req_rate_total / req_num);
     }
 
-    fclose(fd);
     goodput_mbps = req_size_total * 8 / duration_us;
     printf("The actual RX throughput is %u Mbps\n", (unsigned int)(goodput_mbps/TG_GOODPUT_RATIO));
     printf("The actual duration is %llu s\n", duration_us/1000000);
+    /* all connections are closed: receivers no longer record flows */
+    merge_fct_hists();
+    print_fct_hists();
     printf("===========================================\n");
     printf("Write FCT results to %s\n", fct_log_name);
 }
@@ -834,33 +1367,31 @@ void cleanup()
 {
     unsigned int i = 0;
 
-    free(server_port);
-    free(server_addr);
+    free_client_config(&config);
     free(server_req_count);
 
-    free(dscp_value);
-    free(dscp_prob);
-
-    free(rate_value);
-    free(rate_prob);
-
-    free_cdf(req_size_dist);
-    free(req_size_dist);
-
-    free(req_size);
-    free(req_server_id);
-    free(req_dscp);
-    free(req_rate);
-    free(req_sleep_us);
-    free(req_start_time);
-    free(req_stop_time);
+    free(flow_slots);
+    free(pending_head);
+    free(pending_tail);
+    free(size_fct_hists);
+    free(dscp_fct_hists);
+    free(server_fct_hists);
+    close_fct_log(&fct_log);
+    free_trace_splitter(&trace_splitter);
+    close_trace(&trace);
+    for (i = 0; shards && i < num_shards; i++)
+    {
+        free(shards[i].streams);
+        free_stream_heap(&(shards[i].heap));
+    }
+    free(shards);
 
     if (connection_lists)
     {
         if (verbose_mode)
             printf("===========================================\n");
 
-        for(i = 0; i < num_server; i++)
+        for(i = 0; i < config.num_server; i++)
         {
             if (verbose_mode)
                 printf("Clear connection list %u to %s:%u\n", i, connection_lists[i].ip, connection_lists[i].port);
@@ -1,8 +1,15 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
 #include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/tcp.h>
@@ -14,26 +21,72 @@
 #include "../common/common.h"
 #include "../common/cdf.h"
 #include "../common/conn.h"
+#include "../common/receiver.h"
+#include "../common/fctlog.h"
+
+/* number of requests per schedule chunk. Each chunk is sampled from its own random stream. */
+#define TG_SCHEDULE_CHUNK 65536
+/* interval (us) at which deferred requests check for new connections after all requests arrived */
+#define TG_DEFER_WAIT_US 100
 
 /* the structure of a flow request */
 struct flow_request
 {
     struct conn_node *node;
     struct flow_metadata metadata;
+    unsigned long long start_ns;    /* time when the request is written (CLOCK_MONOTONIC) */
+};
+
+/* a persistent thread to send flow requests of incast requests */
+struct sender
+{
+    unsigned int id;
+    pthread_t thread;
+};
+
+/* consecutive requests of the schedule */
+struct schedule_chunk
+{
+    unsigned int first_req; /* ID of the first request */
+    unsigned int num_req;
+    unsigned int first_flow;    /* ID of the first flow */
+    unsigned int num_flow;
+    struct rng_state rng;   /* random stream of the chunk */
+    unsigned long long size_total;
+    unsigned long long dscp_total;
+    unsigned long long rate_total;
+    unsigned long long interval_total;
+};
+
+/* a thread to sample schedule chunks */
+struct schedule_worker
+{
+    bool sample_flows;  /* sample requests or their flows */
+    unsigned int *server_flow_count;    /* number of flows to each server in its chunks */
+    pthread_t thread;
 };
 
 bool verbose_mode = false;  /* by default, we don't give more detailed output */
+unsigned int num_receivers = TG_RECEIVER_THREADS;   /* number of threads to receive traffic */
 
 char config_file_name[80] = {0};    /* configuration file name */
 char dist_file_name[80] = {0};  /* size distribution file name */
-char log_prefix[] = "log";  /* default */
+char log_prefix[64] = "log";    /* default */
 char fct_log_suffix[] = "flows.txt";
 char rct_log_suffix[] = "reqs.txt";
+char fct_bin_log_suffix[] = "flows.bin";
+char rct_bin_log_suffix[] = "reqs.bin";
 char rct_log_name[80] = {0};    /* request completion times (RCT) log file name */
 char fct_log_name[80] = {0};    /* request flow completion times (FCT) log file name */
+bool binary_log = false;    /* write binary records instead of text lines into log files */
+struct fct_log rct_log; /* log file with request completion times */
+struct fct_log fct_log; /* log file with flow completion times */
 char result_script_name[80] = {0};  /* name of script file to parse final results */
 int seed = 0;   /* random seed */
-unsigned int usleep_overhead_us = 0;    /* usleep overhead */
+double link_capacity = TG_LINK_CAPACITY;   /* capacity of the client link (Mbps) to size connection pools */
+int rcvbuf_size = 0;    /* SO_RCVBUF of connections (0: kernel autotuning) */
+unsigned int spin_us = 0;   /* busy-wait before each request arrival (in microseconds) */
+struct arrival_schedule schedule; /* absolute deadlines of request arrivals */
 struct timeval tv_start, tv_end;    /* start and end time of traffic */
 
 /* per-server variables */
@@ -66,22 +119,42 @@ struct cdf_table *req_size_dist = NULL;
 unsigned int period_us;  /* average request arrival interval (us) */
 
 /* per-request variables */
-unsigned int *req_size = NULL;  /* request size */
+unsigned long long *req_size = NULL;    /* request size */
 unsigned int *req_fanout = NULL;    /* request fanout size */
-unsigned int **req_server_flow_count = NULL;    /* number of flows (of this request) generated by each server */
+unsigned int *req_first_flow = NULL;    /* ID of the first flow of request. Flows of a request are sorted by server ID. */
 unsigned int *req_dscp = NULL;  /* DSCP of request */
 unsigned int *req_rate = NULL;  /* sending rate of request */
 unsigned int *req_sleep_us = NULL;  /* sleep time interval */
 struct timeval *req_start_time = NULL;  /* start time of request */
 struct timeval *req_stop_time = NULL;   /* stop time of request */
+unsigned int *req_flow_finished = NULL; /* number of completed flows of request (accessed atomically) */
 
 /* per-flow variables */
 unsigned int *flow_req_id = NULL;   /* request ID of the flow */
+unsigned int *flow_server_id = NULL;    /* server ID of the flow */
 struct timeval *flow_start_time = NULL; /* start time of flow */
 struct timeval *flow_stop_time = NULL;  /* stop time of flow */
 
 struct conn_list *connection_lists = NULL;  /* connection pool */
 unsigned int global_flow_id = 0;
+unsigned int req_next = 0;  /* ID of the next request to send */
+unsigned int req_deferred = 0;  /* number of requests which waited for new connections */
+
+struct schedule_chunk *schedule_chunks = NULL;
+unsigned int num_schedule_chunks = 0;
+unsigned int next_schedule_chunk = 0;   /* next chunk to sample (accessed atomically) */
+
+/* sender threads, which are released together for each request */
+struct sender *senders = NULL;
+unsigned int num_senders = 0;
+struct flow_request *sender_reqs = NULL;    /* flow requests of the current request */
+unsigned int sender_num_reqs = 0;   /* number of flow requests of the current request */
+int sender_round = 0;   /* incremented to release senders (futex, accessed atomically) */
+int senders_busy = 0;   /* number of senders which have not finished the round (futex, accessed atomically) */
+bool senders_stop = false;  /* senders exit in the next round */
+unsigned long long req_spread_total_ns = 0; /* sum of the spreads of flow start times of requests */
+unsigned long long req_spread_max_ns = 0;
+unsigned int req_spread_num = 0;    /* number of requests with more than one flow */
 
 /* print usage of the program */
 void print_usage(char *program);
@@ -91,14 +164,36 @@ void read_args(int argc, char *argv[]);
 void read_config(char *file_name);
 /* set request variables */
 void set_req_variables();
-/* receive traffic from established connections */
-void *listen_connection(void *ptr);
+/* sample chunks of the schedule with all workers */
+void run_schedule_workers(struct schedule_worker *workers, unsigned int num_workers, bool sample_flows);
+/* sample chunks of the schedule */
+void *run_schedule_worker(void *ptr);
+/* sample the size, fanout, DSCP, sending rate and arrival interval of requests in a chunk */
+void sample_chunk_requests(struct schedule_chunk *chunk);
+/* sample the servers of flows in a chunk */
+void sample_chunk_flows(struct schedule_chunk *chunk, unsigned int *server_flow_count);
+/* record the completion of a flow (called by receiver threads) */
+bool finish_flow(unsigned int receiver_id, struct flow_metadata *flow, struct timeval *resp_time, struct timeval *stop_time);
 /* generate incast requests */
 void run_incast_requests();
-/* generate a incast request to some servers */
-void run_incast_request(unsigned int req_id);
+/* generate a incast request to some servers, or return false to defer it */
+bool run_incast_request(unsigned int req_id);
 /* generate a flow request to a server */
-void *run_flow(void *ptr);
+void run_flow(struct flow_request *f);
+/* start sender threads */
+void start_senders();
+/* stop sender threads */
+void stop_senders();
+/* release all senders to send the flow requests of a round and wait until they finish */
+void release_senders();
+/* a persistent thread to send flow requests */
+void *run_sender(void *ptr);
+/* wait while a futex word is equal to val */
+void futex_wait(int *addr, int val);
+/* wake up all threads waiting on a futex word */
+void futex_wake(int *addr);
+/* add a new connection to its pool and receive flows on it */
+void add_new_conn(struct conn_list *list, struct conn_node *node);
 /* terminate all existing connections */
 void exit_connections();
 /* terminate a connection */
@@ -112,6 +207,9 @@ int main(int argc, char *argv[])
 {
     unsigned int i = 0;
     struct conn_node *ptr = NULL;
+    struct conn_plan plan;
+    double avg_fanout = 0;  /* average number of flows per request */
+    unsigned int num_conn = 0;  /* initial number of connections per server */
 
     /* read program arguments */
     read_args(argc, argv);
@@ -120,25 +218,14 @@ int main(int argc, char *argv[])
     if (seed == 0)
     {
         gettimeofday(&tv_start, NULL);
-        srand((tv_start.tv_sec*1000000) + tv_start.tv_usec);
+        seed = (tv_start.tv_sec*1000000) + tv_start.tv_usec;
     }
-    else
-        srand(seed);
 
     /* read configuration file */
     read_config(config_file_name);
     /* set request variables */
     set_req_variables();
 
-    /* calculate usleep overhead */
-    usleep_overhead_us = get_usleep_overhead(20);
-    if (verbose_mode)
-    {
-        printf("===========================================\n");
-        printf("The usleep overhead is %u us\n", usleep_overhead_us);
-        printf("===========================================\n");
-    }
-
     /* we use calloc here to implicitly initialize struct conn_list as 0 */
     connection_lists = (struct conn_list*)calloc(num_server, sizeof(struct conn_list));
     if (!connection_lists)
@@ -147,6 +234,21 @@ int main(int argc, char *argv[])
         error("Error: calloc connection_lists");
     }
 
+    /* size connection pools for the outstanding flows predicted by the load model of the link */
+    for (i = 0; i < num_fanout; i++)
+        avg_fanout += (double)fanout_size[i] * fanout_prob[i] / fanout_prob_total;
+    /* a request may send all its flows to a server, which leaves the pool at its low water mark */
+    num_conn = max(max_fanout_size + TG_CONN_GROW, TG_PAIR_INIT_CONN);
+    printf("===========================================\n");
+    if (plan_conn_pool(&plan, avg_cdf(req_size_dist), period_us, link_capacity, avg_fanout / num_server,
+                       avg_fanout, rate_value, rate_prob, num_rate))
+    {
+        num_conn = max(num_conn, plan.max_flows);
+        print_conn_plan(&plan, num_server, num_conn, rcvbuf_size);
+    }
+    else
+        printf("Warning: the link is overloaded (%.1f%% of %.0f Mbps), %u connections per server at first\n", plan.load * 100, link_capacity, num_conn);
+
     /* initialize connection pool and establish connections to servers */
     for (i = 0; i < num_server; i++)
     {
@@ -155,7 +257,11 @@ int main(int argc, char *argv[])
             cleanup();
             error("Error: init_conn_list");
         }
-        if (!insert_conn_list(&connection_lists[i], max(max_fanout_size, TG_PAIR_INIT_CONN)))
+        connection_lists[i].rcvbuf = rcvbuf_size;
+        /* keep enough spare connections for the largest request, which waits for new ones otherwise */
+        connection_lists[i].low_water = max_fanout_size;
+        connection_lists[i].grow = max(connection_lists[i].grow, max_fanout_size);
+        if (!insert_conn_list(&connection_lists[i], num_conn))
         {
             cleanup();
             error("Error: insert_conn_list");
@@ -164,28 +270,41 @@ int main(int argc, char *argv[])
             print_conn_list(&connection_lists[i]);
     }
 
-    /* start threads to receive traffic */
+    /* start threads to receive traffic on established connections */
+    if (!start_receivers(num_receivers, finish_flow))
+    {
+        cleanup();
+        error("Error: start_receivers");
+    }
     for (i = 0; i < num_server; i++)
     {
-        ptr = connection_lists[i].head;
-        while (true)
+        for (ptr = connection_lists[i].head; ptr != NULL; ptr = ptr->next)
         {
-            if (!ptr)
-                break;
-            else
+            if (!add_receiver_conn(ptr))
             {
-                pthread_create(&(ptr->thread), NULL, listen_connection, (void*)ptr);
-                ptr = ptr->next;
+                cleanup();
+                error("Error: add_receiver_conn");
             }
         }
     }
 
+    /* open new connections in the background when pools run low */
+    if (!start_conn_manager(connection_lists, num_server, add_new_conn))
+    {
+        cleanup();
+        error("Error: start_conn_manager");
+    }
+    start_senders();
+
     printf("===========================================\n");
     printf("Start to generate requests\n");
     printf("===========================================\n");
     gettimeofday(&tv_start, NULL);
     global_flow_id =  0;
     run_incast_requests();
+    print_arrival_schedule(&schedule);
+    stop_senders();
+    stop_conn_manager();
 
     /* close existing connections */
     printf("===========================================\n");
@@ -204,7 +323,9 @@ int main(int argc, char *argv[])
     cleanup();
 
     /* parse results */
-    if (strlen(result_script_name) > 0)
+    if (strlen(result_script_name) > 0 && binary_log)
+        printf("Convert %s and %s with log2text to parse them with %s\n", fct_log_name, rct_log_name, result_script_name);
+    else if (strlen(result_script_name) > 0)
     {
         char cmd[180] = {0};
         printf("===========================================\n");
@@ -233,8 +354,13 @@ void print_usage(char *program)
     printf("-n <number>     number of requests (instead of -t)\n");
     printf("-t <time>       time in seconds (instead of -n)\n");
     printf("-l <prefix>     log file name prefix (default %s)\n", log_prefix);
+    printf("-f <format>     log file format, text or binary (default text)\n");
     printf("-s <seed>       seed to generate random numbers (default current time)\n");
     printf("-r <file>       python script to parse result files\n");
+    printf("-w <number>     number of threads to receive traffic (default %d)\n", TG_RECEIVER_THREADS);
+    printf("-L <capacity>   capacity of the client link in Mbits/sec to size connection pools (default %d)\n", TG_LINK_CAPACITY);
+    printf("-m <bytes>      SO_RCVBUF of connections (default 0: kernel autotuning)\n");
+    printf("-u <us>         busy-wait for the last microseconds before each request arrival (default 0)\n");
     printf("-v              give more detailed output (verbose)\n");
     printf("-h              display help information\n");
 }
@@ -251,9 +377,6 @@ void read_args(int argc, char *argv[])
         exit(EXIT_SUCCESS);
     }
 
-    sprintf(fct_log_name, "%s_%s", log_prefix, fct_log_suffix);
-    sprintf(rct_log_name, "%s_%s", log_prefix, rct_log_suffix);
-
     while (i < argc)
     {
         if (strlen(argv[i]) == 2 && strcmp(argv[i], "-b") == 0)
@@ -320,10 +443,9 @@ void read_args(int argc, char *argv[])
         }
         else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-l") == 0)
         {
-            if (i+1 < argc && strlen(argv[i+1]) + 1 + strlen(fct_log_suffix) < sizeof(fct_log_name) && strlen(argv[i+1]) + 1 + strlen(rct_log_suffix) < sizeof(rct_log_name))
+            if (i+1 < argc && strlen(argv[i+1]) < sizeof(log_prefix))
             {
-                sprintf(fct_log_name, "%s_%s", argv[i+1], fct_log_suffix);
-                sprintf(rct_log_name, "%s_%s", argv[i+1], rct_log_suffix);
+                sprintf(log_prefix, "%s", argv[i+1]);
                 i += 2;
             }
             else
@@ -333,6 +455,20 @@ void read_args(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
         }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-f") == 0)
+        {
+            if (i+1 < argc && (strcmp(argv[i+1], "text") == 0 || strcmp(argv[i+1], "binary") == 0))
+            {
+                binary_log = (strcmp(argv[i+1], "binary") == 0);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read log file format\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
         else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-s") == 0)
         {
             if (i+1 < argc)
@@ -361,6 +497,80 @@ void read_args(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
         }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-w") == 0)
+        {
+            if (i+1 < argc)
+            {
+                num_receivers = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                if (num_receivers == 0)
+                {
+                    printf("Invalid number of receiver threads\n");
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read number of receiver threads\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-L") == 0)
+        {
+            if (i+1 < argc)
+            {
+                link_capacity = atof(argv[i+1]);
+                if (link_capacity <= 0)
+                {
+                    printf("Invalid link capacity: %f\n", link_capacity);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read link capacity\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-m") == 0)
+        {
+            if (i+1 < argc)
+            {
+                rcvbuf_size = atoi(argv[i+1]);
+                if (rcvbuf_size < 0)
+                {
+                    printf("Invalid receive buffer size\n");
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read receive buffer size\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-u") == 0)
+        {
+            if (i+1 < argc)
+            {
+                spin_us = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read busy-wait time\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
         else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-v") == 0)
         {
             verbose_mode = true;
@@ -401,6 +611,9 @@ void read_args(int argc, char *argv[])
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
+
+    sprintf(fct_log_name, "%s_%s", log_prefix, binary_log ? fct_bin_log_suffix : fct_log_suffix);
+    sprintf(rct_log_name, "%s_%s", log_prefix, binary_log ? rct_bin_log_suffix : rct_log_suffix);
 }
 
 /* read configuration file */
@@ -617,11 +830,13 @@ void read_config(char *file_name)
 /* set request variables */
 void set_req_variables()
 {
-    unsigned int i, k, server_id, flow_id = 0;
+    unsigned int i, k, flow_id = 0;
     unsigned long req_size_total = 0;
     double req_dscp_total = 0;
     unsigned long req_rate_total = 0;
     unsigned long req_interval_total = 0;
+    struct schedule_worker *workers = NULL;
+    unsigned int num_workers = 0;
 
     /* calculate average request arrival interval */
     if (load > 0)
@@ -644,72 +859,110 @@ void set_req_variables()
         req_total_num = max((unsigned long)req_total_time * 1000000 / period_us, 1);
 
     /*per-request variables */
-    req_size = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
+    req_size = (unsigned long long*)calloc(req_total_num, sizeof(unsigned long long));
     req_fanout = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
-    req_server_flow_count = (unsigned int**)calloc(req_total_num, sizeof(unsigned int*));
+    req_first_flow = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
     req_dscp = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
     req_rate = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
     req_sleep_us = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
     req_start_time = (struct timeval*)calloc(req_total_num, sizeof(struct timeval));
     req_stop_time = (struct timeval*)calloc(req_total_num, sizeof(struct timeval));
+    req_flow_finished = (unsigned int*)calloc(req_total_num, sizeof(unsigned int));
 
-    if (!req_size || !req_fanout || !req_server_flow_count || !req_dscp || !req_rate || !req_sleep_us || !req_start_time || !req_stop_time)
+    if (!req_size || !req_fanout || !req_first_flow || !req_dscp || !req_rate || !req_sleep_us || !req_start_time || !req_stop_time ||
+        !req_flow_finished)
     {
         cleanup();
         error("Error: calloc per-request variables");
     }
 
-    /* per request */
-    for (i = 0; i < req_total_num; i++)
+    /*
+     * The schedule is split into chunks of TG_SCHEDULE_CHUNK requests, and chunk i is sampled from
+     * stream i of the seed, so the schedule does not depend on the number of worker threads.
+     */
+    num_schedule_chunks = (req_total_num + TG_SCHEDULE_CHUNK - 1) / TG_SCHEDULE_CHUNK;
+    schedule_chunks = (struct schedule_chunk*)calloc(num_schedule_chunks, sizeof(struct schedule_chunk));
+    num_workers = min(max(sysconf(_SC_NPROCESSORS_ONLN), 1), num_schedule_chunks);
+    workers = (struct schedule_worker*)calloc(num_workers, sizeof(struct schedule_worker));
+    if (!schedule_chunks || !workers)
     {
-        req_server_flow_count[i] = (unsigned int*)calloc(num_server, sizeof(unsigned int));   /* initialize as 0 */
-        if (!req_server_flow_count[i])
+        free(workers);
+        cleanup();
+        error("Error: calloc schedule chunks");
+    }
+
+    for (i = 0; i < num_schedule_chunks; i++)
+    {
+        schedule_chunks[i].first_req = i * TG_SCHEDULE_CHUNK;
+        schedule_chunks[i].num_req = min(req_total_num - schedule_chunks[i].first_req, TG_SCHEDULE_CHUNK);
+        init_rng(&(schedule_chunks[i].rng), seed, i);
+    }
+
+    for (i = 0; i < num_workers; i++)
+    {
+        workers[i].server_flow_count = (unsigned int*)calloc(num_server, sizeof(unsigned int));
+        if (!workers[i].server_flow_count)
         {
+            for (k = 0; k < i; k++)
+                free(workers[k].server_flow_count);
+            free(workers);
             cleanup();
-            error("Error: calloc per-request variables");
+            error("Error: calloc schedule workers");
         }
+    }
 
-        req_size[i] = gen_random_cdf(req_size_dist);    /* request size */
-        req_fanout[i] = gen_value_weight(fanout_size, fanout_prob, num_fanout, fanout_prob_total);  /* request fanout */
-        req_dscp[i] = gen_value_weight(dscp_value, dscp_prob, num_dscp, dscp_prob_total);    /* request DSCP */
-        req_rate[i] = gen_value_weight(rate_value, rate_prob, num_rate, rate_prob_total);   /* sending rate */
-        req_sleep_us[i] = poission_gen_interval(1.0/period_us); /* sleep interval based on poission process */
-
-        req_size_total += req_size[i];
-        req_dscp_total += req_dscp[i];
-        req_rate_total += req_rate[i];
-        req_interval_total += req_sleep_us[i];
-        flow_total_num += req_fanout[i];
+    /* per request */
+    run_schedule_workers(workers, num_workers, false);
 
-        /* each flow in this request */
-        for (k = 0; k < req_fanout[i]; k++)
-        {
-            server_id = rand() % num_server;
-            req_server_flow_count[i][server_id]++;
-            server_flow_count[server_id]++;
-        }
+    for (i = 0; i < num_schedule_chunks; i++)
+    {
+        schedule_chunks[i].first_flow = flow_total_num;
+        flow_total_num += schedule_chunks[i].num_flow;
+        req_size_total += schedule_chunks[i].size_total;
+        req_dscp_total += schedule_chunks[i].dscp_total;
+        req_rate_total += schedule_chunks[i].rate_total;
+        req_interval_total += schedule_chunks[i].interval_total;
     }
 
     /* per-flow variables */
     flow_req_id = (unsigned int*)calloc(flow_total_num, sizeof(unsigned int));
+    flow_server_id = (unsigned int*)calloc(flow_total_num, sizeof(unsigned int));
     flow_start_time = (struct timeval*)calloc(flow_total_num, sizeof(struct timeval));
     flow_stop_time = (struct timeval*)calloc(flow_total_num, sizeof(struct timeval));
 
-    if (!flow_req_id || !flow_start_time || !flow_stop_time)
+    if (!flow_req_id || !flow_server_id || !flow_start_time || !flow_stop_time)
     {
+        for (i = 0; i < num_workers; i++)
+            free(workers[i].server_flow_count);
+        free(workers);
         cleanup();
         error("Error: calloc per-flow variables");
     }
 
-    /* assign request ID to each flow */
-    flow_id = 0;
-    for (i = 0; i < req_total_num; i++)
-        for (k = 0; k < req_fanout[i]; k++)
-            flow_req_id[flow_id++] = i;
+    /* assign request ID and server ID to each flow */
+    run_schedule_workers(workers, num_workers, true);
+
+    for (i = 0; i < num_workers; i++)
+    {
+        for (k = 0; k < num_server; k++)
+            server_flow_count[k] += workers[i].server_flow_count[k];
+        free(workers[i].server_flow_count);
+    }
+    free(workers);
 
+    for (i = 0; i < num_server; i++)
+        flow_id += server_flow_count[i];
     if (flow_id != flow_total_num)
         perror("Not all the flows have request ID");
 
+    /* flows and requests are logged once they complete */
+    if (!open_fct_log(&fct_log, fct_log_name, binary_log, TG_RECORD_INCAST_FLOW) ||
+        !open_fct_log(&rct_log, rct_log_name, binary_log, TG_RECORD_INCAST_REQ))
+    {
+        cleanup();
+        error("Error: open the result files");
+    }
+
     printf("===========================================\n");
     printf("We generate %u requests (%u flows) in total\n", req_total_num, flow_total_num);
 
@@ -726,55 +979,139 @@ void set_req_variables()
     printf("The expected experiment duration is %lu s\n", req_interval_total/1000000);
 }
 
-/* receive traffic from established connections */
-void *listen_connection(void *ptr)
+/* sample chunks of the schedule with all workers */
+void run_schedule_workers(struct schedule_worker *workers, unsigned int num_workers, bool sample_flows)
 {
-    struct conn_node *node = (struct conn_node*)ptr;
-    struct flow_metadata flow;
-    char read_buf[TG_MAX_READ] = {0};
+    unsigned int i = 0;
 
-    while (true)
+    next_schedule_chunk = 0;
+    for (i = 0; i < num_workers; i++)
+        workers[i].sample_flows = sample_flows;
+
+    /* the main thread is the first worker */
+    for (i = 1; i < num_workers; i++)
     {
-        if (!read_flow_metadata(node->sockfd, &flow))
+        if (pthread_create(&(workers[i].thread), NULL, run_schedule_worker, (void*)&workers[i]) != 0)
         {
-            perror("Error: read meatadata");
-            break;
+            cleanup();
+            error("Error: create schedule worker pthread");
         }
+    }
+    run_schedule_worker((void*)&workers[0]);
+    for (i = 1; i < num_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+}
 
-        if (read_exact(node->sockfd, read_buf, flow.size, TG_MAX_READ, true) != flow.size)
-        {
-            perror("Error: receive flow");
-            break;
-        }
+/* sample chunks of the schedule */
+void *run_schedule_worker(void *ptr)
+{
+    struct schedule_worker *worker = (struct schedule_worker*)ptr;
+    unsigned int i;
 
-        node->busy = false;
-        pthread_mutex_lock(&(node->list->lock));
+    while ((i = __atomic_fetch_add(&next_schedule_chunk, 1, __ATOMIC_RELAXED)) < num_schedule_chunks)
+    {
+        if (worker->sample_flows)
+            sample_chunk_flows(&schedule_chunks[i], worker->server_flow_count);
+        else
+            sample_chunk_requests(&schedule_chunks[i]);
+    }
 
-        /* not the special flow ID */
-        if (flow.id != 0)
-        {
-            node->list->flow_finished++;
-            node->list->available_len++;
-        }
-        /* Ohterwise, it's a special flow ID to terminate connection.
-           So this connection will no longer be available. */
-        pthread_mutex_unlock(&(node->list->lock));
+    return (void*)0;
+}
 
-        /* a special flow ID to terminate persistent connection */
-        if (flow.id == 0)
-            break;
-        else
+/* sample the size, fanout, DSCP, sending rate and arrival interval of requests in a chunk */
+void sample_chunk_requests(struct schedule_chunk *chunk)
+{
+    unsigned int i, first = chunk->first_req, last = chunk->first_req + chunk->num_req;
+    struct rng_state *rng = &(chunk->rng);
+
+    /* each attribute is sampled in a tight loop over the chunk */
+    for (i = first; i < last; i++)
+        req_size[i] = gen_random_cdf(req_size_dist, rng);   /* request size */
+    for (i = first; i < last; i++)
+        req_fanout[i] = gen_value_weight(fanout_size, fanout_prob, num_fanout, fanout_prob_total, rng);    /* request fanout */
+    for (i = first; i < last; i++)
+        req_dscp[i] = gen_value_weight(dscp_value, dscp_prob, num_dscp, dscp_prob_total, rng);  /* request DSCP */
+    for (i = first; i < last; i++)
+        req_rate[i] = gen_value_weight(rate_value, rate_prob, num_rate, rate_prob_total, rng);  /* sending rate */
+    for (i = first; i < last; i++)
+        req_sleep_us[i] = poission_gen_interval(1.0/period_us, rng);    /* sleep interval based on poission process */
+
+    for (i = first; i < last; i++)
+    {
+        chunk->size_total += req_size[i];
+        chunk->dscp_total += req_dscp[i];
+        chunk->rate_total += req_rate[i];
+        chunk->interval_total += req_sleep_us[i];
+        chunk->num_flow += req_fanout[i];
+    }
+}
+
+/* sample the servers of flows in a chunk */
+void sample_chunk_flows(struct schedule_chunk *chunk, unsigned int *server_flow_count)
+{
+    unsigned int i, k, j, server_id;
+    unsigned int flow_id = chunk->first_flow;
+
+    for (i = chunk->first_req; i < chunk->first_req + chunk->num_req; i++)
+    {
+        req_first_flow[i] = flow_id;
+        for (k = 0; k < req_fanout[i]; k++)
         {
-            gettimeofday(&flow_stop_time[flow.id - 1], NULL);
-            gettimeofday(&req_stop_time[flow_req_id[flow.id - 1]], NULL);
+            server_id = rand_uint(&(chunk->rng), num_server);
+            server_flow_count[server_id]++;
+
+            /* flows of a request are sent to servers in order */
+            for (j = flow_id + k; j > flow_id && flow_server_id[j - 1] > server_id; j--)
+                flow_server_id[j] = flow_server_id[j - 1];
+            flow_server_id[j] = server_id;
+            flow_req_id[flow_id + k] = i;
         }
+        flow_id += req_fanout[i];
     }
+}
 
-    close(node->sockfd);
-    node->connected = false;
-    node->busy = false;
-
-    return (void*)0;
+/* record the completion of a flow (called by receiver threads). Return false if the flow is not outstanding. */
+bool finish_flow(unsigned int receiver_id, struct flow_metadata *flow, struct timeval *resp_time, struct timeval *stop_time)
+{
+    unsigned int flow_id = flow->id - 1;
+    unsigned int req_id;
+    struct fct_record r = {0};
+
+    /* the flow ID is echoed by the server: it must be a flow which was sent and has not finished */
+    if (flow->id < 1 || flow->id > flow_total_num)
+        return false;
+    if ((flow_start_time[flow_id].tv_sec == 0 && flow_start_time[flow_id].tv_usec == 0) ||
+        flow_stop_time[flow_id].tv_sec != 0 || flow_stop_time[flow_id].tv_usec != 0)
+        return false;
+    req_id = flow_req_id[flow_id];
+
+    flow_stop_time[flow_id] = *stop_time;
+    req_stop_time[req_id] = *stop_time;
+
+    r.type = TG_RECORD_INCAST_FLOW;
+    r.start_s = flow_start_time[flow_id].tv_sec;
+    r.start_us = flow_start_time[flow_id].tv_usec;
+    r.fct_us = (stop_time->tv_sec - flow_start_time[flow_id].tv_sec) * 1000000 + stop_time->tv_usec - flow_start_time[flow_id].tv_usec;
+    r.size = req_size[req_id] / req_fanout[req_id];
+    r.req_id = req_id;
+    r.server_id = flow_server_id[flow_id];
+    r.rate = req_rate[req_id];
+    r.dscp = req_dscp[req_id];
+    append_fct_log(&fct_log, &r);
+
+    /* the last flow completes the request */
+    if (__atomic_add_fetch(&req_flow_finished[req_id], 1, __ATOMIC_ACQ_REL) < req_fanout[req_id])
+        return true;
+
+    r.type = TG_RECORD_INCAST_REQ;
+    r.start_s = req_start_time[req_id].tv_sec;
+    r.start_us = req_start_time[req_id].tv_usec;
+    r.fct_us = (stop_time->tv_sec - req_start_time[req_id].tv_sec) * 1000000 + stop_time->tv_usec - req_start_time[req_id].tv_usec;
+    r.size = req_size[req_id];
+    r.server_id = req_fanout[req_id];   /* fanout */
+    append_fct_log(&rct_log, &r);
+    return true;
 }
 
 /* generate incast requests */
@@ -782,23 +1119,18 @@ void run_incast_requests()
 {
     unsigned int i = 0;
     unsigned int k = 1;
-    unsigned int req_duration_us = 0;
-    int sleep_us = 0;
-    struct timeval req_tv_start, req_tv_end;
+    unsigned long long deadline_ns;
 
+    init_arrival_schedule(&schedule, spin_us);
     for (i = 0; i < req_total_num; i++)
     {
-        gettimeofday(&req_tv_start, NULL);
-        run_incast_request(i);
-        gettimeofday(&req_tv_end, NULL);
-        req_duration_us = (req_tv_end.tv_sec - req_tv_start.tv_sec) * 1000000 + req_tv_end.tv_usec - req_tv_start.tv_usec;
-
-        sleep_us = sleep_us + req_sleep_us[i];
-        if (sleep_us > usleep_overhead_us + req_duration_us)
-        {
-            usleep(sleep_us - usleep_overhead_us - req_duration_us);
-            sleep_us = 0;
-        }
+        /* request i arrives req_sleep_us[i - 1] after request i - 1 */
+        wait_arrival(&schedule, (i > 0) ? req_sleep_us[i - 1] : 0);
+        /* requests are sent in order: deferred requests go first */
+        while (req_next <= i && run_incast_request(req_next))
+            req_next++;
+        if (req_next <= i)
+            req_deferred++;
 
         if (!verbose_mode && i + 1 >= k * req_total_num / 100)
         {
@@ -808,132 +1140,257 @@ void run_incast_requests()
     }
     if (!verbose_mode)
         printf("\n");
+
+    /* wait for the pool manager to open connections for deferred requests */
+    deadline_ns = get_time_ns() + (num_server + 1) * TG_CONN_TIMEOUT_MS * 1000000ULL;
+    while (req_next < req_total_num)
+    {
+        if (run_incast_request(req_next))
+        {
+            req_next++;
+            deadline_ns = get_time_ns() + (num_server + 1) * TG_CONN_TIMEOUT_MS * 1000000ULL;
+        }
+        else if (get_time_ns() > deadline_ns)
+        {
+            printf("Error: no connections for the last %u requests\n", req_total_num - req_next);
+            break;
+        }
+        else
+            usleep(TG_DEFER_WAIT_US);
+    }
 }
 
-/* generate a incast request to some servers */
-void run_incast_request(unsigned int req_id)
+/*
+ * Generate a incast request to some servers. If a server does not have enough available
+ * connections, ask the pool manager for new ones and return false to defer the request.
+ */
+bool run_incast_request(unsigned int req_id)
 {
-    unsigned int conn_id, num_conn, num_conn_new = 0;
+    unsigned int conn_id, num_conn;
     unsigned int i, k = 0;
-    struct flow_request *flow_reqs = (struct flow_request*)malloc(req_fanout[req_id] * sizeof(struct flow_request));
-    pthread_t *threads = (pthread_t*)malloc(req_fanout[req_id] * sizeof(pthread_t));
+    unsigned int flow_id, last_flow = req_first_flow[req_id] + req_fanout[req_id];
+    struct flow_request *flow_reqs = sender_reqs;   /* senders are idle between requests */
     struct conn_node **incast_server_conn = NULL;   /* per-server incast connections */
-    struct conn_node *tail_node = NULL;
+    unsigned long long first_ns, last_ns;
+    bool ready = true;
 
-    if (!flow_reqs || !threads)
+    /* check connections to all servers first, so that the pool manager opens them together */
+    for (flow_id = req_first_flow[req_id]; flow_id < last_flow; flow_id += num_conn)
     {
-        perror("Error: malloc");
-        free(flow_reqs);
-        free(threads);
-        return;
+        /* flows to server i */
+        i = flow_server_id[flow_id];
+        for (num_conn = 1; flow_id + num_conn < last_flow && flow_server_id[flow_id + num_conn] == i; num_conn++);
+
+        if (get_available_conn_list(&connection_lists[i]) < num_conn)
+        {
+            request_conn_list(&connection_lists[i]);
+            ready = false;
+        }
     }
+    if (!ready)
+        return false;
 
     conn_id = 0;
-    /* pre-establish all connections of this incast request*/
-    for (i = 0; i < num_server; i++)
+    for (flow_id = req_first_flow[req_id]; flow_id < last_flow; flow_id += num_conn)
     {
-        num_conn = req_server_flow_count[req_id][i];
-        if (num_conn == 0)  /* no connection to this server */
-            continue;
+        i = flow_server_id[flow_id];
+        for (num_conn = 1; flow_id + num_conn < last_flow && flow_server_id[flow_id + num_conn] == i; num_conn++);
 
-        num_conn_new = max(num_conn - connection_lists[i].available_len, 0);    /* number of new connections we need to establish */
-        if (num_conn_new > 0)
+        incast_server_conn = pop_n_conn_list(&connection_lists[i], num_conn);
+        if (!incast_server_conn)
         {
-            tail_node = connection_lists[i].tail;
-            /* establish new connections */
-            if (insert_conn_list(&connection_lists[i], num_conn_new))
-            {
-                /* start listen_connection threads on new established connections */
-                while (true)
-                {
-                    tail_node = tail_node->next;
-                    if (tail_node)
-                        pthread_create(&(tail_node->thread), NULL, listen_connection, (void*)tail_node);
-                    else
-                        break;
-                }
-
-                if (verbose_mode)
-                    printf("Establish %u new connections to %s:%u (available/total = %u/%u)\n", num_conn_new, server_addr[i], server_port[i], connection_lists[i].available_len, connection_lists[i].len);
-            }
-            else
-            {
-                if (verbose_mode)
-                    printf("Cannot establish %u new connections to %s:%u (available/total = %u/%u)\n", num_conn_new, server_addr[i], server_port[i], connection_lists[i].available_len, connection_lists[i].len);
-
-                perror("Error: insert_conn_list");
-                free(flow_reqs);
-                free(threads);
-                return;
-            }
+            /* connections were closed after the check: give back the ones taken and retry later */
+            for (k = 0; k < conn_id; k++)
+                push_conn_list(flow_reqs[k].node);
+            request_conn_list(&connection_lists[i]);
+            return false;
         }
 
-        incast_server_conn = search_n_conn_list(&connection_lists[i], num_conn);
-        if (incast_server_conn)
+        for (k = 0; k < num_conn; k++)
         {
-            for (k = 0; k < num_conn; k++)
-            {
-                flow_reqs[conn_id].node = incast_server_conn[k];
-                flow_reqs[conn_id].metadata.id = global_flow_id + 1; /* reserve flow ID 0 to terminate connections */
-                flow_reqs[conn_id].metadata.size = req_size[req_id]/req_fanout[req_id];
-                flow_reqs[conn_id].metadata.tos = req_dscp[req_id] * 4;  /* ToS = 4 * DSCP */
-                flow_reqs[conn_id].metadata.rate = req_rate[req_id];
-                conn_id++;
-                global_flow_id++;
-            }
-            free(incast_server_conn);
+            flow_reqs[conn_id].node = incast_server_conn[k];
+            flow_reqs[conn_id].metadata.id = global_flow_id + conn_id + 1; /* reserve flow ID 0 to terminate connections */
+            flow_reqs[conn_id].metadata.size = req_size[req_id]/req_fanout[req_id];
+            flow_reqs[conn_id].metadata.tos = req_dscp[req_id] * 4;  /* ToS = 4 * DSCP */
+            flow_reqs[conn_id].metadata.rate = req_rate[req_id];
+            conn_id++;
         }
-        else
+        free(incast_server_conn);
+    }
+    global_flow_id += conn_id;
+
+    gettimeofday(&req_start_time[req_id], NULL);
+    /* generate requests to servers */
+    sender_num_reqs = req_fanout[req_id];
+    release_senders();
+
+    /* how synchronized the flows of the request are */
+    if (req_fanout[req_id] > 1)
+    {
+        first_ns = last_ns = flow_reqs[0].start_ns;
+        for (i = 1; i < req_fanout[req_id]; i++)
         {
-            perror("Error: search_n_conn_list");
-            free(flow_reqs);
-            free(threads);
-            return;
+            first_ns = min(first_ns, flow_reqs[i].start_ns);
+            last_ns = max(last_ns, flow_reqs[i].start_ns);
         }
+        req_spread_total_ns += last_ns - first_ns;
+        req_spread_max_ns = max(req_spread_max_ns, last_ns - first_ns);
+        req_spread_num++;
     }
+    return true;
+}
+
+/* Generate a flow request to a server */
+void run_flow(struct flow_request *f)
+{
+    struct conn_node *node = f->node;
+    struct timespec ts;
+
+    /* Send request and record start time */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    f->start_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (f->metadata.id > 0)
+        gettimeofday(&flow_start_time[f->metadata.id - 1], NULL);
 
-    if (conn_id != req_fanout[req_id])
+    if (!write_flow_req(node->sockfd, &(f->metadata), node->version))
+        perror("Error: write metadata");
+}
+
+/*
+ * Start a persistent sender thread per flow of the largest request (at most one per CPU).
+ * Sender i is pinned to the i-th CPU the client may run on, and sends flow requests
+ * i, i + num_senders, ... of each request.
+ */
+void start_senders()
+{
+    unsigned int i = 0;
+    int cpu = -1;
+    cpu_set_t allowed, cpuset;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
     {
-        perror("Error: no enough connections");
-        free(flow_reqs);
-        free(threads);
-        return;
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
     }
 
-    gettimeofday(&req_start_time[req_id], NULL);
-    /* generate requests to servers */
-    for (i = 0; i < req_fanout[req_id]; i++)
-        pthread_create(&threads[i], NULL, run_flow, (void*)(&flow_reqs[i]));
+    num_senders = min(max_fanout_size, (unsigned int)CPU_COUNT(&allowed));
+    senders = (struct sender*)calloc(num_senders, sizeof(struct sender));
+    sender_reqs = (struct flow_request*)calloc(max_fanout_size, sizeof(struct flow_request));
+    if (!senders || !sender_reqs)
+    {
+        cleanup();
+        error("Error: calloc senders");
+    }
 
-    for (i = 0; i < req_fanout[req_id]; i++)
-        pthread_join(threads[i], NULL);
+    for (i = 0; i < num_senders; i++)
+    {
+        senders[i].id = i;
+        if (pthread_create(&senders[i].thread, NULL, run_sender, (void*)&senders[i]) != 0)
+        {
+            cleanup();
+            error("Error: create sender pthread");
+        }
 
-    free(flow_reqs);
-    free(threads);
+        /* the next allowed CPU */
+        for (cpu++; cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &allowed); cpu++);
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        if (pthread_setaffinity_np(senders[i].thread, sizeof(cpuset), &cpuset) != 0)
+            printf("Error: pin sender %u to CPU %d\n", i, cpu);
+        else if (verbose_mode)
+            printf("Pin sender %u to CPU %d\n", i, cpu);
+    }
 }
 
-/* Generate a flow request to a server */
-void *run_flow(void *ptr)
+/* stop sender threads */
+void stop_senders()
 {
-    struct flow_request f = *(struct flow_request*)ptr;
-    struct conn_node *node = f.node;
-    int sockfd = node->sockfd;
+    unsigned int i = 0;
 
-    /* Send request and record start time */
-    if (f.metadata.id > 0)
-        gettimeofday(&flow_start_time[f.metadata.id - 1], NULL);
+    __atomic_store_n(&senders_stop, true, __ATOMIC_RELAXED);
+    sender_num_reqs = 0;
+    release_senders();
+    for (i = 0; i < num_senders; i++)
+        pthread_join(senders[i].thread, NULL);
+}
 
-    node->busy = true;
-    pthread_mutex_lock(&(node->list->lock));
-    node->list->available_len--;
-    pthread_mutex_unlock(&(node->list->lock));
+/* release all senders to send the flow requests of a round and wait until they finish */
+void release_senders()
+{
+    int busy;
 
-    if (!write_flow_req(sockfd, &(f.metadata)))
-        perror("Error: write metadata");
+    __atomic_store_n(&senders_busy, num_senders, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sender_round, 1, __ATOMIC_RELEASE);
+    futex_wake(&sender_round);
+
+    while ((busy = __atomic_load_n(&senders_busy, __ATOMIC_ACQUIRE)) > 0)
+        futex_wait(&senders_busy, busy);
+}
+
+/* a persistent thread to send flow requests */
+void *run_sender(void *ptr)
+{
+    struct sender *s = (struct sender*)ptr;
+    int round = 0;
+    unsigned int i;
+    bool stop;
+
+    while (true)
+    {
+        /* wait for the next round */
+        while (__atomic_load_n(&sender_round, __ATOMIC_ACQUIRE) == round)
+            futex_wait(&sender_round, round);
+        round = __atomic_load_n(&sender_round, __ATOMIC_ACQUIRE);
+        stop = __atomic_load_n(&senders_stop, __ATOMIC_RELAXED);
+
+        for (i = s->id; i < sender_num_reqs; i += num_senders)
+            run_flow(&sender_reqs[i]);
+
+        /* the last sender to finish wakes up the request generator */
+        if (__atomic_sub_fetch(&senders_busy, 1, __ATOMIC_ACQ_REL) == 0)
+            futex_wake(&senders_busy);
+
+        if (stop)
+            break;
+    }
 
     return (void*)0;
 }
 
+/* wait while a futex word is equal to val */
+void futex_wait(int *addr, int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/* wake up all threads waiting on a futex word */
+void futex_wake(int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* add a new connection from the pool manager to its pool and receive flows on it */
+void add_new_conn(struct conn_list *list, struct conn_node *node)
+{
+    if (!node)
+    {
+        if (verbose_mode)
+            printf("Cannot establish a new connection to %s:%u\n", list->ip, list->port);
+        return;
+    }
+
+    /* a connection which cannot receive flows would never finish its flows */
+    if (!add_receiver_conn(node))
+    {
+        printf("Error: cannot receive flows on a new connection to %s:%u\n", list->ip, list->port);
+        drop_conn_node(node);
+        return;
+    }
+    add_conn_list(list, node, 0);
+    if (verbose_mode)
+        printf("Establish a new connection to %s:%u (available/total = %u/%u)\n", list->ip, list->port, get_available_conn_list(list), list->len);
+}
+
 /* terminate all existing connections */
 void exit_connections()
 {
@@ -969,13 +1426,15 @@ void exit_connections()
 /* terminate a connection */
 void exit_connection(struct conn_node *node)
 {
-    struct flow_request req;
+    struct flow_request req = {0};
     req.node = node;
     req.metadata.id = 0;
     req.metadata.size = 100;
     req.metadata.tos = 0;
     req.metadata.rate = 0;
 
+    /* this connection will no longer be available */
+    __atomic_fetch_sub(&(node->list->available_len), 1, __ATOMIC_RELAXED);
     run_flow((void*)&req);
 }
 
@@ -983,70 +1442,36 @@ void print_statistic()
 {
     unsigned long long duration_us = (tv_end.tv_sec - tv_start.tv_sec) * 1000000 + tv_end.tv_usec - tv_start.tv_usec;
     unsigned long long req_size_total = 0;
-    unsigned long long fct_us, rct_us;
-    unsigned int flow_goodput_mbps, req_goodput_mbps;   /* per-flow/request goodput (Mbps) */
     unsigned int goodput_mbps;  /* total goodput (Mbps) */
-    unsigned int req_id;
     unsigned int i = 0;
-    FILE *fd = NULL;
-
-    fd = fopen(rct_log_name, "w");
-    if (!fd)
-    {
-        cleanup();
-        error("Error: open the RCT result file");
-    }
 
     for (i = 0; i < req_total_num; i++)
     {
         req_size_total += req_size[i];
         if ((req_stop_time[i].tv_sec == 0) && (req_stop_time[i].tv_usec == 0))
-        {
             printf("Unfinished request %u\n", i);
-            continue;
-        }
-
-        rct_us = (req_stop_time[i].tv_sec - req_start_time[i].tv_sec) * 1000000 + req_stop_time[i].tv_usec - req_start_time[i].tv_usec;
-        if (rct_us > 0)
-            req_goodput_mbps = req_size[i] * 8 / rct_us;
-        else
-            req_goodput_mbps = 0;
-
-        /* request size, RCT(us), DSCP, sending rate (Mbps), goodput (Mbps), fanout */
-        fprintf(fd, "%u %llu %u %u %u %u\n", req_size[i], rct_us, req_dscp[i], req_rate[i], req_goodput_mbps, req_fanout[i]);
-    }
-    fclose(fd);
-
-    fd = fopen(fct_log_name, "w");
-    if (!fd)
-    {
-        cleanup();
-        error("Error: open the FCT result file");
     }
 
     for (i = 0; i < flow_total_num; i++)
     {
         if ((flow_stop_time[i].tv_sec == 0) && (flow_stop_time[i].tv_usec == 0))
-        {
             printf("Unfinished flow %u\n", i);
-            continue;
-        }
-
-        fct_us = (flow_stop_time[i].tv_sec - flow_start_time[i].tv_sec) * 1000000 + flow_stop_time[i].tv_usec - flow_start_time[i].tv_usec;
-        req_id = flow_req_id[i];
-        if (fct_us > 0)
-            flow_goodput_mbps = req_size[req_id] / req_fanout[req_id] * 8 / fct_us;
-        else
-            flow_goodput_mbps = 0;
-
-        /* flow size, FCT(us), DSCP, sending rate (Mbps), goodput (Mbps) */
-        fprintf(fd, "%u %llu %u %u %u\n", req_size[req_id]/req_fanout[req_id], fct_us, req_dscp[req_id], req_rate[req_id], flow_goodput_mbps);
     }
-    fclose(fd);
+
+    close_fct_log(&rct_log);
+    close_fct_log(&fct_log);
 
     goodput_mbps = req_size_total * 8 / duration_us;
     printf("The actual RX throughput is %u Mbps\n", (unsigned int)(goodput_mbps/TG_GOODPUT_RATIO));
     printf("The actual duration is %llu s\n", duration_us/1000000);
+    if (req_deferred > 0)
+        printf("%u requests waited for new connections\n", req_deferred);
+    if (req_next < req_total_num)
+        printf("%u requests were not sent\n", req_total_num - req_next);
+    /* time between the first and the last flow requests of an incast request */
+    if (req_spread_num > 0)
+        printf("The average spread of flow start times in requests is %.2f us (max %.2f us, %u senders)\n",
+               req_spread_total_ns / 1000.0 / req_spread_num, req_spread_max_ns / 1000.0, num_senders);
     printf("===========================================\n");
     printf("Write RCT results to %s\n", rct_log_name);
     printf("Write FCT results to %s\n", fct_log_name);
@@ -1063,6 +1488,8 @@ void cleanup()
 
     free(fanout_size);
     free(fanout_prob);
+    free(senders);
+    free(sender_reqs);
 
     free(dscp_value);
     free(dscp_prob);
@@ -1080,15 +1507,15 @@ void cleanup()
     free(req_sleep_us);
     free(req_start_time);
     free(req_stop_time);
-
-    if (req_server_flow_count)
-    {
-        for(i = 0; i < req_total_num; i++)
-            free(req_server_flow_count[i]);
-    }
-    free(req_server_flow_count);
+    free(req_flow_finished);
+    free(req_first_flow);
+    free(schedule_chunks);
 
     free(flow_req_id);
+    free(flow_server_id);
+
+    close_fct_log(&rct_log);
+    close_fct_log(&fct_log);
     free(flow_start_time);
     free(flow_stop_time);
 
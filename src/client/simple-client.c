@@ -12,7 +12,6 @@
 #include "../common/common.h"
 
 char server_ip[16] = {0};   /* sender IP address */
-char read_buf[TG_MAX_READ] = {1};
 int server_port = TG_SERVER_PORT;   /* sender TCP port */
 struct flow_metadata flow;
 unsigned int flow_number = 10;  /* number of flows */
@@ -33,6 +32,7 @@ int main(int argc, char *argv[])
     struct sockaddr_in serv_addr;   /* server address */
     unsigned int fct_us;
     unsigned int goodput_mbps;
+    unsigned int version;   /* protocol version of the connection */
     flow.size = 1024;  /* flow size in bytes */
     flow.tos = 0;  /* ToS value of flows */
     flow.rate = 0;  /* sending rate of flows */
@@ -60,6 +60,12 @@ int main(int argc, char *argv[])
     if (connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
         error("Error: connect");
 
+    version = negotiate_proto_version(sockfd);
+    if (version == 0)
+        error("Error: negotiate protocol version");
+    if (version < TG_PROTO_V2 && flow.size > 0xFFFFFFFFULL)
+        error("Error: the server does not support flows larger than 4GB");
+
     for (i = 0; i < flow_number; i ++)
     {
         printf("Generate flow request %u\n", i);
@@ -70,20 +76,20 @@ int main(int argc, char *argv[])
 
         gettimeofday(&tv_start, NULL);
 
-        if (!write_flow_req(sockfd, &flow))
+        if (!write_flow_req(sockfd, &flow, version))
             error("Error: generate request");
 
-        if (!read_flow_metadata(sockfd, &flow))
+        if (!read_flow_metadata(sockfd, &flow, version))
             error("Error: read metadata");
 
-        if (read_exact(sockfd, read_buf, flow.size, TG_MAX_READ, true) != flow.size)
+        if (discard_exact(sockfd, flow.size, TG_MAX_DISCARD) != flow.size)
             error("Error: receive flow");
 
         gettimeofday(&tv_end, NULL);
         fct_us = (tv_end.tv_sec - tv_start.tv_sec) * 1000000 + (tv_end.tv_usec - tv_start.tv_usec);
         goodput_mbps = flow.size * 8 / fct_us;
 
-        printf("Flow: ID: %u\nSize: %u bytes ToS: %u Rate: %u Mbps\n", flow.id, flow.size, flow.tos, flow.rate);
+        printf("Flow: ID: %u\nSize: %llu bytes ToS: %u Rate: %u Mbps\n", flow.id, flow.size, flow.tos, flow.rate);
         printf("FCT: %u us Goodput: %u Mbps\n", fct_us, goodput_mbps);
     }
 
@@ -96,7 +102,7 @@ void print_usage(char *program)
     printf("Usage: %s [options]\n", program);
     printf("-s <sender>        IP address of sender (required)\n");
     printf("-p <port>          port number (default %d)\n", TG_SERVER_PORT);
-    printf("-n <bytes>         flow size in bytes (default %u)\n", flow.size);
+    printf("-n <bytes>         flow size in bytes (default %llu)\n", flow.size);
     printf("-q <tos>           Type of Service (ToS) value (default increased from %u)\n", flow.tos);
     printf("-c <count>         number of flows (default %u)\n", flow_number);
     printf("-r <rate (Mbps)>   sending rate of flows (default 0: no rate limiting)\n");
@@ -154,7 +160,7 @@ void read_args(int argc, char *argv[])
         {
             if (i+1 < argc)
             {
-                sscanf(argv[i+1], "%u", &(flow.size));
+                sscanf(argv[i+1], "%llu", &(flow.size));
                 i += 2;
             }
             /* cannot read flow size */
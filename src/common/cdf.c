@@ -11,6 +11,8 @@ void init_cdf(struct cdf_table *table)
     table->max_entry = TG_CDF_TABLE_ENTRY;
     table->min_cdf = 0;
     table->max_cdf = 1;
+    table->guide = NULL;
+    table->num_guide = 0;
 
     if (!(table->entries))
         perror("Error: malloc entries in init_cdf()");
@@ -20,7 +22,55 @@ void init_cdf(struct cdf_table *table)
 void free_cdf(struct cdf_table *table)
 {
     if (table)
+    {
         free(table->entries);
+        free(table->guide);
+    }
+}
+
+/* get the guide entry of a CDF value */
+static int get_cdf_guide(struct cdf_table *table, double cdf)
+{
+    int k;
+
+    if (table->max_cdf <= table->min_cdf || cdf <= table->min_cdf)
+        return 0;
+
+    k = (int)((cdf - table->min_cdf) / (table->max_cdf - table->min_cdf) * table->num_guide);
+    return (k < table->num_guide) ? k : table->num_guide - 1;
+}
+
+/*
+ * Build the guide table of a CDF distribution. As get_cdf_guide() is monotonic, a search
+ * for x can start at guide[get_cdf_guide(x)] and take O(1) steps on average.
+ */
+static void build_cdf_guide(struct cdf_table *table)
+{
+    int i = 0, k = 0;
+    double max_cdf;   /* maximum CDF of entries so far */
+
+    free(table->guide);
+    table->num_guide = (table->num_entry > 1) ? table->num_entry : 1;
+    table->guide = (int*)malloc(table->num_guide * sizeof(int));
+    if (!table->guide)
+    {
+        perror("Error: malloc guide in build_cdf_guide()");
+        table->num_guide = 0;
+        return;
+    }
+
+    /* guide[k] is the first entry whose CDF (or the CDF of an earlier entry) falls in the k-th range or above */
+    max_cdf = (table->num_entry > 0) ? table->entries[0].cdf : 0;
+    for (k = 0; k < table->num_guide; k++)
+    {
+        while (i < table->num_entry && get_cdf_guide(table, max_cdf) < k)
+        {
+            i++;
+            if (i < table->num_entry && table->entries[i].cdf > max_cdf)
+                max_cdf = table->entries[i].cdf;
+        }
+        table->guide[k] = i;
+    }
 }
 
 /* get CDF distribution from a given file */
@@ -63,6 +113,8 @@ void load_cdf(struct cdf_table *table, char *file_name)
         table->num_entry++;
     }
     fclose(fd);
+
+    build_cdf_guide(table);
 }
 
 /* print CDF distribution information */
@@ -114,13 +166,13 @@ double interpolate(double x, double x1, double y1, double x2, double y2)
 }
 
 /* generate a random floating point number from min to max */
-double rand_range(double min, double max)
+double rand_range(struct rng_state *rng, double min, double max)
 {
-    return min + rand() * (max - min) / RAND_MAX;
+    return min + rand_double(rng) * (max - min);
 }
 
 /* generate a random value based on CDF distribution */
-double gen_random_cdf(struct cdf_table *table)
+double gen_random_cdf(struct cdf_table *table, struct rng_state *rng)
 {
     int i = 0;
     double x;
@@ -129,9 +181,13 @@ double gen_random_cdf(struct cdf_table *table)
     if (!table)
         return 0;
 
-    x = rand_range(table->min_cdf, table->max_cdf);
+    x = rand_range(rng, table->min_cdf, table->max_cdf);
 
-    for (i = 0; i < table->num_entry; i++)
+    /* entries before the guide entry have smaller CDF values than x */
+    if (table->guide)
+        i = table->guide[get_cdf_guide(table, x)];
+
+    for (; i < table->num_entry; i++)
     {
         if (x <= table->entries[i].cdf)
         {
@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "rng.h"
+
 #define TG_CDF_TABLE_ENTRY 32
 
 struct cdf_entry
@@ -20,6 +22,8 @@ struct cdf_table
     int max_entry;  /* maximum number of entries in CDF table */
     double min_cdf; /* minimum value of CDF (default 0) */
     double max_cdf; /* maximum value of CDF (default 1) */
+    int *guide; /* guide[k]: first entry that may have a CDF in the k-th of num_guide equal CDF ranges */
+    int num_guide;  /* number of guide entries */
 };
 
 /* initialize a CDF distribution */
@@ -38,6 +42,6 @@ void print_cdf(struct cdf_table *table);
 double avg_cdf(struct cdf_table *table);
 
 /* Generate a random value based on CDF distribution */
-double gen_random_cdf(struct cdf_table *table);
+double gen_random_cdf(struct cdf_table *table, struct rng_state *rng);
 
 #endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -5,8 +7,17 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
 #include <netinet/in.h>
+#include <linux/sockios.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <errno.h>
 #include <math.h>
+#include <time.h>
+#include <sched.h>
 
 #include "common.h"
 
@@ -14,6 +25,29 @@
 static char max_write_buf[TG_MAX_WRITE] = {0};
 /* buffer to use with rate limiting */
 static char min_write_buf[TG_MIN_WRITE] = {0};
+/* how to generate payload */
+static enum payload_mode payload_mode = TG_PAYLOAD_COPY;
+/* memfd holding TG_MAX_WRITE bytes of payload (used with TG_PAYLOAD_SENDFILE) */
+static int payload_fd = -1;
+
+/* how to enforce sending rates */
+static enum pacing_mode pacing_mode = TG_PACING_USLEEP;
+
+/* statistics of payload writes (updated atomically by all threads) */
+static unsigned long long payload_writes = 0;   /* successful system calls to write payload */
+static unsigned long long zc_sends = 0; /* successful send() calls with MSG_ZEROCOPY */
+static unsigned long long zc_completions = 0;   /* MSG_ZEROCOPY sends notified as completed */
+static unsigned long long zc_copied = 0;    /* completed MSG_ZEROCOPY sends for which the kernel copied data */
+static unsigned long long zc_fallbacks = 0; /* MSG_ZEROCOPY sends retried with write() (e.g., optmem limit) */
+static unsigned long long paced_flows = 0;  /* rate-limited flows */
+static unsigned long long paced_requested_mbps = 0; /* sum of requested rates of rate-limited flows */
+static unsigned long long paced_bytes = 0;  /* bytes sent by rate-limited flows */
+static unsigned long long paced_us = 0; /* time spent on sending rate-limited flows */
+
+/* maximum time to wait for zero-copy completions at the end of a flow */
+#define TG_ZEROCOPY_WAIT_MS 1000
+/* reap zero-copy completions of a blocking socket once this number of sends is pending */
+#define TG_ZEROCOPY_REAP_THRESH 16
 
 /*
  * This function attemps to read exactly count bytes from file descriptor fd
@@ -30,10 +64,10 @@ static char min_write_buf[TG_MIN_WRITE] = {0};
  * dummy_buf = false, and at least min{count, max_per_read} when
  * dummy_buf = true.
  */
-unsigned int read_exact(int fd, char *buf, size_t count, size_t max_per_read, bool dummy_buf)
+size_t read_exact(int fd, char *buf, size_t count, size_t max_per_read, bool dummy_buf)
 {
-    unsigned int bytes_total_read = 0;  /* total number of bytes that have been read */
-    unsigned int bytes_to_read = 0; /* maximum number of bytes to read in next read() call */
+    size_t bytes_total_read = 0;    /* total number of bytes that have been read */
+    size_t bytes_to_read = 0;   /* maximum number of bytes to read in next read() call */
     char *cur_buf = NULL;   /* current location */
     int n;  /* number of bytes read in current read() call */
 
@@ -62,6 +96,37 @@ unsigned int read_exact(int fd, char *buf, size_t count, size_t max_per_read, bo
     return bytes_total_read;
 }
 
+/*
+ * Receive exactly count bytes from a TCP socket and drop them. With MSG_TRUNC,
+ * the kernel discards the data instead of copying it to a user buffer. Each
+ * call to recv() is for at most max_per_read bytes. The return value gives
+ * the number of bytes successfully received.
+ */
+size_t discard_exact(int fd, size_t count, size_t max_per_read)
+{
+    size_t bytes_total_read = 0;    /* total number of bytes that have been discarded */
+    ssize_t n;  /* number of bytes discarded in current recv() call */
+
+    while (count > 0)
+    {
+        n = recv(fd, NULL, (count > max_per_read) ? max_per_read : count, MSG_TRUNC);
+
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                printf("Error: recv() in discard_exact()");
+            break;
+        }
+
+        bytes_total_read += n;
+        count -= n;
+    }
+
+    return bytes_total_read;
+}
+
 /*
  * This function attemps to write exactly count bytes from the buffer starting
  * at buf to file referred to by file descriptor fd. It repeatedly calls
@@ -76,29 +141,45 @@ unsigned int read_exact(int fd, char *buf, size_t count, size_t max_per_read, bo
  * To avoid buffer overflow, the length of buf should be at least count when
  * dummy_buf = false, and at least min{count, max_per_write} when
  * dummy_buf = true.
+ * With dummy_buf = true, the data is generated by write_payload(), so it may
+ * not come from buf at all (e.g., sendfile() from a memfd).
  * Users can rate-limit the sending of traffic. If rate_mbps is equal to 0, it indicates no rate-limiting.
+ * The rate of payload (dummy_buf = true) is enforced as set by set_pacing_mode().
  * Users can also set ToS value for traffic.
  */
-unsigned int write_exact(int fd, char *buf, size_t count, size_t max_per_write,
-    unsigned int rate_mbps, unsigned int tos, unsigned int sleep_overhead_us, bool dummy_buf)
+size_t write_exact(int fd, char *buf, size_t count, size_t max_per_write,
+    unsigned int rate_mbps, unsigned int tos, unsigned int sleep_overhead_us, bool dummy_buf, unsigned int *zc_pending)
 {
-    unsigned int bytes_total_write = 0; /* total number of bytes that have been written */
-    unsigned int bytes_to_write = 0;    /* maximum number of bytes to write in next send() call */
+    size_t bytes_total_write = 0;   /* total number of bytes that have been written */
+    size_t bytes_to_write = 0;  /* maximum number of bytes to write in next send() call */
     char *cur_buf = NULL;   /* current location */
     int n;  /* number of bytes read in current read() call */
     struct timeval tv_start, tv_end;    /* start and end time of write */
     long sleep_us = 0;  /* sleep time (us) */
     long write_us = 0;  /* time used for write() */
+    unsigned int zc_local = 0;  /* zero-copy sends without completion notifications (no per-socket counter) */
+    /* a payload is paced by a token bucket with TG_PACING_BUCKET, or with TG_PACING_KERNEL if SO_MAX_PACING_RATE fails */
+    bool usleep_pacing = (pacing_mode == TG_PACING_USLEEP || !dummy_buf);
+    unsigned long long start_ns = 0;    /* start time of the token bucket */
+
+    if (!zc_pending)
+        zc_pending = &zc_local;
 
     if (setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0)
         printf("Error: set IP_TOS option in write_exact()");
 
+    if (rate_mbps && !usleep_pacing)
+        start_ns = get_time_ns();
+
     while (count > 0)
     {
         bytes_to_write = (count > max_per_write) ? max_per_write : count;
         cur_buf = (dummy_buf) ? buf : (buf + bytes_total_write);
+        /* the bucket holds at most max_per_write bytes of tokens, and is full at the beginning */
+        if (rate_mbps && !usleep_pacing && bytes_total_write + bytes_to_write > max_per_write)
+            sleep_until_ns(start_ns + (unsigned long long)(bytes_total_write + bytes_to_write - max_per_write) * 8000 / rate_mbps);
         gettimeofday(&tv_start, NULL);
-        n = write(fd, cur_buf, bytes_to_write);
+        n = (dummy_buf) ? write_payload(fd, cur_buf, bytes_to_write, zc_pending) : write(fd, cur_buf, bytes_to_write);
         gettimeofday(&tv_end, NULL);
         write_us = (tv_end.tv_sec - tv_start.tv_sec) * 1000000 + tv_end.tv_usec - tv_start.tv_usec;
         sleep_us += (rate_mbps) ? n * 8 / rate_mbps - write_us : 0;
@@ -113,7 +194,9 @@ unsigned int write_exact(int fd, char *buf, size_t count, size_t max_per_write,
         {
             bytes_total_write += n;
             count -= n;
-            if (sleep_overhead_us < sleep_us)
+            if (*zc_pending >= TG_ZEROCOPY_REAP_THRESH)
+                reap_payload_completions(fd, zc_pending, false);
+            if (usleep_pacing && sleep_overhead_us < sleep_us)
             {
                 usleep(sleep_us - sleep_overhead_us);
                 sleep_us = 0;
@@ -121,91 +204,539 @@ unsigned int write_exact(int fd, char *buf, size_t count, size_t max_per_write,
         }
     }
 
+    /* do not wait for notifications of this flow: the rest is reaped with later flows of the socket */
+    if (*zc_pending > 0)
+        reap_payload_completions(fd, zc_pending, false);
+
     return bytes_total_write;
 }
 
+/* set the way to generate payload and return true if it succeeds */
+bool set_payload_mode(enum payload_mode mode)
+{
+    size_t filled = 0;
+    ssize_t n;
+
+    if (mode == TG_PAYLOAD_SENDFILE && payload_fd < 0)
+    {
+        payload_fd = memfd_create("tg_payload", MFD_CLOEXEC);
+        if (payload_fd < 0)
+        {
+            perror("Error: memfd_create in set_payload_mode()");
+            return false;
+        }
+
+        /* fill the memfd so that its pages are resident in the page cache */
+        while (filled < TG_MAX_WRITE)
+        {
+            n = write(payload_fd, max_write_buf, TG_MAX_WRITE - filled);
+            if (n <= 0)
+            {
+                perror("Error: fill memfd in set_payload_mode()");
+                close(payload_fd);
+                payload_fd = -1;
+                return false;
+            }
+            filled += n;
+        }
+    }
+
+    payload_mode = mode;
+    return true;
+}
+
+/* prepare a socket to send payload (e.g., enable SO_ZEROCOPY) and return true if it succeeds */
+bool init_payload_socket(int fd)
+{
+    int sock_opt = 1;
+
+    if (payload_mode == TG_PAYLOAD_ZEROCOPY && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &sock_opt, sizeof(sock_opt)) < 0)
+    {
+        perror("Error: set SO_ZEROCOPY option in init_payload_socket()");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Write at most count (<= TG_MAX_WRITE) bytes of dummy payload into a socket.
+ * buf is a dummy buffer of at least count bytes, used when the payload is copied
+ * or sent with MSG_ZEROCOPY. Dummy buffers are never modified, so several flows
+ * can share them while zero-copy sends are still in flight.
+ * For each zero-copy send, *zc_pending is increased. The caller should reap the
+ * completions with reap_payload_completions().
+ * Return the result of the underlying system call.
+ */
+ssize_t write_payload(int fd, char *buf, size_t count, unsigned int *zc_pending)
+{
+    off_t offset = 0;   /* each call reads from the start of the memfd without moving its file offset */
+    ssize_t n;
+
+    if (payload_mode == TG_PAYLOAD_SENDFILE)
+        n = sendfile(fd, payload_fd, &offset, min(count, TG_MAX_WRITE));
+    else if (payload_mode == TG_PAYLOAD_ZEROCOPY)
+    {
+        n = send(fd, buf, count, MSG_ZEROCOPY);
+        if (n > 0)
+        {
+            (*zc_pending)++;
+            __atomic_fetch_add(&zc_sends, 1, __ATOMIC_RELAXED);
+        }
+        /* too many notifications are pending (optmem limit): copy this time */
+        else if (n < 0 && errno == ENOBUFS)
+        {
+            __atomic_fetch_add(&zc_fallbacks, 1, __ATOMIC_RELAXED);
+            n = write(fd, buf, count);
+        }
+    }
+    else
+        n = write(fd, buf, count);
+
+    if (n > 0)
+        __atomic_fetch_add(&payload_writes, 1, __ATOMIC_RELAXED);
+
+    return n;
+}
+
+/*
+ * Reap zero-copy completion notifications from the error queue of a socket.
+ * Each notification covers a range of sends. If wait is true, wait (at most
+ * TG_ZEROCOPY_WAIT_MS for each notification) until all pending sends complete.
+ */
+void reap_payload_completions(int fd, unsigned int *zc_pending, bool wait)
+{
+    struct msghdr msg;
+    struct cmsghdr *cmsg = NULL;
+    struct sock_extended_err *serr = NULL;
+    char control[256];
+    struct pollfd pfd;
+    unsigned int num;
+
+    while (*zc_pending > 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || !wait)
+                break;
+
+            /* POLLERR is reported when the error queue is not empty */
+            pfd.fd = fd;
+            pfd.events = 0;
+            if (poll(&pfd, 1, TG_ZEROCOPY_WAIT_MS) <= 0)
+            {
+                printf("Error: %u zero-copy sends are not completed in reap_payload_completions()\n", *zc_pending);
+                break;
+            }
+            continue;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* sends from ee_info to ee_data (inclusive) complete */
+            num = serr->ee_data - serr->ee_info + 1;
+            __atomic_fetch_add(&zc_completions, num, __ATOMIC_RELAXED);
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                __atomic_fetch_add(&zc_copied, num, __ATOMIC_RELAXED);
+            *zc_pending -= min(num, *zc_pending);
+        }
+    }
+}
+
+/* set the way to enforce sending rates */
+void set_pacing_mode(enum pacing_mode mode)
+{
+    pacing_mode = mode;
+}
+
+/*
+ * Set the pacing rate of a socket for a flow. With TG_PACING_KERNEL, the rate is
+ * enforced by SO_MAX_PACING_RATE (or removed if rate_mbps is 0) and false is returned.
+ * Otherwise, return true if the application has to enforce a non-zero rate.
+ */
+bool set_flow_pacing(int fd, unsigned int rate_mbps)
+{
+    unsigned long long rate_bps = (rate_mbps > 0) ? (unsigned long long)rate_mbps * 1000000 / 8 : ~0ULL;
+
+    if (pacing_mode != TG_PACING_KERNEL)
+        return rate_mbps > 0;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate_bps, sizeof(rate_bps)) < 0)
+    {
+        perror("Error: set SO_MAX_PACING_RATE option in set_flow_pacing()");
+        return rate_mbps > 0;
+    }
+
+    return false;
+}
+
+/*
+ * Record the sending rate achieved by a flow of size bytes whose payload took
+ * duration_us to write, and return it (Mbps). Bytes that are still not sent
+ * by TCP (e.g., held back by kernel pacing) when the last write returns are not counted.
+ * Flows without rate limiting are not recorded.
+ */
+unsigned int record_flow_rate(int fd, unsigned long long size, unsigned int rate_mbps, unsigned long long duration_us)
+{
+    int unsent = 0;
+    unsigned long long sent;
+    unsigned int achieved_mbps;
+
+    if (rate_mbps == 0 || duration_us == 0)
+        return 0;
+
+    if (ioctl(fd, SIOCOUTQNSD, &unsent) < 0)
+        unsent = 0;
+
+    sent = size - min((unsigned long long)max(unsent, 0), size);
+    achieved_mbps = sent * 8 / duration_us;
+    __atomic_fetch_add(&paced_flows, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&paced_requested_mbps, rate_mbps, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&paced_bytes, sent, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&paced_us, duration_us, __ATOMIC_RELAXED);
+
+    return achieved_mbps;
+}
+
+/* print statistics of payload writes and sending rates */
+void print_payload_stats()
+{
+    unsigned long long completions = __atomic_load_n(&zc_completions, __ATOMIC_RELAXED);
+    unsigned long long copied = __atomic_load_n(&zc_copied, __ATOMIC_RELAXED);
+    unsigned long long flows = __atomic_load_n(&paced_flows, __ATOMIC_RELAXED);
+    unsigned long long us = __atomic_load_n(&paced_us, __ATOMIC_RELAXED);
+
+    printf("Payload writes: %llu\n", __atomic_load_n(&payload_writes, __ATOMIC_RELAXED));
+    /* the achieved rate is averaged over the sending time, so that tiny flows do not dominate it */
+    if (flows > 0 && us > 0)
+        printf("Rate-limited flows: %llu, average requested rate: %llu Mbps, average achieved rate: %llu Mbps\n",
+               flows, __atomic_load_n(&paced_requested_mbps, __ATOMIC_RELAXED) / flows,
+               __atomic_load_n(&paced_bytes, __ATOMIC_RELAXED) * 8 / us);
+    if (payload_mode != TG_PAYLOAD_ZEROCOPY)
+        return;
+
+    printf("MSG_ZEROCOPY sends: %llu (completed: %llu, fallback to write: %llu)\n",
+           __atomic_load_n(&zc_sends, __ATOMIC_RELAXED), completions, __atomic_load_n(&zc_fallbacks, __ATOMIC_RELAXED));
+    printf("Completed MSG_ZEROCOPY sends: %llu avoid a copy, %llu copied by the kernel (%.1f%% zero-copy)\n",
+           completions - copied, copied, (completions > 0) ? (completions - copied) * 100.0 / completions : 0);
+}
+
+/* get the size of flow metadata on the wire with a protocol version */
+unsigned int get_metadata_size(unsigned int version)
+{
+    return (version >= TG_PROTO_V2) ? TG_METADATA_V2_SIZE : TG_METADATA_SIZE;
+}
+
+/* serialize the metadata of a flow into a buffer of get_metadata_size(version) bytes */
+void pack_flow_metadata(char *buf, struct flow_metadata *f, unsigned int version)
+{
+    unsigned int size = f->size;
+    unsigned int v = TG_PROTO_V2;
+
+    if (version < TG_PROTO_V2)
+    {
+        memcpy(buf, &(f->id), 4);
+        memcpy(buf + 4, &size, 4);
+        memcpy(buf + 8, &(f->tos), 4);
+        memcpy(buf + 12, &(f->rate), 4);
+        return;
+    }
+
+    memcpy(buf, &(f->id), 4);
+    memcpy(buf + 4, &(f->tos), 4);
+    memcpy(buf + 8, &(f->rate), 4);
+    memcpy(buf + 12, &v, 4);
+    memcpy(buf + 16, &(f->size), 8);
+    memcpy(buf + 24, &(f->server_recv_us), 8);
+    memcpy(buf + 32, &(f->server_send_us), 8);
+}
+
+/* deserialize the metadata of a flow from a buffer of get_metadata_size(version) bytes */
+void unpack_flow_metadata(char *buf, struct flow_metadata *f, unsigned int version)
+{
+    unsigned int size = 0;
+
+    if (version < TG_PROTO_V2)
+    {
+        memcpy(&(f->id), buf, 4);
+        memcpy(&size, buf + 4, 4);
+        memcpy(&(f->tos), buf + 8, 4);
+        memcpy(&(f->rate), buf + 12, 4);
+        f->size = size;
+        f->server_recv_us = 0;
+        f->server_send_us = 0;
+        return;
+    }
+
+    memcpy(&(f->id), buf, 4);
+    memcpy(&(f->tos), buf + 4, 4);
+    memcpy(&(f->rate), buf + 8, 4);
+    memcpy(&(f->size), buf + 16, 8);
+    memcpy(&(f->server_recv_us), buf + 24, 8);
+    memcpy(&(f->server_send_us), buf + 32, 8);
+}
+
+/* negotiate the protocol version on a new connection and return it (0 if it fails) */
+unsigned int negotiate_proto_version(int fd)
+{
+    if (!write_proto_hello(fd))
+        return 0;
+
+    return read_proto_hello(fd);
+}
+
+/* send the version negotiation request on a new connection and return true if it succeeds */
+bool write_proto_hello(int fd)
+{
+    struct flow_metadata f;
+
+    memset(&f, 0, sizeof(f));
+    f.id = TG_HELLO_ID;
+    f.rate = TG_PROTO_V2;
+
+    return write_flow_req(fd, &f, TG_PROTO_V1);
+}
+
+/* read the answer to the version negotiation request and return the version (0 if it fails) */
+unsigned int read_proto_hello(int fd)
+{
+    struct flow_metadata f;
+
+    if (!read_flow_metadata(fd, &f, TG_PROTO_V1))
+        return 0;
+
+    return get_proto_hello_version(&f);
+}
+
+/* get the version from the answer to the version negotiation request */
+unsigned int get_proto_hello_version(struct flow_metadata *f)
+{
+    /* an old server echoes the request back with an empty flow */
+    if (f->id != TG_HELLO_ACK_ID)
+        return TG_PROTO_V1;
+
+    return max(min(f->rate, TG_PROTO_V2), TG_PROTO_V1);
+}
+
+/* if the metadata is a version negotiation request, turn it into the answer and return true */
+bool accept_proto_hello(struct flow_metadata *f, unsigned int *version)
+{
+    if (f->id != TG_HELLO_ID)
+        return false;
+
+    *version = max(min(f->rate, TG_PROTO_V2), TG_PROTO_V1);
+    f->id = TG_HELLO_ACK_ID;
+    f->size = 0;
+    f->rate = *version;
+    return true;
+}
+
 /* read the metadata of a flow and return true if it succeeds. */
-bool read_flow_metadata(int fd, struct flow_metadata *f)
+bool read_flow_metadata(int fd, struct flow_metadata *f, unsigned int version)
 {
-    char buf[TG_METADATA_SIZE] = {0};
+    char buf[TG_METADATA_MAX_SIZE] = {0};
+    unsigned int len = get_metadata_size(version);
 
     if (!f)
         return false;
 
-    if (read_exact(fd, buf, TG_METADATA_SIZE, TG_METADATA_SIZE, false) != TG_METADATA_SIZE)
+    if (read_exact(fd, buf, len, len, false) != len)
         return false;
 
     /* extract metadata */
-    memcpy(&(f->id), buf + offsetof(struct flow_metadata, id), sizeof(f->id));
-    memcpy(&(f->size), buf + offsetof(struct flow_metadata, size), sizeof(f->size));
-    memcpy(&(f->tos), buf + offsetof(struct flow_metadata, tos), sizeof(f->tos));
-    memcpy(&(f->rate), buf + offsetof(struct flow_metadata, rate), sizeof(f->rate));
+    unpack_flow_metadata(buf, f, version);
+
+    return true;
+}
+
+/* enable kernel receive timestamps (SCM_TIMESTAMPNS) on a socket and return true if it succeeds */
+bool enable_rx_timestamps(int fd)
+{
+    int sock_opt = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &sock_opt, sizeof(sock_opt)) < 0)
+    {
+        perror("Error: set SO_TIMESTAMPNS option in enable_rx_timestamps()");
+        return false;
+    }
+
+    return true;
+}
+
+/* get the kernel receive timestamp (us since the Epoch) of a received message (0 if it has none) */
+unsigned long long get_rx_timestamp_us(struct msghdr *msg)
+{
+    struct cmsghdr *cmsg = NULL;
+    struct timespec ts;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Receive at most count bytes from a socket and return the result of recvmsg().
+ * If the kernel timestamps the data, *rx_us is set to the receive timestamp.
+ */
+ssize_t recv_timestamped(int fd, char *buf, size_t count, unsigned long long *rx_us)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    char control[TG_RX_CONTROL_SIZE];
+    unsigned long long ts_us;
+    ssize_t n;
+
+    iov.iov_base = buf;
+    iov.iov_len = count;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    n = recvmsg(fd, &msg, 0);
+    if (n > 0 && (ts_us = get_rx_timestamp_us(&msg)) > 0)
+        *rx_us = ts_us;
+
+    return n;
+}
+
+/*
+ * Read the metadata of a flow request from a socket and return true if it succeeds.
+ * server_recv_us is the time when the kernel receives the request, or the time when
+ * the request is read if the kernel does not timestamp it.
+ */
+bool read_flow_request(int fd, struct flow_metadata *f, unsigned int version)
+{
+    char buf[TG_METADATA_MAX_SIZE] = {0};
+    unsigned int len = get_metadata_size(version);
+    unsigned int bytes_read = 0;
+    unsigned long long rx_us = 0;
+    ssize_t n;
+
+    if (!f)
+        return false;
+
+    while (bytes_read < len)
+    {
+        n = recv_timestamped(fd, buf + bytes_read, len - bytes_read, &rx_us);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                printf("Error: recvmsg() in read_flow_request()");
+            return false;
+        }
+        bytes_read += n;
+    }
+
+    unpack_flow_metadata(buf, f, version);
+    f->server_recv_us = (rx_us > 0) ? rx_us : get_realtime_us();
 
     return true;
 }
 
 /* write a flow request into a socket and return true if it succeeds */
-bool write_flow_req(int fd, struct flow_metadata *f)
+bool write_flow_req(int fd, struct flow_metadata *f, unsigned int version)
 {
-    char buf[TG_METADATA_SIZE] = {0};   /* buffer to hold metadata */
+    char buf[TG_METADATA_MAX_SIZE] = {0};   /* buffer to hold metadata */
+    unsigned int len = get_metadata_size(version);
 
     if (!f)
         return false;
+    /* the first version of the protocol carries 32-bit flow sizes */
+    if (version < TG_PROTO_V2 && f->size > 0xFFFFFFFFULL)
+    {
+        printf("Error: flow of %llu bytes to a server which does not support flows larger than 4GB\n", f->size);
+        return false;
+    }
 
     /* fill in metadata */
-    memcpy(buf + offsetof(struct flow_metadata, id), &(f->id), sizeof(f->id));
-    memcpy(buf + offsetof(struct flow_metadata, size), &(f->size), sizeof(f->size));
-    memcpy(buf + offsetof(struct flow_metadata, tos),  &(f->tos), sizeof(f->tos));
-    memcpy(buf + offsetof(struct flow_metadata, rate), &(f->rate), sizeof(f->rate));
+    pack_flow_metadata(buf, f, version);
 
     /* write the request into the socket */
-    if (write_exact(fd, buf, TG_METADATA_SIZE, TG_METADATA_SIZE, 0, f->tos, 0, false) == TG_METADATA_SIZE)
+    if (write_exact(fd, buf, len, len, 0, f->tos, 0, false, NULL) == len)
         return true;
     else
         return false;
 }
 
 /* write a flow (response) into a socket and return true if it succeeds */
-bool write_flow(int fd, struct flow_metadata *f, unsigned int sleep_overhead_us)
+bool write_flow(int fd, struct flow_metadata *f, unsigned int version, unsigned int sleep_overhead_us, unsigned int *zc_pending)
 {
     char *write_buf = NULL;  /* buffer to hold the real content of the flow */
-    unsigned int max_per_write = 0;
-    unsigned int result = 0;
+    size_t max_per_write = 0;
+    size_t result = 0;
+    unsigned int rate_mbps = 0; /* rate enforced by the application */
+    bool paced = false;
 
     if (!f)
         return false;
 
+    /* set (or clear) the pacing rate first: the echo must not be paced at the rate of the previous flow */
+    paced = set_flow_pacing(fd, f->rate);
+    if (paced)
+        rate_mbps = f->rate;
+
     /* echo back metadata */
-    if (!write_flow_req(fd, f))
+    f->server_send_us = get_realtime_us();
+    if (!write_flow_req(fd, f, version))
     {
         printf("Error: write_flow_req() in write_flow()\n");
         return false;
     }
 
-    /* use min_write_buf with rate limiting */
-    if (f->rate > 0)
-    {
-        write_buf = min_write_buf;
-        max_per_write = TG_MIN_WRITE;
-    }
-    /* use max_write_buf w/o rate limiting */
-    else
-    {
-        write_buf = max_write_buf;
-        max_per_write = TG_MAX_WRITE;
-    }
+    /* small writes if the application paces the flow, also when the kernel cannot */
+    write_buf = get_flow_write_buf(paced, &max_per_write);
 
     /* generate the flow response */
-    result = write_exact(fd, write_buf, f->size, max_per_write, f->rate, f->tos, sleep_overhead_us, true);
+    result = write_exact(fd, write_buf, f->size, max_per_write, rate_mbps, f->tos, sleep_overhead_us, true, zc_pending);
     if (result == f->size)
         return true;
     else
     {
-        printf("Error: write_exact() in write_flow() only successfully writes %u of %u bytes.\n", result, f->size);
+        printf("Error: write_exact() in write_flow() only successfully writes %zu of %llu bytes.\n", result, f->size);
         return false;
     }
 }
 
+/* get the dummy buffer to generate a flow (response) and the maximum number of bytes per write */
+char *get_flow_write_buf(bool paced, size_t *max_per_write)
+{
+    /* use min_write_buf if the application enforces the rate */
+    if (paced)
+    {
+        *max_per_write = TG_MIN_WRITE;
+        return min_write_buf;
+    }
+    /* use max_write_buf w/o rate limiting */
+    else
+    {
+        *max_per_write = TG_MAX_WRITE;
+        return max_write_buf;
+    }
+}
+
 /* print error information */
 void error(char *msg)
 {
@@ -226,14 +757,24 @@ void remove_newline(char *str)
 }
 
 /* generate poission process arrival interval */
-double poission_gen_interval(double avg_rate)
+double poission_gen_interval(double avg_rate, struct rng_state *rng)
 {
     if (avg_rate > 0)
-        return -logf(1.0 - (double)(rand() % RAND_MAX) / RAND_MAX) / avg_rate;
+        return -log(1.0 - rand_double(rng)) / avg_rate;
     else
         return 0;
 }
 
+/* pin the calling thread to a CPU and return true if it succeeds */
+bool pin_thread_cpu(int cpu)
+{
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return sched_setaffinity(0, sizeof(cpuset), &cpuset) == 0;
+}
+
 /* calculate usleep overhead */
 unsigned int get_usleep_overhead(int iter_num)
 {
@@ -254,10 +795,10 @@ unsigned int get_usleep_overhead(int iter_num)
 }
 
 /* randomly generate value based on weights */
-unsigned int gen_value_weight(unsigned int *vals, unsigned int *weights, unsigned int len, unsigned int weight_total)
+unsigned int gen_value_weight(unsigned int *vals, unsigned int *weights, unsigned int len, unsigned int weight_total, struct rng_state *rng)
 {
     unsigned int i = 0;
-    unsigned int val = rand() % weight_total;
+    unsigned int val = rand_uint(rng, weight_total);
 
     for (i = 0; i < len; i++)
     {
@@ -270,6 +811,90 @@ unsigned int gen_value_weight(unsigned int *vals, unsigned int *weights, unsigne
     return vals[len - 1];
 }
 
+/* get the current time of CLOCK_MONOTONIC in nanoseconds */
+unsigned long long get_time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* sleep until an absolute time of CLOCK_MONOTONIC in nanoseconds */
+void sleep_until_ns(unsigned long long deadline_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline_ns / 1000000000;
+    ts.tv_nsec = deadline_ns % 1000000000;
+    /* restart if interrupted by a signal */
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/* start an arrival schedule now. Each wait busy-waits for the last spin_us microseconds. */
+void init_arrival_schedule(struct arrival_schedule *s, unsigned int spin_us)
+{
+    memset(s, 0, sizeof(struct arrival_schedule));
+    s->next_ns = get_time_ns();
+    s->spin_ns = (unsigned long long)spin_us * 1000;
+}
+
+/*
+ * Wait for the next arrival, interval_us after the deadline of the previous one.
+ * Deadlines are absolute, so time spent between waits does not accumulate into drift.
+ */
+void wait_arrival(struct arrival_schedule *s, unsigned int interval_us)
+{
+    unsigned long long now_ns, lag_ns;
+
+    s->next_ns += (unsigned long long)interval_us * 1000;
+    now_ns = get_time_ns();
+    if (now_ns + s->spin_ns < s->next_ns)
+    {
+        sleep_until_ns(s->next_ns - s->spin_ns);
+        now_ns = get_time_ns();
+    }
+    while (now_ns < s->next_ns)
+        now_ns = get_time_ns();
+
+    lag_ns = now_ns - s->next_ns;
+    s->lag_total_ns += lag_ns;
+    s->lag_max_ns = max(s->lag_max_ns, lag_ns);
+    s->num_arrivals++;
+    if (lag_ns >= TG_ARRIVAL_LATE_US * 1000)
+        s->num_late++;
+}
+
+/* add the lag statistics of another arrival schedule to s */
+void merge_arrival_schedule(struct arrival_schedule *s, struct arrival_schedule *other)
+{
+    s->lag_total_ns += other->lag_total_ns;
+    s->lag_max_ns = max(s->lag_max_ns, other->lag_max_ns);
+    s->num_arrivals += other->num_arrivals;
+    s->num_late += other->num_late;
+}
+
+/* print how far arrivals lagged behind the schedule */
+void print_arrival_schedule(struct arrival_schedule *s)
+{
+    if (s->num_arrivals == 0)
+        return;
+
+    printf("The average arrival lag is %.2f us (max %.2f us)\n",
+           (double)s->lag_total_ns / s->num_arrivals / 1000, (double)s->lag_max_ns / 1000);
+    printf("%u of %u arrivals lagged at least %d us behind schedule\n", s->num_late, s->num_arrivals, TG_ARRIVAL_LATE_US);
+}
+
+/* get the current wall-clock time in microseconds since the Epoch */
+unsigned long long get_realtime_us()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 /* display progress */
 void display_progress(unsigned int num_finished, unsigned int num_total)
 {
@@ -3,18 +3,66 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "rng.h"
 
 /* structure of flow metadata */
 struct flow_metadata
 {
     unsigned int id;    /* ID */
-    unsigned int size;  /* flow size (bytes) */
+    unsigned long long size;    /* flow size (bytes, 32 bits on the wire with TG_PROTO_V1) */
     unsigned int tos;   /* ToS value */
     unsigned int rate;  /* sending rate (Mbps) */
+    unsigned long long server_recv_us;  /* time when the server receives the request (TG_PROTO_V2 responses) */
+    unsigned long long server_send_us;  /* time when the server hands the response to its socket (TG_PROTO_V2 responses) */
+};
+
+/* ways to generate the payload of a flow (response) */
+enum payload_mode
+{
+    TG_PAYLOAD_COPY,    /* write() from a static buffer */
+    TG_PAYLOAD_SENDFILE,    /* sendfile() from a pre-filled memfd */
+    TG_PAYLOAD_ZEROCOPY /* send() with MSG_ZEROCOPY from a static buffer */
+};
+
+/* ways to enforce the sending rate of a flow */
+enum pacing_mode
+{
+    TG_PACING_USLEEP,   /* usleep() between writes, corrected by the usleep overhead */
+    TG_PACING_BUCKET,   /* token bucket with absolute deadlines */
+    TG_PACING_KERNEL    /* SO_MAX_PACING_RATE (fq qdisc or TCP internal pacing) */
+};
+
+/* arrivals scheduled at absolute deadlines */
+struct arrival_schedule
+{
+    unsigned long long next_ns; /* deadline of the latest arrival (CLOCK_MONOTONIC) */
+    unsigned long long spin_ns; /* busy-wait for the last spin_ns before each deadline */
+    unsigned long long lag_total_ns;    /* total lag of arrivals behind their deadlines */
+    unsigned long long lag_max_ns;  /* maximum lag of an arrival behind its deadline */
+    unsigned int num_arrivals;  /* number of arrivals */
+    unsigned int num_late;  /* number of arrivals at least TG_ARRIVAL_LATE_US behind their deadlines */
 };
 
+/*
+ * Wire formats of flow metadata (host byte order). Connections start with TG_PROTO_V1.
+ * A client asks for TG_PROTO_V2 with a TG_PROTO_V1 request of ID TG_HELLO_ID whose rate
+ * is the highest version it supports. A server supporting TG_PROTO_V2 answers with ID
+ * TG_HELLO_ACK_ID and the chosen version as rate, and an old server just echoes the request.
+ */
+#define TG_PROTO_V1 1   /* 32-bit ID, size, ToS and rate */
+#define TG_PROTO_V2 2   /* 32-bit ID, ToS, rate and version, then 64-bit size and server timestamps (us) */
+#define TG_HELLO_ID 0xFFFFFFFF
+#define TG_HELLO_ACK_ID 0xFFFFFFFE
 /* flow meata data size */
-#define TG_METADATA_SIZE (sizeof(struct flow_metadata))
+#define TG_METADATA_SIZE 16
+#define TG_METADATA_V2_SIZE 40
+#define TG_METADATA_MAX_SIZE TG_METADATA_V2_SIZE
+/* size of the control buffer to receive a kernel receive timestamp */
+#define TG_RX_CONTROL_SIZE CMSG_SPACE(sizeof(struct timespec))
 /* default server port */
 #define TG_SERVER_PORT 5001
 /* default number of backlogged connections for listen() */
@@ -25,8 +73,16 @@ struct flow_metadata
 #define TG_MIN_WRITE (1 << 16)
 /* maximum amount of data to read in a 'recv' system call */
 #define TG_MAX_READ (1 << 20)
-/* default initial number of TCP connections per pair */
+/* maximum amount of data to discard in a 'recv' system call (MSG_TRUNC, nothing is copied) */
+#define TG_MAX_DISCARD (1 << 24)
+/* initial number of TCP connections per pair without a load model (e.g., trace replay or overload) */
 #define TG_PAIR_INIT_CONN 5
+/* default capacity of the client link (Mbps) */
+#define TG_LINK_CAPACITY 10000
+/* maximum number of outstanding flows of a client */
+#define TG_MAX_OUTSTANDING_FLOWS (1 << 16)
+/* an arrival is late if it lags behind its deadline by this many microseconds */
+#define TG_ARRIVAL_LATE_US 100
 /* default goodput / link capacity ratio */
 #define TG_GOODPUT_RATIO (1448.0 / (1500 + 14 + 4 + 8 + 12))
 
@@ -43,20 +99,114 @@ struct flow_metadata
  */
 
 /* read exactly 'count' bytes from a socket 'fd' */
-unsigned int read_exact(int fd, char *buf, size_t count, size_t max_per_read, bool dummy_buf);
+size_t read_exact(int fd, char *buf, size_t count, size_t max_per_read, bool dummy_buf);
+
+/* receive and discard exactly 'count' bytes from a TCP socket 'fd' in the kernel */
+size_t discard_exact(int fd, size_t count, size_t max_per_read);
+
+/*
+ * write exactly 'count' bytes into a socket 'fd' at rate_mbps (0 if the application does not
+ * enforce a rate, e.g., the kernel paces the socket). zc_pending counts zero-copy sends
+ * of the socket without completion notifications (NULL if it is not tracked).
+ */
+size_t write_exact(int fd, char *buf, size_t count, size_t max_per_write,
+    unsigned int rate_mbps, unsigned int tos, unsigned int sleep_overhead_us, bool dummy_buf, unsigned int *zc_pending);
+
+/* get the size of flow metadata on the wire with a protocol version */
+unsigned int get_metadata_size(unsigned int version);
+
+/* serialize the metadata of a flow into a buffer of get_metadata_size(version) bytes */
+void pack_flow_metadata(char *buf, struct flow_metadata *f, unsigned int version);
+
+/* deserialize the metadata of a flow from a buffer of get_metadata_size(version) bytes */
+void unpack_flow_metadata(char *buf, struct flow_metadata *f, unsigned int version);
+
+/* negotiate the protocol version on a new connection and return it (0 if it fails) */
+unsigned int negotiate_proto_version(int fd);
+
+/* send the version negotiation request on a new connection and return true if it succeeds */
+bool write_proto_hello(int fd);
+
+/* read the answer to the version negotiation request and return the version (0 if it fails) */
+unsigned int read_proto_hello(int fd);
+
+/* get the version from the answer to the version negotiation request */
+unsigned int get_proto_hello_version(struct flow_metadata *f);
 
-/* write exactly 'count' bytes into a socket 'fd' */
-unsigned int write_exact(int fd, char *buf, size_t count, size_t max_per_write,
-    unsigned int rate_mbps, unsigned int tos, unsigned int sleep_overhead_us, bool dummy_buf);
+/* if the metadata is a version negotiation request, turn it into the answer and return true */
+bool accept_proto_hello(struct flow_metadata *f, unsigned int *version);
+
+/* set the way to generate payload and return true if it succeeds */
+bool set_payload_mode(enum payload_mode mode);
+
+/* prepare a socket to send payload (e.g., enable SO_ZEROCOPY) and return true if it succeeds */
+bool init_payload_socket(int fd);
+
+/* write at most count bytes of dummy payload into a socket and return the result of the system call */
+ssize_t write_payload(int fd, char *buf, size_t count, unsigned int *zc_pending);
+
+/* reap zero-copy completions of a socket. If wait is true, wait until all pending sends complete. */
+void reap_payload_completions(int fd, unsigned int *zc_pending, bool wait);
+
+/* set the way to enforce sending rates */
+void set_pacing_mode(enum pacing_mode mode);
+
+/* set the pacing rate of a socket for a flow and return true if the application has to enforce the rate */
+bool set_flow_pacing(int fd, unsigned int rate_mbps);
+
+/* record the sending rate achieved by a flow and return it (Mbps) */
+unsigned int record_flow_rate(int fd, unsigned long long size, unsigned int rate_mbps, unsigned long long duration_us);
+
+/* print statistics of payload writes and sending rates */
+void print_payload_stats();
+
+/* get the current time of CLOCK_MONOTONIC in nanoseconds */
+unsigned long long get_time_ns();
+
+/* sleep until an absolute time of CLOCK_MONOTONIC in nanoseconds */
+void sleep_until_ns(unsigned long long deadline_ns);
+
+/* get the current wall-clock time in microseconds since the Epoch */
+unsigned long long get_realtime_us();
+
+/* start an arrival schedule now. Each wait busy-waits for the last spin_us microseconds. */
+void init_arrival_schedule(struct arrival_schedule *s, unsigned int spin_us);
+
+/* wait for the next arrival, interval_us after the deadline of the previous one */
+void wait_arrival(struct arrival_schedule *s, unsigned int interval_us);
+
+/* add the lag statistics of another arrival schedule to s */
+void merge_arrival_schedule(struct arrival_schedule *s, struct arrival_schedule *other);
+
+/* print how far arrivals lagged behind the schedule */
+void print_arrival_schedule(struct arrival_schedule *s);
 
 /* read the metadata of a flow from a socket and return true if it succeeds. */
-bool read_flow_metadata(int fd, struct flow_metadata *f);
+bool read_flow_metadata(int fd, struct flow_metadata *f, unsigned int version);
+
+/* enable kernel receive timestamps (SCM_TIMESTAMPNS) on a socket and return true if it succeeds */
+bool enable_rx_timestamps(int fd);
+
+/* get the kernel receive timestamp (us since the Epoch) of a received message (0 if it has none) */
+unsigned long long get_rx_timestamp_us(struct msghdr *msg);
+
+/* receive at most count bytes from a socket and set *rx_us to the kernel receive timestamp if there is one */
+ssize_t recv_timestamped(int fd, char *buf, size_t count, unsigned long long *rx_us);
+
+/* read the metadata of a flow request with the time when it is received and return true if it succeeds */
+bool read_flow_request(int fd, struct flow_metadata *f, unsigned int version);
 
 /* write a flow request into a socket and return true if it succeeds */
-bool write_flow_req(int fd, struct flow_metadata *f);
+bool write_flow_req(int fd, struct flow_metadata *f, unsigned int version);
 
 /* write a flow (response) into a socket and return true if it succeeds */
-bool write_flow(int fd, struct flow_metadata *f, unsigned int sleep_overhead_us);
+bool write_flow(int fd, struct flow_metadata *f, unsigned int version, unsigned int sleep_overhead_us, unsigned int *zc_pending);
+
+/*
+ * Get the dummy buffer to generate a flow (response) and the maximum number of bytes per write.
+ * paced is whether the application enforces the rate of the flow, as returned by set_flow_pacing().
+ */
+char *get_flow_write_buf(bool paced, size_t *max_per_write);
 
 /* print error information and terminate the program */
 void error(char *msg);
@@ -65,13 +215,16 @@ void error(char *msg);
 void remove_newline(char *str);
 
 /* generate poission process arrival interval */
-double poission_gen_interval(double avg_rate);
+double poission_gen_interval(double avg_rate, struct rng_state *rng);
 
 /* calculate usleep overhead */
 unsigned int get_usleep_overhead(int iter_num);
 
+/* pin the calling thread to a CPU and return true if it succeeds */
+bool pin_thread_cpu(int cpu);
+
 /* randomly generate a value based on weights */
-unsigned int gen_value_weight(unsigned int *vals, unsigned int *weights, unsigned int len, unsigned int weight_total);
+unsigned int gen_value_weight(unsigned int *vals, unsigned int *weights, unsigned int len, unsigned int weight_total, struct rng_state *rng);
 
 /* display progress */
 void display_progress(unsigned int num_finished, unsigned int num_total);
@@ -1,25 +1,47 @@
 #include "conn.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 
-/* initialize connection */
-bool init_conn_node(struct conn_node *node, int id, struct conn_list *list)
+/* the pool manager */
+static struct conn_list *manager_lists = NULL;
+static unsigned int manager_num_lists = 0;
+static conn_ready_handler manager_handler = NULL;
+static pthread_t manager_thread;
+static pthread_mutex_t manager_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t manager_cond = PTHREAD_COND_INITIALIZER;
+static bool manager_wake = false;   /* protected by manager_lock */
+static bool manager_stop = false;   /* accessed atomically */
+static bool manager_running = false;
+
+/* push an available node to the stack of its number of outstanding flows */
+static void push_free_conn(struct conn_list *list, struct conn_node *node);
+
+/* thread to run the pool manager */
+static void *run_conn_manager(void *ptr);
+
+/* create a socket and start a non-blocking connection to the server of a list */
+static bool start_conn_node(struct conn_node *node, struct conn_list *list)
 {
     struct sockaddr_in serv_addr;
     int sock_opt = 1;
 
-    if (!node)
-        return false;
-
-    node->id = id;
-    node->busy = false;
+    node->id = 0;
+    node->outstanding = 0;
     node->next = NULL;
+    node->next_free = NULL;
     node->list = list;
     node->connected = false;
+    node->rcvlowat = 1;
 
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
@@ -27,11 +49,11 @@ bool init_conn_node(struct conn_node *node, int id, struct conn_list *list)
     serv_addr.sin_port = htons(list->port);
 
     /* initialize server socket */
-    node->sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    node->sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (node->sockfd < 0)
     {
         char msg[256] = {0};
-        snprintf(msg, 256, "Error: init socket (to %s:%hu) in init_conn_node()", list->ip, list->port);
+        snprintf(msg, 256, "Error: init socket (to %s:%hu) in start_conn_node()", list->ip, list->port);
         perror(msg);
         return false;
     }
@@ -40,30 +62,229 @@ bool init_conn_node(struct conn_node *node, int id, struct conn_list *list)
     if (setsockopt(node->sockfd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt)) < 0)
     {
         char msg[256] = {0};
-        snprintf(msg, 256, "Error: set SO_REUSEADDR (to %s:%hu) in init_conn_node()", list->ip, list->port);
+        snprintf(msg, 256, "Error: set SO_REUSEADDR (to %s:%hu) in start_conn_node()", list->ip, list->port);
         perror(msg);
         return false;
     }
     if (setsockopt(node->sockfd, IPPROTO_TCP, TCP_NODELAY, &sock_opt, sizeof(sock_opt)) < 0)
     {
         char msg[256] = {0};
-        snprintf(msg, 256, "Error: set TCP_NODELAY (to %s:%hu) in init_conn_node()", list->ip, list->port);
+        snprintf(msg, 256, "Error: set TCP_NODELAY (to %s:%hu) in start_conn_node()", list->ip, list->port);
+        perror(msg);
+        return false;
+    }
+    /* the receive buffer must be set before connect() to take effect on the window scale */
+    if (list->rcvbuf > 0 && setsockopt(node->sockfd, SOL_SOCKET, SO_RCVBUF, &(list->rcvbuf), sizeof(list->rcvbuf)) < 0)
+    {
+        char msg[256] = {0};
+        snprintf(msg, 256, "Error: set SO_RCVBUF (to %s:%hu) in start_conn_node()", list->ip, list->port);
         perror(msg);
         return false;
     }
 
-    if (connect(node->sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+    if (connect(node->sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0 && errno != EINPROGRESS)
     {
         char msg[256] = {0};
-        snprintf(msg, 256, "Error: connect() (to %s:%hu) in init_conn_node()", list->ip, list->port);
+        snprintf(msg, 256, "Error: connect() (to %s:%hu) in start_conn_node()", list->ip, list->port);
         perror(msg);
         return false;
     }
 
-    node->connected = true;
     return true;
 }
 
+/* close the socket of a node which is not in a list and release it */
+void drop_conn_node(struct conn_node *node)
+{
+    if (node->sockfd >= 0)
+        close(node->sockfd);
+    free(node);
+}
+
+/* get the milliseconds left before a deadline of CLOCK_MONOTONIC in nanoseconds (0 if it has passed) */
+static int get_timeout_ms(unsigned long long deadline_ns)
+{
+    unsigned long long now_ns = get_time_ns();
+
+    return (now_ns < deadline_ns) ? (int)((deadline_ns - now_ns + 999999) / 1000000) : 0;
+}
+
+/* drop the node at position i of nodes, which has not been established */
+static void fail_conn_node(struct conn_list *list, struct conn_node **nodes, unsigned int i, char *reason)
+{
+    printf("Error: %s (to %s:%hu) in open_conn_nodes()\n", reason, list->ip, list->port);
+    drop_conn_node(nodes[i]);
+    nodes[i] = NULL;
+}
+
+/*
+ * Open num connections to the server of a list in parallel and return the number of connections
+ * established. All handshakes and version negotiations overlap, so it takes about one RTT for
+ * each of them regardless of num. Connections which are not established within TG_CONN_TIMEOUT_MS
+ * (e.g., the server accepts them but never answers) are dropped, so a slow server cannot hold
+ * the caller. The established nodes are stored at the beginning of nodes.
+ * They are not in the list yet: add them with add_conn_list().
+ */
+unsigned int open_conn_nodes(struct conn_list *list, struct conn_node **nodes, unsigned int num)
+{
+    struct pollfd *fds = NULL;
+    struct flow_metadata f;
+    unsigned long long deadline_ns = get_time_ns() + TG_CONN_TIMEOUT_MS * 1000000ULL;
+    unsigned int i, num_pending = 0, num_conn = 0;
+    unsigned int meta_size = get_metadata_size(TG_PROTO_V1);
+    int err, n;
+    socklen_t len;
+
+    if (!list || !nodes || num == 0)
+        return 0;
+
+    fds = (struct pollfd*)calloc(num, sizeof(struct pollfd));
+    if (!fds)
+    {
+        perror("Error: calloc fds in open_conn_nodes()");
+        return 0;
+    }
+
+    /* start all connections at once */
+    for (i = 0; i < num; i++)
+    {
+        fds[i].fd = -1;
+        nodes[i] = (struct conn_node*)malloc(sizeof(struct conn_node));
+        if (!nodes[i])
+        {
+            perror("Error: malloc node in open_conn_nodes()");
+            continue;
+        }
+        if (!start_conn_node(nodes[i], list))
+        {
+            drop_conn_node(nodes[i]);
+            nodes[i] = NULL;
+            continue;
+        }
+        fds[i].fd = nodes[i]->sockfd;
+        fds[i].events = POLLOUT;
+        num_pending++;
+    }
+
+    /* wait for the handshakes */
+    while (num_pending > 0)
+    {
+        n = poll(fds, num, get_timeout_ms(deadline_ns));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n < 0)
+                perror("Error: poll in open_conn_nodes()");
+            break;
+        }
+
+        for (i = 0; i < num; i++)
+        {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+
+            err = 0;
+            len = sizeof(err);
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+            {
+                char msg[256] = {0};
+                if (err != 0)
+                    errno = err;
+                snprintf(msg, 256, "Error: connect() (to %s:%hu) in open_conn_nodes()", list->ip, list->port);
+                perror(msg);
+                drop_conn_node(nodes[i]);
+                nodes[i] = NULL;
+            }
+            fds[i].fd = -1;
+            num_pending--;
+        }
+    }
+
+    /*
+     * Negotiate protocol versions: send all requests before reading the answers. The sockets stay
+     * non-blocking and the answers are read as they arrive until the deadline.
+     */
+    num_pending = 0;
+    for (i = 0; i < num; i++)
+    {
+        if (!nodes[i])
+            continue;
+        if (fds[i].fd >= 0)
+        {
+            fail_conn_node(list, nodes, i, "connect() timed out");
+            continue;
+        }
+        /* a new socket has room for the request, so it is written at once */
+        if (!write_proto_hello(nodes[i]->sockfd))
+        {
+            fail_conn_node(list, nodes, i, "send the version negotiation request");
+            continue;
+        }
+        nodes[i]->meta_len = 0;
+        fds[i].fd = nodes[i]->sockfd;
+        fds[i].events = POLLIN;
+        num_pending++;
+    }
+
+    while (num_pending > 0)
+    {
+        n = poll(fds, num, get_timeout_ms(deadline_ns));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n < 0)
+                perror("Error: poll in open_conn_nodes()");
+            break;
+        }
+
+        for (i = 0; i < num; i++)
+        {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+
+            n = recv(fds[i].fd, nodes[i]->meta_buf + nodes[i]->meta_len, meta_size - nodes[i]->meta_len, 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+            if (n > 0)
+                nodes[i]->meta_len += n;
+            if (n > 0 && nodes[i]->meta_len < meta_size)
+                continue;
+
+            if (n <= 0)
+                fail_conn_node(list, nodes, i, "negotiate protocol version");
+            else
+            {
+                unpack_flow_metadata(nodes[i]->meta_buf, &f, TG_PROTO_V1);
+                nodes[i]->version = get_proto_hello_version(&f);
+                nodes[i]->meta_len = 0;
+            }
+            fds[i].fd = -1;
+            num_pending--;
+        }
+    }
+
+    /* requests and flows are written and read with blocking calls from now on */
+    for (i = 0; i < num; i++)
+    {
+        if (!nodes[i])
+            continue;
+        if (fds[i].fd >= 0)
+            fail_conn_node(list, nodes, i, "version negotiation timed out");
+        else if (fcntl(nodes[i]->sockfd, F_SETFL, fcntl(nodes[i]->sockfd, F_GETFL) & ~O_NONBLOCK) < 0)
+            fail_conn_node(list, nodes, i, "clear O_NONBLOCK");
+        else
+        {
+            nodes[i]->connected = true;
+            nodes[num_conn++] = nodes[i];
+        }
+    }
+
+    free(fds);
+    return num_conn;
+}
+
 bool init_conn_list(struct conn_list *list, int index, char *ip, unsigned short port)
 {
     if (!list)
@@ -84,156 +305,416 @@ bool init_conn_list(struct conn_list *list, int index, char *ip, unsigned short
     list->len = 0;
     list->available_len = 0;
     list->flow_finished = 0;
+    memset(list->free_heads, 0, sizeof(list->free_heads));
+    list->depth = 1;
+    list->rcvbuf = 0;
+    list->low_water = TG_CONN_LOW_WATER;
+    list->grow = TG_CONN_GROW;
+    list->refill = false;
     pthread_mutex_init(&(list->lock), NULL);
+    pthread_cond_init(&(list->cond), NULL);
 
     return true;
 }
 
-/* insert several nodes to the tail of the linked list */
+/*
+ * Append a connected node to the tail of the linked list with num_flows outstanding flows sent on it
+ * before, and make it available if it can take more flows. Receivers may finish some of these flows
+ * first: they count node->outstanding down from 0 (wrapping around), so they never make the node
+ * available before it is added.
+ */
+void add_conn_list(struct conn_list *list, struct conn_node *node, unsigned int num_flows)
+{
+    if (!list || !node)
+        return;
+
+    pthread_mutex_lock(&(list->lock));
+    node->id = list->len;
+    node->next = NULL;
+    /* if the list is empty */
+    if (list->len == 0)
+    {
+        list->head = node;
+        list->tail = node;
+    }
+    else
+    {
+        list->tail->next = node;
+        list->tail = node;
+    }
+    list->len++;
+    pthread_mutex_unlock(&(list->lock));
+
+    if (__atomic_add_fetch(&(node->outstanding), num_flows, __ATOMIC_RELAXED) < list->depth)
+        push_free_conn(list, node);
+}
+
+/* establish several connections in parallel and insert them to the tail of the linked list */
 bool insert_conn_list(struct conn_list *list, int num)
 {
-    int i = 0;
-    struct conn_node *new_node = NULL;
+    struct conn_node **nodes = NULL;
+    unsigned int i, num_conn = 0;
 
-    if (!list)
+    if (!list || num <= 0)
         return false;
 
-    for (i = 0; i < num; i++)
+    nodes = (struct conn_node**)malloc(num * sizeof(struct conn_node*));
+    if (!nodes)
     {
-        new_node = (struct conn_node*)malloc(sizeof(struct conn_node));
-        if (!init_conn_node(new_node, list->len, list))
-        {
-            free(new_node);
-            return false;
-        }
+        perror("Error: malloc nodes in insert_conn_list()");
+        return false;
+    }
 
-        /* if the list is empty */
-        if (list->len == 0)
-        {
-            list->head = new_node;
-            list->tail = new_node;
-        }
+    num_conn = open_conn_nodes(list, nodes, num);
+    for (i = 0; i < num_conn; i++)
+        add_conn_list(list, nodes[i], 0);
+
+    free(nodes);
+    return num_conn == (unsigned int)num;
+}
+
+/* open list->grow connections for the pool manager */
+static void grow_conn_list(struct conn_list *list)
+{
+    struct conn_node **nodes = NULL;
+    unsigned int i, num_conn = 0;
+
+    nodes = (struct conn_node**)malloc(max(list->grow, 1) * sizeof(struct conn_node*));
+    if (nodes)
+        num_conn = open_conn_nodes(list, nodes, max(list->grow, 1));
+    else
+        perror("Error: malloc nodes in grow_conn_list()");
+
+    for (i = 0; i < num_conn; i++)
+    {
+        if (manager_handler)
+            manager_handler(list, nodes[i]);
         else
+            add_conn_list(list, nodes[i], 0);
+    }
+    if (num_conn == 0 && manager_handler)
+        manager_handler(list, NULL);
+
+    free(nodes);
+}
+
+/* start the pool manager thread on num_lists lists */
+bool start_conn_manager(struct conn_list *lists, unsigned int num_lists, conn_ready_handler handler)
+{
+    if (!lists || manager_running)
+        return false;
+
+    manager_lists = lists;
+    manager_num_lists = num_lists;
+    manager_handler = handler;
+    manager_wake = false;
+    __atomic_store_n(&manager_stop, false, __ATOMIC_RELAXED);
+    if (pthread_create(&manager_thread, NULL, run_conn_manager, NULL) != 0)
+    {
+        perror("Error: create pool manager pthread in start_conn_manager()");
+        return false;
+    }
+
+    manager_running = true;
+    return true;
+}
+
+/* ask the pool manager to open new connections to the server of a list. It never blocks on a handshake. */
+void request_conn_list(struct conn_list *list)
+{
+    if (!list || !manager_running)
+        return;
+
+    /* the manager is only woken up once until it serves the list */
+    if (__atomic_exchange_n(&(list->refill), true, __ATOMIC_ACQ_REL))
+        return;
+
+    pthread_mutex_lock(&manager_lock);
+    manager_wake = true;
+    pthread_cond_signal(&manager_cond);
+    pthread_mutex_unlock(&manager_lock);
+}
+
+/* serve all requests to the pool manager and stop it */
+void stop_conn_manager()
+{
+    if (!manager_running)
+        return;
+
+    pthread_mutex_lock(&manager_lock);
+    __atomic_store_n(&manager_stop, true, __ATOMIC_RELAXED);
+    pthread_cond_signal(&manager_cond);
+    pthread_mutex_unlock(&manager_lock);
+
+    pthread_join(manager_thread, NULL);
+    manager_running = false;
+}
+
+/* thread to run the pool manager */
+static void *run_conn_manager(void *ptr)
+{
+    unsigned int i;
+    bool busy;
+
+    while (true)
+    {
+        pthread_mutex_lock(&manager_lock);
+        while (!manager_wake && !__atomic_load_n(&manager_stop, __ATOMIC_RELAXED))
+            pthread_cond_wait(&manager_cond, &manager_lock);
+        manager_wake = false;
+        pthread_mutex_unlock(&manager_lock);
+
+        busy = false;
+        for (i = 0; i < manager_num_lists; i++)
         {
-            list->tail->next = new_node;
-            list->tail = new_node;
+            /* the flag is cleared first, so that requests made while connecting are not lost */
+            if (__atomic_exchange_n(&(manager_lists[i].refill), false, __ATOMIC_ACQ_REL))
+            {
+                grow_conn_list(&manager_lists[i]);
+                busy = true;
+            }
         }
-        pthread_mutex_lock(&(list->lock));
-        list->len++;
-        list->available_len++;
-        pthread_mutex_unlock(&(list->lock));
+
+        if (!busy && __atomic_load_n(&manager_stop, __ATOMIC_RELAXED))
+            break;
     }
 
-    return true;
+    return (void*)0;
 }
 
-/* search the first available connection (busy==false && connected==true) in the list. */
-struct conn_node *search_conn_list(struct conn_list *list)
+/* push a node to a stack of available connections */
+static void push_conn_stack(struct conn_node **head, struct conn_node *node)
 {
-    struct conn_node *ptr = NULL;
+    node->next_free = __atomic_load_n(head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(head, &(node->next_free), node, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+/* push an available node to the stack of its number of outstanding flows */
+static void push_free_conn(struct conn_list *list, struct conn_node *node)
+{
+    unsigned int outstanding = __atomic_load_n(&(node->outstanding), __ATOMIC_RELAXED);
+
+    push_conn_stack(&(list->free_heads[min(outstanding, TG_CONN_MAX_DEPTH - 1)]), node);
+    __atomic_fetch_add(&(list->available_len), 1, __ATOMIC_RELAXED);
+}
+
+/* pop a node from a stack of available connections (by the only popping thread) */
+static struct conn_node *pop_conn_stack(struct conn_node **head)
+{
+    struct conn_node *node = NULL;
+
+    do
+    {
+        node = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+        if (!node)
+            return NULL;
+    } while (!__atomic_compare_exchange_n(head, &node, node->next_free, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    return node;
+}
 
-    if (!list || !(list->available_len))
+/*
+ * Pop an available connection from the list and add an outstanding flow to it.
+ * A connection is available as long as it has less than list->depth outstanding
+ * flows. It is kept in the stack of the number of flows it had when it was pushed,
+ * and the stacks are popped from the least loaded one, so that requests are pipelined
+ * only when no connection is idle. A connection whose flows finish while it is in a
+ * stack stays there, which only makes it less preferred. Connections closed while
+ * they are available are dropped. Since only one thread pops
+ * from a list, a popped node cannot be pushed back concurrently (no ABA).
+ * When less than list->low_water connections are left, the pool manager is
+ * asked to open new ones.
+ */
+struct conn_node *pop_conn_list(struct conn_list *list)
+{
+    struct conn_node *node = NULL;
+    unsigned int i;
+
+    if (!list)
         return NULL;
 
-    ptr = list->head;
+    if (list->low_water > 0 && get_available_conn_list(list) <= list->low_water)
+        request_conn_list(list);
+
     while (true)
     {
-        if (!ptr)
+        for (i = 0, node = NULL; i < min(list->depth, TG_CONN_MAX_DEPTH) && !node; i++)
+            node = pop_conn_stack(&(list->free_heads[i]));
+        if (!node)
             return NULL;
-        else if (!(ptr->busy) && ptr->connected)
-            return ptr;
-        else
-            ptr = ptr->next;
+
+        __atomic_fetch_sub(&(list->available_len), 1, __ATOMIC_RELAXED);
+        if (node->connected)
+        {
+            if (__atomic_add_fetch(&(node->outstanding), 1, __ATOMIC_RELAXED) < list->depth)
+                push_free_conn(list, node);
+            return node;
+        }
     }
 
     return NULL;
 }
 
-/* search N available connections in the list */
-struct conn_node **search_n_conn_list(struct conn_list *list, unsigned int num)
+/* pop N available connections from the list and add an outstanding flow to each of them */
+struct conn_node **pop_n_conn_list(struct conn_list *list, unsigned int num)
 {
-    struct conn_node *ptr = NULL;
     struct conn_node **result = NULL;
-    int i = 0;
+    unsigned int i = 0;
 
-    if (!list || list->available_len < num || !num)
+    if (!list || get_available_conn_list(list) < num || !num)
         return NULL;
 
     result = (struct conn_node**)malloc(num * sizeof(struct conn_node*));
     if (!result)
     {
-        perror("Error: malloc result in search_n_conn_list()");
+        perror("Error: malloc result in pop_n_conn_list()");
         return NULL;
     }
 
-    ptr = list->head;
-    while (true)
+    for (i = 0; i < num; i++)
     {
-        if (ptr)
-        {
-            if (!(ptr->busy) && ptr->connected)
-                result[i++] = ptr;
-
-            if (i < num)
-                ptr = ptr->next;
-            else
-                return result;
-        }
-        else
+        result[i] = pop_conn_list(list);
+        if (!result[i])
         {
+            /* not enough connections: give back what we got */
+            while (i > 0)
+                push_conn_list(result[--i]);
             free(result);
             return NULL;
         }
     }
 
-    return NULL;
+    return result;
+}
+
+/* finish an outstanding flow of a connection, which makes it available again if it was full */
+void push_conn_list(struct conn_node *node)
+{
+    if (!node)
+        return;
+
+    if (__atomic_fetch_sub(&(node->outstanding), 1, __ATOMIC_RELAXED) == node->list->depth)
+        push_free_conn(node->list, node);
 }
 
-/* wait for all threads in the linked list to finish */
+/* get the number of available connections in the list */
+unsigned int get_available_conn_list(struct conn_list *list)
+{
+    return (list) ? __atomic_load_n(&(list->available_len), __ATOMIC_RELAXED) : 0;
+}
+
+/* wait for all connections in the linked list to be closed */
 void wait_conn_list(struct conn_list *list)
 {
     struct conn_node *ptr = NULL;
-    struct timespec ts;
-    int s;
 
     if (!list)
         return;
 
-    ptr = list->head;
-    while (true)
+    pthread_mutex_lock(&(list->lock));
+    for (ptr = list->head; ptr != NULL; ptr = ptr->next)
     {
-        if (!ptr)
-            break;
-        else
-        {
-            /* if this connection is active, we need to wait for long enough time */
-            if (ptr->connected)
-            {
-                s = pthread_join(ptr->thread, NULL);
-                if (s != 0)
-                {
-                    char msg[256] = {0};
-                    snprintf(msg, 256, "Error: pthread_join() (to %s:%hu) in wait_conn_list()",
-                             list->ip, list->port);
-                    perror(msg);
-                }
-            }
-            else
-            {
-                clock_gettime(CLOCK_REALTIME, &ts);
-                ts.tv_sec += 5;
-                s = pthread_timedjoin_np(ptr->thread, NULL, &ts);
-                if (s != 0)
-                {
-                    char msg[256] = {0};
-                    snprintf(msg, 256, "Error: pthread_timedjoin_np() (to %s:%hu) in wait_conn_list()",
-                             list->ip, list->port);
-                    perror(msg);
-                }
-            }
-            ptr = ptr->next;
-        }
+        /* receivers signal the condition when they close connections */
+        while (ptr->connected)
+            pthread_cond_wait(&(list->cond), &(list->lock));
     }
+    pthread_mutex_unlock(&(list->lock));
+}
+
+/*
+ * The link is modeled as an M/G/1 processor-sharing queue of jobs, where a job gets its share
+ * E[S] / (C (1 - load)) of the link unless its flows are paced slower, i.e., for E[S / rate] of
+ * its flows, and its first byte comes back after a base RTT. By Little's law with this mean
+ * sojourn time W, the expected number of outstanding jobs is N = W / period, which is
+ * load / (1 - load) without pacing and RTT. Their number is geometric with mean N, and splitting
+ * the flows of jobs over servers thins it into a geometric distribution with mean N * q per
+ * server (ratio N * q / (1 + N * q)), where q is the share of a server.
+ */
+bool plan_conn_pool(struct conn_plan *plan, double avg_bytes, double period_us, double capacity_mbps, double server_flows,
+                    double job_flows, unsigned int *rate_value, unsigned int *rate_prob, unsigned int num_rate)
+{
+    double q = min(server_flows, 1);
+    double share_us, flow_bits, ratio;
+    double paced_us = 0, weight_total = 0;
+    unsigned int i;
+
+    if (!plan || period_us <= 0 || capacity_mbps <= 0)
+        return false;
+
+    memset(plan, 0, sizeof(struct conn_plan));
+    plan->capacity_mbps = capacity_mbps;
+    plan->load = avg_bytes * 8 / period_us / (capacity_mbps * TG_GOODPUT_RATIO);
+    if (plan->load >= 1)
+        return false;
+
+    /* a job takes the longer of its share of the link and the time its flows are paced for */
+    share_us = avg_bytes * 8 / (capacity_mbps * TG_GOODPUT_RATIO * (1 - plan->load));
+    flow_bits = avg_bytes * 8 / max(job_flows, 1);
+    for (i = 0; rate_value && rate_prob && i < num_rate; i++)
+    {
+        paced_us += (double)rate_prob[i] * ((rate_value[i] > 0) ? max(share_us, flow_bits / rate_value[i]) : share_us);
+        weight_total += rate_prob[i];
+    }
+    plan->sojourn_us = ((weight_total > 0) ? paced_us / weight_total : share_us) + TG_PLAN_BASE_RTT;
+
+    plan->avg_flows = plan->sojourn_us / period_us * server_flows;
+    ratio = plan->sojourn_us / period_us * q / (1 + plan->sojourn_us / period_us * q);
+    if (ratio > 0)
+        plan->max_flows = (unsigned int)ceil(log(1 - TG_PLAN_PERCENTILE / 100) / log(ratio));
+    /* jobs with more than one flow per server */
+    if (server_flows > 1)
+        plan->max_flows = (unsigned int)ceil(plan->max_flows * server_flows);
+
+    return true;
+}
+
+/* get the maximum receive buffer of a connection (bytes) */
+static unsigned long long get_max_rcvbuf(int rcvbuf)
+{
+    unsigned long long rmem[3] = {4096, 131072, 6291456};
+    FILE *fd = NULL;
+
+    /* the kernel doubles SO_RCVBUF for its bookkeeping */
+    if (rcvbuf > 0)
+        return 2ULL * rcvbuf;
+
+    /* autotuning grows buffers up to tcp_rmem[2] */
+    fd = fopen("/proc/sys/net/ipv4/tcp_rmem", "r");
+    if (fd)
+    {
+        if (fscanf(fd, "%llu %llu %llu", &rmem[0], &rmem[1], &rmem[2]) != 3)
+            rmem[2] = 6291456;
+        fclose(fd);
+    }
+
+    return rmem[2];
+}
+
+/* print the predicted concurrency, file descriptors and memory of num_server pools of num_conn connections */
+void print_conn_plan(struct conn_plan *plan, unsigned int num_server, unsigned int num_conn, int rcvbuf)
+{
+    unsigned long long total_conn = (unsigned long long)num_server * num_conn;
+    unsigned long long max_rcvbuf = get_max_rcvbuf(rcvbuf);
+    struct rlimit rl;
+
+    if (!plan)
+        return;
+
+    printf("The expected link load is %.1f%% of %.0f Mbps\n", plan->load * 100, plan->capacity_mbps);
+    printf("Expected outstanding time of a request: %.1f us (base RTT %d us)\n", plan->sojourn_us, TG_PLAN_BASE_RTT);
+    printf("Expected outstanding flows per server: %.2f on average, %u at the %.1fth percentile\n", plan->avg_flows, plan->max_flows, TG_PLAN_PERCENTILE);
+    printf("Connection pools: %u per server, %llu in total\n", num_conn, total_conn);
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+    {
+        printf("File descriptors: %llu for connections (limit %llu)\n", total_conn, (unsigned long long)rl.rlim_cur);
+        if (total_conn >= rl.rlim_cur)
+            printf("Warning: connections exceed the limit of file descriptors (ulimit -n)\n");
+    }
+    else
+        printf("File descriptors: %llu for connections\n", total_conn);
+    printf("Memory: %.1f KB of connection state, receive buffers up to %.1f MB (%.1f MB for the expected outstanding flows)\n",
+           total_conn * sizeof(struct conn_node) / 1024.0, total_conn * max_rcvbuf / 1048576.0, plan->avg_flows * num_server * max_rcvbuf / 1048576.0);
 }
 
 /* clear all the nodes in the linked list */
@@ -259,5 +740,6 @@ void print_conn_list(struct conn_list *list)
 {
     if (list)
         printf("%s:%hu  total connections: %u  available connections: %u  flows finished: %u\n",
-               list->ip, list->port, list->len, list->available_len, list->flow_finished);
+               list->ip, list->port, list->len, get_available_conn_list(list),
+               __atomic_load_n(&(list->flow_finished), __ATOMIC_RELAXED));
 }
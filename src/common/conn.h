@@ -6,6 +6,22 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <sys/time.h>
+
+#include "common.h"
+
+/* default number of available connections below which the pool manager opens new ones */
+#define TG_CONN_LOW_WATER 2
+/* default number of connections the pool manager opens at a time */
+#define TG_CONN_GROW 4
+/* maximum number of outstanding flows per connection (pipeline depth) */
+#define TG_CONN_MAX_DEPTH 16
+/* time (ms) allowed to establish a connection, including its version negotiation */
+#define TG_CONN_TIMEOUT_MS 1000
+/* percentile of outstanding flows that connection pools are sized for */
+#define TG_PLAN_PERCENTILE 99.9
+/* base RTT (us) of a request in the load model: from its request to the first byte of its response */
+#define TG_PLAN_BASE_RTT 100
 
 struct conn_list;
 
@@ -13,10 +29,17 @@ struct conn_node
 {
     int id; /* connection ID */
     int sockfd; /* socket */
-    pthread_t thread;   /* thread */
-    bool busy;  /* whether the connection is receiving data */
+    unsigned int outstanding;   /* number of outstanding flows (accessed atomically) */
     bool connected; /* whether the connection is established */
+    unsigned int version;   /* protocol version negotiated with the server */
+    char meta_buf[TG_METADATA_MAX_SIZE];    /* metadata of the flow being received */
+    unsigned int meta_len;  /* number of metadata bytes received */
+    struct flow_metadata flow;  /* flow being received */
+    unsigned long long bytes_recv;  /* number of flow bytes received */
+    int rcvlowat;   /* current SO_RCVLOWAT of the socket */
+    struct timeval resp_time;   /* time when the response of the flow begins */
     struct conn_node *next; /* pointer to next node */
+    struct conn_node *next_free;    /* pointer to next available node in its stack */
     struct conn_list *list; /* pointer to parent list */
 };
 
@@ -28,28 +51,106 @@ struct conn_list
     struct conn_node *head; /* pointer to head node */
     struct conn_node *tail; /* pointer to tail node */
     unsigned int len;   /* total number of nodes */
-    unsigned int available_len; /* total number of available nodes */
-    unsigned int flow_finished; /* total number of flows finished */
-    pthread_mutex_t lock;
+    unsigned int available_len; /* total number of available nodes (accessed atomically) */
+    unsigned int flow_finished; /* total number of flows finished (accessed atomically) */
+    struct conn_node *free_heads[TG_CONN_MAX_DEPTH];   /* lock-free stacks of available nodes by outstanding flows */
+    unsigned int depth; /* maximum number of outstanding flows per connection (default 1, at most TG_CONN_MAX_DEPTH) */
+    int rcvbuf; /* SO_RCVBUF of new connections (default 0: kernel autotuning) */
+    unsigned int low_water; /* the pool manager opens connections when fewer are available (0: never) */
+    unsigned int grow;  /* number of connections the pool manager opens at a time */
+    bool refill;    /* whether the pool manager is asked to open connections (accessed atomically) */
+    pthread_mutex_t lock;   /* protects the links of nodes, len, connected and cond */
+    pthread_cond_t cond;    /* signaled when a connection is closed */
+};
+
+/* load model of the client link, used to size connection pools before a run */
+struct conn_plan
+{
+    double capacity_mbps;   /* capacity of the link */
+    double load;    /* utilization of the link */
+    double sojourn_us;  /* expected time a job is outstanding */
+    double avg_flows;   /* expected number of outstanding flows per server */
+    unsigned int max_flows; /* number of outstanding flows per server at TG_PLAN_PERCENTILE */
 };
 
 
 /* initialize functions */
-bool init_conn_node(struct conn_node *node, int id, struct conn_list *list);
 bool init_conn_list(struct conn_list *list, int index, char *ip, unsigned short port);
 
-/* insert several nodes to the tail of the linked list */
+/*
+ * Open num connections to the server of a list with non-blocking connect() calls in parallel,
+ * and return the number of connections established, which are stored at the beginning of nodes.
+ */
+unsigned int open_conn_nodes(struct conn_list *list, struct conn_node **nodes, unsigned int num);
+
+/*
+ * Append a connected node to the tail of the linked list with num_flows outstanding flows sent on it
+ * before, and make it available if it can take more flows. Some of these flows may have finished.
+ */
+void add_conn_list(struct conn_list *list, struct conn_node *node, unsigned int num_flows);
+
+/* close the socket of a node which is not in a list and release it */
+void drop_conn_node(struct conn_node *node);
+
+/* establish several connections in parallel and insert them to the tail of the linked list */
 bool insert_conn_list(struct conn_list *list, int num);
 
-/* search the first available connection (busy==false) in the list. */
-struct conn_node *search_conn_list(struct conn_list *list);
+/*
+ * Called in the pool manager thread for each new connection of a list (NULL if no connection
+ * can be established). The node is not in the list yet, so the handler may start receiving
+ * flows on it and send requests on it before it adds the node with add_conn_list(), which
+ * takes the number of requests sent. A node which cannot receive flows is dropped instead.
+ */
+typedef void (*conn_ready_handler)(struct conn_list *list, struct conn_node *node);
+
+/*
+ * The pool manager is a thread which opens list->grow connections to the server of a list
+ * when it is asked to, e.g., when a pop leaves less than list->low_water connections available.
+ * Threads which use the pool never block on a handshake. Without a handler, new nodes are
+ * added to their list.
+ */
+bool start_conn_manager(struct conn_list *lists, unsigned int num_lists, conn_ready_handler handler);
 
-/* search N available connections in the list */
-struct conn_node **search_n_conn_list(struct conn_list *list, unsigned int num);
+/* ask the pool manager to open new connections to the server of a list */
+void request_conn_list(struct conn_list *list);
 
-/* wait for all threads in the linked list to finish */
+/* serve all requests to the pool manager and stop it */
+void stop_conn_manager();
+
+/*
+ * Available connections (with less than depth outstanding flows) are kept in one lock-free
+ * stack per number of outstanding flows. Any thread can push a connection, but only one thread
+ * at a time may pop connections from a list. With depth > 1, requests are pipelined on the
+ * least loaded connections once no connection is idle, and the server answers them in order.
+ */
+
+/* pop an available connection from the list and add an outstanding flow to it */
+struct conn_node *pop_conn_list(struct conn_list *list);
+
+/* pop N available connections from the list and add an outstanding flow to each of them */
+struct conn_node **pop_n_conn_list(struct conn_list *list, unsigned int num);
+
+/* finish an outstanding flow of a connection, which makes it available again */
+void push_conn_list(struct conn_node *node);
+
+/* get the number of available connections in the list */
+unsigned int get_available_conn_list(struct conn_list *list);
+
+/* wait for all connections in the linked list to be closed */
 void wait_conn_list(struct conn_list *list);
 
+/*
+ * Estimate the outstanding flows per server of a client whose link is shared by jobs (requests)
+ * of avg_bytes arriving every period_us on average. Each job has job_flows flows, server_flows of
+ * them to a server on average, and each flow is paced at one of num_rate sending rates (Mbps, 0 for
+ * no limit) with weights rate_prob. Return false if the link is overloaded, so that the model does not apply.
+ */
+bool plan_conn_pool(struct conn_plan *plan, double avg_bytes, double period_us, double capacity_mbps, double server_flows,
+                    double job_flows, unsigned int *rate_value, unsigned int *rate_prob, unsigned int num_rate);
+
+/* print the predicted concurrency, file descriptors and memory of num_server pools of num_conn connections */
+void print_conn_plan(struct conn_plan *plan, unsigned int num_server, unsigned int num_conn, int rcvbuf);
+
 /* clear all the nodes in the linked list */
 void clear_conn_list(struct conn_list *list);
 
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "fctlog.h"
+
+/* thread to write out full buffers of a log */
+static void *run_fct_log_writer(void *ptr);
+
+/* write records to the log file */
+static void write_fct_records(struct fct_log *log, char *records, unsigned int num)
+{
+    unsigned int i = 0;
+
+    if (log->binary)
+    {
+        if (fwrite(records, log->record_size, num, log->fd) != num)
+            perror("Error: write binary log");
+    }
+    else
+    {
+        for (i = 0; i < num; i++)
+            print_fct_record(log->fd, (struct fct_record*)(records + (size_t)i * log->record_size));
+    }
+}
+
+/* get the size of records of a type */
+unsigned int get_fct_record_size(unsigned int type)
+{
+    if ((type & TG_RECORD_TYPE_MASK) == TG_RECORD_FLOW)
+        return sizeof(struct fct_record_ext);
+    else
+        return sizeof(struct fct_record);
+}
+
+/* open a log file of records of a type and start its writer thread. Return true if it succeeds. */
+bool open_fct_log(struct fct_log *log, char *file_name, bool binary, unsigned int type)
+{
+    struct fct_log_header header;
+
+    if (!log)
+        return false;
+
+    memset(log, 0, sizeof(struct fct_log));
+    log->binary = binary;
+    log->record_size = get_fct_record_size(type);
+    log->fd = fopen(file_name, binary ? "wb" : "w");
+    log->bufs[0] = (char*)malloc((size_t)TG_FCT_LOG_RECORDS * log->record_size);
+    log->bufs[1] = (char*)malloc((size_t)TG_FCT_LOG_RECORDS * log->record_size);
+    log->cap[0] = log->cap[1] = TG_FCT_LOG_RECORDS;
+    if (!log->fd || !log->bufs[0] || !log->bufs[1])
+    {
+        perror("Error: open log in open_fct_log()");
+        goto err;
+    }
+
+    if (binary)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TG_FCT_LOG_MAGIC, sizeof(header.magic));
+        header.version = TG_FCT_LOG_VERSION;
+        header.record_size = log->record_size;
+        if (fwrite(&header, sizeof(header), 1, log->fd) != 1)
+        {
+            perror("Error: write log header in open_fct_log()");
+            goto err;
+        }
+    }
+
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->cond, NULL);
+    if (pthread_create(&log->thread, NULL, run_fct_log_writer, (void*)log) != 0)
+    {
+        perror("Error: create log writer pthread in open_fct_log()");
+        goto err;
+    }
+
+    return true;
+
+err:
+    if (log->fd)
+        fclose(log->fd);
+    free(log->bufs[0]);
+    free(log->bufs[1]);
+    memset(log, 0, sizeof(struct fct_log));
+    return false;
+}
+
+/* double the capacity of the active buffer of a log (with the lock held). Return true if it succeeds. */
+static bool grow_fct_log(struct fct_log *log)
+{
+    unsigned int cap = 2 * log->cap[log->active];
+    char *buf = NULL;
+
+    if (cap < log->cap[log->active])
+        return false;
+
+    buf = (char*)realloc(log->bufs[log->active], (size_t)cap * log->record_size);
+    if (!buf)
+        return false;
+
+    log->bufs[log->active] = buf;
+    log->cap[log->active] = cap;
+    return true;
+}
+
+/*
+ * Append a record to a log (thread-safe). r points to a record of the type of the log.
+ * Receiver threads do not wait for the writer: a full buffer is handed over to the writer
+ * if it is idle, and grows otherwise. Records are never dropped, since they are the
+ * measurement: only if the buffer cannot grow, the caller waits for the writer.
+ */
+void append_fct_log(struct fct_log *log, struct fct_record *r)
+{
+    pthread_mutex_lock(&log->lock);
+
+    while (log->len[log->active] == log->cap[log->active])
+    {
+        if (!log->busy)
+        {
+            log->busy = true;
+            log->active ^= 1;
+            log->len[log->active] = 0;
+            pthread_cond_broadcast(&log->cond);
+        }
+        else if (!grow_fct_log(log))
+            pthread_cond_wait(&log->cond, &log->lock);
+    }
+
+    memcpy(log->bufs[log->active] + (size_t)log->len[log->active] * log->record_size, r, log->record_size);
+    log->len[log->active]++;
+    pthread_mutex_unlock(&log->lock);
+}
+
+static void *run_fct_log_writer(void *ptr)
+{
+    struct fct_log *log = (struct fct_log*)ptr;
+    struct timespec deadline;
+    unsigned int full;
+
+    pthread_mutex_lock(&log->lock);
+    while (true)
+    {
+        if (!log->busy)
+        {
+            if (log->closing)
+                break;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += TG_FCT_LOG_FLUSH_S;
+            /* periodically write out a partially filled buffer */
+            if (pthread_cond_timedwait(&log->cond, &log->lock, &deadline) == ETIMEDOUT && !log->busy && log->len[log->active] > 0)
+            {
+                log->busy = true;
+                log->active ^= 1;
+                log->len[log->active] = 0;
+            }
+            continue;
+        }
+
+        full = log->active ^ 1;
+        pthread_mutex_unlock(&log->lock);
+        write_fct_records(log, log->bufs[full], log->len[full]);
+        fflush(log->fd);
+        pthread_mutex_lock(&log->lock);
+
+        log->num_records += log->len[full];
+        log->len[full] = 0;
+        log->busy = false;
+        pthread_cond_broadcast(&log->cond);
+    }
+
+    /* records left in the active buffer */
+    write_fct_records(log, log->bufs[log->active], log->len[log->active]);
+    log->num_records += log->len[log->active];
+    log->len[log->active] = 0;
+    pthread_mutex_unlock(&log->lock);
+
+    return (void*)0;
+}
+
+/* write out all records, stop the writer thread and close the log file */
+void close_fct_log(struct fct_log *log)
+{
+    if (!log || !log->fd)
+        return;
+
+    pthread_mutex_lock(&log->lock);
+    log->closing = true;
+    pthread_cond_broadcast(&log->cond);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->thread, NULL);
+
+    fclose(log->fd);
+    log->fd = NULL;
+    free(log->bufs[0]);
+    free(log->bufs[1]);
+    log->bufs[0] = log->bufs[1] = NULL;
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->cond);
+}
+
+/* print a record as a line of the text log format */
+void print_fct_record(FILE *fd, struct fct_record *r)
+{
+    struct fct_record_ext *e = (struct fct_record_ext*)r;
+    unsigned int goodput_mbps = (r->fct_us > 0) ? r->size * 8 / r->fct_us : 0;
+    long long transfer_us = 0;
+
+    switch (r->type & TG_RECORD_TYPE_MASK)
+    {
+        case TG_RECORD_FLOW:
+            /* the transfer time is the rest of the FCT */
+            if (r->type & TG_RECORD_SERVER_TIME)
+                transfer_us = (long long)r->fct_us - e->transit_us - e->queue_us;
+            /*
+             * size (bytes), FCT(us), DSCP, sending rate (Mbps), goodput (Mbps), FCT from response begin (us),
+             * request transit (us), server queueing (us), data transfer (us)
+             */
+            fprintf(fd, "%llu %u %u %u %u %u %d %d %lld\n", r->size, r->fct_us, r->dscp, r->rate, goodput_mbps,
+                    e->resp_fct_us, e->transit_us, e->queue_us, transfer_us);
+            break;
+
+        case TG_RECORD_INCAST_FLOW:
+            /* flow size, FCT(us), DSCP, sending rate (Mbps), goodput (Mbps) */
+            fprintf(fd, "%llu %u %u %u %u\n", r->size, r->fct_us, r->dscp, r->rate, goodput_mbps);
+            break;
+
+        case TG_RECORD_INCAST_REQ:
+            /* request size, RCT(us), DSCP, sending rate (Mbps), goodput (Mbps), fanout */
+            fprintf(fd, "%llu %u %u %u %u %u\n", r->size, r->fct_us, r->dscp, r->rate, goodput_mbps, r->server_id);
+            break;
+    }
+}
+
+/* read the header of a binary log file and return its record size (0 if it is invalid) */
+unsigned int read_fct_log_header(FILE *fd)
+{
+    struct fct_log_header header;
+
+    if (fread(&header, sizeof(header), 1, fd) != 1)
+        return 0;
+
+    if (memcmp(header.magic, TG_FCT_LOG_MAGIC, sizeof(header.magic)) != 0 || header.version != TG_FCT_LOG_VERSION)
+        return 0;
+    if (header.record_size != sizeof(struct fct_record) && header.record_size != sizeof(struct fct_record_ext))
+        return 0;
+
+    return header.record_size;
+}
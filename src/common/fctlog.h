@@ -0,0 +1,99 @@
+#ifndef FCTLOG_H
+#define FCTLOG_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* types of completion records (the low bits of fct_record.type) */
+#define TG_RECORD_FLOW 0    /* flow of client (struct fct_record_ext) */
+#define TG_RECORD_INCAST_FLOW 1 /* flow of incast-client */
+#define TG_RECORD_INCAST_REQ 2  /* request of incast-client */
+#define TG_RECORD_TYPE_MASK 0x0F
+/* flags of completion records (the high bits of fct_record.type) */
+#define TG_RECORD_SERVER_TIME 0x10  /* transit_us and queue_us are measured with server timestamps */
+
+/* binary log files start with a header */
+#define TG_FCT_LOG_MAGIC "TGFCTLOG"
+#define TG_FCT_LOG_VERSION 3
+/* number of records per log buffer */
+#define TG_FCT_LOG_RECORDS 16384
+/* the background writer writes out buffered records at least every TG_FCT_LOG_FLUSH_S seconds */
+#define TG_FCT_LOG_FLUSH_S 1
+
+/* header of binary log files */
+struct fct_log_header
+{
+    char magic[8];  /* TG_FCT_LOG_MAGIC */
+    unsigned int version;   /* TG_FCT_LOG_VERSION */
+    unsigned int record_size;   /* size of each record, given by the type of records in the file */
+};
+
+/*
+ * Fixed-width record of a completed flow or request (host byte order, 32 bytes).
+ * Times are taken with gettimeofday(), so they are kept in microseconds.
+ */
+struct fct_record
+{
+    unsigned long long size;    /* size (bytes) */
+    unsigned int start_s;   /* start time (s since the Epoch) */
+    unsigned int start_us;  /* start time (us within the second) */
+    unsigned int fct_us;    /* completion time (us) */
+    unsigned int req_id;    /* request ID */
+    unsigned int rate;  /* sending rate (Mbps) */
+    unsigned short server_id;   /* server ID (flows) or fanout (TG_RECORD_INCAST_REQ) */
+    unsigned char dscp; /* DSCP value */
+    unsigned char type; /* TG_RECORD_* and flags */
+};
+
+/* extended record of a flow of client (TG_RECORD_FLOW, 48 bytes) */
+struct fct_record_ext
+{
+    struct fct_record base;
+    unsigned int resp_fct_us;   /* FCT from the beginning of the response (us) */
+    int transit_us; /* request transit time (us, TG_PROTO_V2 only) */
+    int queue_us;   /* server queueing time (us, TG_PROTO_V2 only) */
+    unsigned int reserved;  /* 0, pads the record to a multiple of 8 bytes */
+};
+
+/* log of completion records, written by a background thread */
+struct fct_log
+{
+    FILE *fd;
+    bool binary;    /* binary records or text lines */
+    unsigned int record_size;   /* size of each record in the buffers */
+    char *bufs[2];  /* records are appended to bufs[active] while the writer writes the other */
+    unsigned int len[2];    /* number of records in each buffer */
+    unsigned int cap[2];    /* capacity of each buffer (records) */
+    unsigned int active;
+    bool busy;  /* whether the writer is writing the other buffer */
+    bool closing;
+    unsigned long long num_records; /* number of written records */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+/* get the size of records of a type */
+unsigned int get_fct_record_size(unsigned int type);
+
+/* open a log file of records of a type and start its writer thread. Return true if it succeeds. */
+bool open_fct_log(struct fct_log *log, char *file_name, bool binary, unsigned int type);
+
+/*
+ * Append a record to a log (thread-safe). r points to a record of the type of the log.
+ * Records are never dropped: if the writer is busy, the buffer grows, and the caller only
+ * waits for the writer if memory runs out.
+ */
+void append_fct_log(struct fct_log *log, struct fct_record *r);
+
+/* write out all records, stop the writer thread and close the log file */
+void close_fct_log(struct fct_log *log);
+
+/* print a record as a line of the text log format */
+void print_fct_record(FILE *fd, struct fct_record *r);
+
+/* read the header of a binary log file and return its record size (0 if it is invalid) */
+unsigned int read_fct_log_header(FILE *fd);
+
+#endif
@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "hist.h"
+
+/* get the index of the bucket counting a value */
+unsigned int get_hist_bucket(unsigned long long value)
+{
+    unsigned int msb;
+
+    if (value < TG_HIST_SUB_COUNT)
+        return value;
+
+    if (value >= (1ULL << TG_HIST_MAX_BITS))
+        return TG_HIST_BUCKETS - 1;
+
+    msb = 63 - __builtin_clzll(value);
+    return TG_HIST_SUB_COUNT + (msb - TG_HIST_SUB_BITS) * (TG_HIST_SUB_COUNT / 2) +
+           (unsigned int)(value >> (msb - TG_HIST_SUB_BITS + 1)) - TG_HIST_SUB_COUNT / 2;
+}
+
+/* highest value counted in a bucket */
+static unsigned long long hist_value(unsigned int index)
+{
+    unsigned int shift, sub;
+
+    if (index < TG_HIST_SUB_COUNT)
+        return index;
+
+    shift = (index - TG_HIST_SUB_COUNT) / (TG_HIST_SUB_COUNT / 2) + 1;
+    sub = (index - TG_HIST_SUB_COUNT) % (TG_HIST_SUB_COUNT / 2) + TG_HIST_SUB_COUNT / 2;
+    return ((unsigned long long)(sub + 1) << shift) - 1;
+}
+
+/* initialize a histogram */
+void init_hist(struct hist_table *table)
+{
+    if (!table)
+        return;
+
+    memset(table, 0, sizeof(struct hist_table));
+    table->min_value = ~0ULL;
+}
+
+/* add a value into a histogram */
+void record_hist(struct hist_table *table, unsigned long long value)
+{
+    if (!table)
+        return;
+
+    table->counts[get_hist_bucket(value)]++;
+    table->num_value++;
+    table->sum += value;
+    if (value < table->min_value)
+        table->min_value = value;
+    if (value > table->max_value)
+        table->max_value = value;
+}
+
+/* add all values of another histogram into a histogram */
+void merge_hist(struct hist_table *table, struct hist_table *other)
+{
+    unsigned int i = 0;
+
+    if (!table || !other)
+        return;
+
+    for (i = 0; i < TG_HIST_BUCKETS; i++)
+        table->counts[i] += other->counts[i];
+    table->num_value += other->num_value;
+    table->sum += other->sum;
+    if (other->min_value < table->min_value)
+        table->min_value = other->min_value;
+    if (other->max_value > table->max_value)
+        table->max_value = other->max_value;
+}
+
+/* get the average value of a histogram */
+double avg_hist(struct hist_table *table)
+{
+    if (!table || table->num_value == 0)
+        return 0;
+
+    return (double)table->sum / table->num_value;
+}
+
+/* find the bucket of the rank-th smallest value (1-based) and the rank of the value in the bucket */
+unsigned int find_rank_hist(struct hist_table *table, unsigned long long rank, unsigned long long *bucket_rank)
+{
+    unsigned long long count = 0;
+    unsigned int i = 0;
+
+    for (i = 0; i < TG_HIST_BUCKETS - 1; i++)
+    {
+        if (count + table->counts[i] >= rank)
+            break;
+        count += table->counts[i];
+    }
+
+    if (bucket_rank)
+        *bucket_rank = rank - count;
+    return i;
+}
+
+/* get the value at a percentile (0 - 100) of a histogram */
+unsigned long long percentile_hist(struct hist_table *table, double percentile)
+{
+    unsigned long long target, count = 0;
+    unsigned int i = 0;
+
+    if (!table || table->num_value == 0)
+        return 0;
+
+    /* the smallest value which at least percentile% of values are not larger than */
+    target = (unsigned long long)(percentile / 100 * table->num_value + 0.5);
+    if (target == 0)
+        return table->min_value;
+
+    for (i = 0; i < TG_HIST_BUCKETS; i++)
+    {
+        count += table->counts[i];
+        if (count >= target)
+            break;
+    }
+
+    if (i == TG_HIST_BUCKETS)
+        return table->max_value;
+    /* the bucket may be wider than the range of recorded values */
+    if (hist_value(i) > table->max_value)
+        return table->max_value;
+    if (hist_value(i) < table->min_value)
+        return table->min_value;
+    return hist_value(i);
+}
+
+/* print the number of values, average, p50, p99 and p99.9 of a histogram in a line */
+void print_hist(struct hist_table *table, char *name)
+{
+    if (!table)
+        return;
+
+    printf("%s: %llu flows, average %.0f us, p50 %llu us, p99 %llu us, p99.9 %llu us\n", name, table->num_value,
+           avg_hist(table), percentile_hist(table, 50), percentile_hist(table, 99), percentile_hist(table, 99.9));
+}
@@ -0,0 +1,51 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Log-linear (HDR-style) histogram. Values below 2^TG_HIST_SUB_BITS are counted exactly.
+ * Each larger power of two is split into 2^(TG_HIST_SUB_BITS - 1) buckets, so a value
+ * is reported with a relative error below 2^(1 - TG_HIST_SUB_BITS).
+ */
+#define TG_HIST_SUB_BITS 8
+#define TG_HIST_SUB_COUNT (1 << TG_HIST_SUB_BITS)
+/* largest value power of two (larger values are counted in the last bucket) */
+#define TG_HIST_MAX_BITS 40
+#define TG_HIST_BUCKETS (TG_HIST_SUB_COUNT + (TG_HIST_MAX_BITS - TG_HIST_SUB_BITS) * (TG_HIST_SUB_COUNT / 2))
+
+struct hist_table
+{
+    unsigned long long counts[TG_HIST_BUCKETS];
+    unsigned long long num_value;   /* number of values */
+    unsigned long long sum; /* sum of values */
+    unsigned long long min_value;
+    unsigned long long max_value;
+};
+
+/* initialize a histogram */
+void init_hist(struct hist_table *table);
+
+/* add a value into a histogram */
+void record_hist(struct hist_table *table, unsigned long long value);
+
+/* add all values of another histogram into a histogram */
+void merge_hist(struct hist_table *table, struct hist_table *other);
+
+/* get the average value of a histogram */
+double avg_hist(struct hist_table *table);
+
+/* get the index of the bucket counting a value */
+unsigned int get_hist_bucket(unsigned long long value);
+
+/* find the bucket of the rank-th smallest value (1-based) and the rank of the value in the bucket */
+unsigned int find_rank_hist(struct hist_table *table, unsigned long long rank, unsigned long long *bucket_rank);
+
+/* get the value at a percentile (0 - 100) of a histogram */
+unsigned long long percentile_hist(struct hist_table *table, double percentile);
+
+/* print the number of values, average, p50, p99 and p99.9 of a histogram in a line */
+void print_hist(struct hist_table *table, char *name);
+
+#endif
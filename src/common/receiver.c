@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+
+#include "receiver.h"
+
+struct receiver
+{
+    unsigned int id;    /* index of the receiver thread */
+    int epoll_fd;
+    pthread_t thread;
+};
+
+static struct receiver *receivers = NULL;
+static unsigned int num_receivers = 0;
+static unsigned int next_receiver = 0;
+static flow_done_handler done_handler = NULL;
+
+/* thread to run a receiver */
+static void *run_receiver(void *ptr);
+
+bool start_receivers(unsigned int num_threads, flow_done_handler handler)
+{
+    unsigned int i = 0;
+
+    if (num_threads == 0 || receivers)
+        return false;
+
+    receivers = (struct receiver*)calloc(num_threads, sizeof(struct receiver));
+    if (!receivers)
+    {
+        perror("Error: calloc receivers in start_receivers()");
+        return false;
+    }
+
+    num_receivers = num_threads;
+    done_handler = handler;
+    for (i = 0; i < num_threads; i++)
+    {
+        receivers[i].id = i;
+        receivers[i].epoll_fd = epoll_create1(0);
+        if (receivers[i].epoll_fd < 0)
+        {
+            perror("Error: initialize receiver in start_receivers()");
+            return false;
+        }
+        if (pthread_create(&receivers[i].thread, NULL, run_receiver, (void*)&receivers[i]) != 0)
+        {
+            perror("Error: create receiver pthread in start_receivers()");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* start receiving flows on a connected node. Nodes are assigned to receivers in a round robin manner. */
+bool add_receiver_conn(struct conn_node *node)
+{
+    struct epoll_event ev;
+    struct receiver *r = NULL;
+
+    if (!node || !receivers)
+        return false;
+
+    r = &receivers[__atomic_fetch_add(&next_receiver, 1, __ATOMIC_RELAXED) % num_receivers];
+    node->meta_len = 0;
+    node->bytes_recv = 0;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = node;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, node->sockfd, &ev) < 0)
+    {
+        char msg[256] = {0};
+        snprintf(msg, 256, "Error: epoll_ctl (to %s:%hu) in add_receiver_conn()", node->list->ip, node->list->port);
+        perror(msg);
+        return false;
+    }
+
+    return true;
+}
+
+/* close a connection which will no longer be available */
+static void close_receiver_conn(struct conn_node *node)
+{
+    /* close() also removes the socket from the epoll set */
+    close(node->sockfd);
+
+    pthread_mutex_lock(&(node->list->lock));
+    node->connected = false;
+    pthread_cond_broadcast(&(node->list->cond));
+    pthread_mutex_unlock(&(node->list->lock));
+}
+
+/* the whole flow is received on a connection. Return false if the connection is closed. */
+static bool finish_flow(struct receiver *r, struct conn_node *node)
+{
+    struct timeval stop_time;
+
+    gettimeofday(&stop_time, NULL);
+    /* a special flow ID to terminate persistent connection */
+    if (node->flow.id == 0)
+    {
+        close_receiver_conn(node);
+        return false;
+    }
+
+    /* the server answered a flow we never asked for: the connection cannot be trusted */
+    if (done_handler && !done_handler(r->id, &(node->flow), &(node->resp_time), &stop_time))
+    {
+        printf("Error: drop unknown flow %u on connection (to %s:%hu) in finish_flow()\n", node->flow.id, node->list->ip, node->list->port);
+        close_receiver_conn(node);
+        return false;
+    }
+
+    node->meta_len = 0;
+    __atomic_fetch_add(&(node->list->flow_finished), 1, __ATOMIC_RELAXED);
+    push_conn_list(node);
+    return true;
+}
+
+/*
+ * Set SO_RCVLOWAT of a connection for the rest of the flow. While a large payload
+ * is drained, the receiver is only woken up when enough bytes are queued. The
+ * mark never exceeds what is left of the flow (or half of a fixed receive buffer),
+ * so a wakeup always comes. The option is only set when it changes.
+ */
+static void set_receiver_lowat(struct conn_node *node, unsigned int meta_size)
+{
+    int lowat = 1;
+    unsigned long long remaining = node->flow.size - node->bytes_recv;
+
+    if (node->meta_len == meta_size && remaining > TG_RECEIVER_LOWAT)
+    {
+        lowat = TG_RECEIVER_LOWAT;
+        if (node->list->rcvbuf > 0 && lowat > node->list->rcvbuf / 2)
+            lowat = max(node->list->rcvbuf / 2, 1);
+    }
+
+    if (lowat != node->rcvlowat && setsockopt(node->sockfd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat)) == 0)
+        node->rcvlowat = lowat;
+}
+
+/*
+ * Receive as much as possible on a connection without blocking.
+ * Return false if the connection is broken. The node must not be
+ * accessed after it is closed, since the pool may release it.
+ */
+static bool receive_conn(struct receiver *r, struct conn_node *node)
+{
+    ssize_t n = 0;
+    unsigned int reads = 0;
+    unsigned int meta_size = get_metadata_size(node->version);
+
+    while (reads < TG_RECEIVER_READS)
+    {
+        /* read the metadata of the flow */
+        if (node->meta_len < meta_size)
+        {
+            n = recv(node->sockfd, node->meta_buf + node->meta_len, meta_size - node->meta_len, MSG_DONTWAIT);
+            if (n <= 0)
+                break;
+
+            node->meta_len += n;
+            if (node->meta_len < meta_size)
+                continue;
+
+            unpack_flow_metadata(node->meta_buf, &(node->flow), node->version);
+            gettimeofday(&(node->resp_time), NULL);
+            node->bytes_recv = 0;
+        }
+        /* drain the payload of the flow, which the kernel discards without copying it */
+        else if (node->bytes_recv < node->flow.size)
+        {
+            n = recv(node->sockfd, NULL, min(node->flow.size - node->bytes_recv, TG_MAX_DISCARD), MSG_DONTWAIT | MSG_TRUNC);
+            if (n <= 0)
+                break;
+
+            node->bytes_recv += n;
+            reads++;
+        }
+
+        if (node->meta_len == meta_size && node->bytes_recv >= node->flow.size && !finish_flow(r, node))
+            return true;
+    }
+
+    if (reads < TG_RECEIVER_READS)
+    {
+        if (n == 0)
+        {
+            printf("Error: connection (to %s:%hu) closed by the server in receive_conn()\n", node->list->ip, node->list->port);
+            return false;
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            perror("Error: receive flow in receive_conn()");
+            return false;
+        }
+    }
+
+    set_receiver_lowat(node, meta_size);
+    return true;
+}
+
+/* thread to run a receiver */
+static void *run_receiver(void *ptr)
+{
+    struct receiver *r = (struct receiver*)ptr;
+    struct epoll_event events[TG_RECEIVER_EVENTS];
+    struct conn_node *node = NULL;
+    int i, n;
+
+    while (true)
+    {
+        n = epoll_wait(r->epoll_fd, events, TG_RECEIVER_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Error: epoll_wait in run_receiver()");
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            node = (struct conn_node*)events[i].data.ptr;
+            if (!receive_conn(r, node))
+                close_receiver_conn(node);
+        }
+    }
+
+    return (void*)0;
+}
@@ -0,0 +1,38 @@
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "conn.h"
+
+/* default number of receiver threads */
+#define TG_RECEIVER_THREADS 2
+/* maximum number of events returned by an epoll_wait() call */
+#define TG_RECEIVER_EVENTS 64
+/* maximum number of payload reads on a connection per event (fairness across connections) */
+#define TG_RECEIVER_READS 4
+/* SO_RCVLOWAT while a large payload is drained, so that a wakeup discards at least this many bytes */
+#define TG_RECEIVER_LOWAT (64 * 1024)
+
+/*
+ * Called in the receiver thread (receiver_id < num_threads) when a flow (ID != 0) is completely
+ * received at stop_time. resp_time is when the response (its metadata) begins to arrive. Return
+ * false if the flow does not match an outstanding request, which drops it and closes the connection.
+ */
+typedef bool (*flow_done_handler)(unsigned int receiver_id, struct flow_metadata *flow, struct timeval *resp_time, struct timeval *stop_time);
+
+/*
+ * Start num_threads epoll threads to receive flows on all connections of the
+ * connection pool. Each connection is served by one thread, which parses the
+ * flow metadata and discards the payload in the kernel (MSG_TRUNC). Responses of pipelined
+ * requests are matched by flow ID. When a flow is received, the connection
+ * can take another flow. A flow with ID 0 closes the connection.
+ */
+bool start_receivers(unsigned int num_threads, flow_done_handler handler);
+
+/* start receiving flows on a connected node */
+bool add_receiver_conn(struct conn_node *node);
+
+#endif
@@ -0,0 +1,57 @@
+#include "rng.h"
+
+/* generate the next number of a splitmix64 sequence */
+static unsigned long long splitmix64(unsigned long long *x)
+{
+    unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static unsigned long long rotl(unsigned long long x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* initialize the stream of a seed */
+void init_rng(struct rng_state *rng, unsigned long long seed, unsigned long long stream)
+{
+    /* different streams of a seed start from different splitmix64 states */
+    unsigned long long x = splitmix64(&seed) ^ (stream * 0xD1B54A32D192ED03ULL);
+    int i;
+
+    for (i = 0; i < 4; i++)
+        rng->s[i] = splitmix64(&x);
+}
+
+/* generate a 64-bit random number */
+unsigned long long next_rng(struct rng_state *rng)
+{
+    unsigned long long *s = rng->s;
+    unsigned long long result = rotl(s[1] * 5, 7) * 9;
+    unsigned long long t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/* generate a random floating point number in [0, 1) with 53 bits of resolution */
+double rand_double(struct rng_state *rng)
+{
+    return (next_rng(rng) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/* generate a random integer in [0, n) */
+unsigned long long rand_uint(struct rng_state *rng, unsigned long long n)
+{
+    /* multiply-shift, whose bias (below n / 2^64) is negligible */
+    return (unsigned long long)(((unsigned __int128)next_rng(rng) * n) >> 64);
+}
@@ -0,0 +1,26 @@
+#ifndef RNG_H
+#define RNG_H
+
+/*
+ * Pseudo-random number generator (xoshiro256**). Each generator thread owns its state,
+ * and independent streams are derived from a seed and a stream ID with splitmix64,
+ * so the numbers of a stream do not depend on the number of threads.
+ */
+struct rng_state
+{
+    unsigned long long s[4];
+};
+
+/* initialize the stream of a seed */
+void init_rng(struct rng_state *rng, unsigned long long seed, unsigned long long stream);
+
+/* generate a 64-bit random number */
+unsigned long long next_rng(struct rng_state *rng);
+
+/* generate a random floating point number in [0, 1) with 53 bits of resolution */
+double rand_double(struct rng_state *rng);
+
+/* generate a random integer in [0, n) */
+unsigned long long rand_uint(struct rng_state *rng, unsigned long long n);
+
+#endif
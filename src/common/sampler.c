@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sampler.h"
+#include "common.h"
+
+/*
+ * Read a client configuration file. If need_dist is true, the file must provide exactly
+ * one request size distribution. Return true if it succeeds.
+ */
+bool read_client_config(struct client_config *config, char *file_name, bool need_dist, bool verbose)
+{
+    FILE *fd = NULL;
+    char key[80] = {0};
+    char line[256] = {0};
+    char dist_file_name[80] = {0};
+    unsigned int num_dist = 0;  /* number of flow size distributions */
+    unsigned int num_server = 0, num_dscp = 0, num_rate = 0;
+
+    memset(config, 0, sizeof(struct client_config));
+
+    /* parse configuration file for the first time */
+    fd = fopen(file_name, "r");
+    if (!fd)
+    {
+        perror("Error: open configuration file for the first time");
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), fd) != NULL)
+    {
+        sscanf(line, "%s", key);
+        if (!strcmp(key, "server"))
+            num_server++;
+        else if (!strcmp(key, "req_size_dist"))
+            num_dist++;
+        else if (!strcmp(key, "dscp"))
+            num_dscp++;
+        else if (!strcmp(key, "rate"))
+            num_rate++;
+    }
+
+    fclose(fd);
+
+    if (num_server < 1)
+    {
+        printf("Error: configuration file should provide at least one server\n");
+        return false;
+    }
+    if (num_dist > 1 || (num_dist == 0 && need_dist))
+    {
+        printf("Error: configuration file should provide exactly one request size distribution\n");
+        return false;
+    }
+
+    /* per-server variables */
+    config->server_port = (unsigned int*)calloc(num_server, sizeof(unsigned int));
+    config->server_addr = (char (*)[20])calloc(num_server, sizeof(char[20]));
+    /* DSCP and probability */
+    config->dscp_value = (unsigned int*)calloc(max(num_dscp, 1), sizeof(unsigned int));
+    config->dscp_prob = (unsigned int*)calloc(max(num_dscp, 1), sizeof(unsigned int));
+    /* sending rate value and probability */
+    config->rate_value = (unsigned int*)calloc(max(num_rate, 1), sizeof(unsigned int));
+    config->rate_prob = (unsigned int*)calloc(max(num_rate, 1), sizeof(unsigned int));
+    if (!config->server_port || !config->server_addr || !config->dscp_value || !config->dscp_prob ||
+        !config->rate_value || !config->rate_prob)
+    {
+        perror("Error: calloc configuration variables");
+        return false;
+    }
+
+    /* second time */
+    fd = fopen(file_name, "r");
+    if (!fd)
+    {
+        perror("Error: open configuration file for the second time");
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), fd) != NULL)
+    {
+        remove_newline(line);
+        sscanf(line, "%s", key);
+
+        if (!strcmp(key, "server"))
+        {
+            num_server = config->num_server;
+            sscanf(line, "%s %19s %u", key, config->server_addr[num_server], &config->server_port[num_server]);
+            if (verbose)
+                printf("Server[%u]: %s, Port: %u\n", num_server, config->server_addr[num_server], config->server_port[num_server]);
+            config->num_server++;
+        }
+        else if (!strcmp(key, "req_size_dist"))
+        {
+            sscanf(line, "%s %79s", key, dist_file_name);
+            if (verbose)
+                printf("Loading request size distribution: %s\n", dist_file_name);
+
+            config->req_size_dist = (struct cdf_table*)malloc(sizeof(struct cdf_table));
+            if (!config->req_size_dist)
+            {
+                perror("Error: malloc req_size_dist");
+                fclose(fd);
+                return false;
+            }
+
+            init_cdf(config->req_size_dist);
+            load_cdf(config->req_size_dist, dist_file_name);
+            if (verbose)
+            {
+                printf("===========================================\n");
+                print_cdf(config->req_size_dist);
+                printf("Average request size: %.2f bytes\n", avg_cdf(config->req_size_dist));
+                printf("===========================================\n");
+            }
+        }
+        else if (!strcmp(key, "dscp"))
+        {
+            num_dscp = config->num_dscp;
+            sscanf(line, "%s %u %u", key, &config->dscp_value[num_dscp], &config->dscp_prob[num_dscp]);
+            if (config->dscp_value[num_dscp] >= TG_DSCP_VALUES)
+            {
+                printf("Invalid DSCP value %u\n", config->dscp_value[num_dscp]);
+                fclose(fd);
+                return false;
+            }
+            config->dscp_prob_total += config->dscp_prob[num_dscp];
+            if (verbose)
+                printf("DSCP: %u, Prob: %u\n", config->dscp_value[num_dscp], config->dscp_prob[num_dscp]);
+            config->num_dscp++;
+        }
+        else if (!strcmp(key, "rate"))
+        {
+            num_rate = config->num_rate;
+            sscanf(line, "%s %uMbps %u", key, &config->rate_value[num_rate], &config->rate_prob[num_rate]);
+            config->rate_prob_total += config->rate_prob[num_rate];
+            if (verbose)
+                printf("Rate: %uMbps, Prob: %u\n", config->rate_value[num_rate], config->rate_prob[num_rate]);
+            config->num_rate++;
+        }
+    }
+
+    fclose(fd);
+
+    /* by default, DSCP value is 0 */
+    if (config->num_dscp == 0)
+    {
+        config->num_dscp = 1;
+        config->dscp_value[0] = 0;
+        config->dscp_prob[0] = 100;
+        config->dscp_prob_total = config->dscp_prob[0];
+        if (verbose)
+            printf("DSCP: %u, Prob: %u\n", config->dscp_value[0], config->dscp_prob[0]);
+    }
+
+    /* by default, no rate limiting */
+    if (config->num_rate == 0)
+    {
+        config->num_rate = 1;
+        config->rate_value[0] = 0;
+        config->rate_prob[0] = 100;
+        config->rate_prob_total = config->rate_prob[0];
+        if (verbose)
+            printf("Rate: %uMbps, Prob: %u\n", config->rate_value[0], config->rate_prob[0]);
+    }
+
+    return true;
+}
+
+/* free the variables of a client configuration */
+void free_client_config(struct client_config *config)
+{
+    free(config->server_port);
+    free(config->server_addr);
+    free(config->dscp_value);
+    free(config->dscp_prob);
+    free(config->rate_value);
+    free(config->rate_prob);
+    if (config->req_size_dist)
+    {
+        free_cdf(config->req_size_dist);
+        free(config->req_size_dist);
+    }
+    memset(config, 0, sizeof(struct client_config));
+}
+
+/*
+ * Initialize the stream of a server. Requests arrive at avg_rate (per us). With -n (req_total_num > 0),
+ * each of the num_server servers gets an equal share of the requests.
+ */
+void init_server_stream(struct server_stream *stream, unsigned int server_id, int seed, double avg_rate,
+                        unsigned int num_server, unsigned int req_total_num)
+{
+    stream->server_id = server_id;
+    init_rng(&(stream->rng), seed, server_id);
+    stream->next_us = poission_gen_interval(avg_rate, &(stream->rng));
+    stream->num_left = 0;
+    if (req_total_num > 0)
+        stream->num_left = req_total_num / num_server + ((server_id < req_total_num % num_server) ? 1 : 0);
+}
+
+/* return true if the next request of stream a arrives before that of stream b. Ties go to the lower server ID. */
+static bool stream_before(struct server_stream *a, struct server_stream *b)
+{
+    return a->next_us < b->next_us || (a->next_us == b->next_us && a->server_id < b->server_id);
+}
+
+/* move the stream at position i of a heap down to restore the heap order */
+static void sift_down_stream(struct stream_heap *heap, unsigned int i)
+{
+    struct server_stream *stream = NULL;
+    unsigned int child;
+
+    while ((child = 2 * i + 1) < heap->len)
+    {
+        if (child + 1 < heap->len && stream_before(heap->streams[child + 1], heap->streams[child]))
+            child++;
+        if (!stream_before(heap->streams[child], heap->streams[i]))
+            break;
+
+        stream = heap->streams[i];
+        heap->streams[i] = heap->streams[child];
+        heap->streams[child] = stream;
+        i = child;
+    }
+}
+
+/* build the heap of streams with requests left. Return true if it succeeds. */
+bool init_stream_heap(struct stream_heap *heap, struct server_stream *streams, unsigned int num_streams, bool limited)
+{
+    unsigned int i;
+
+    memset(heap, 0, sizeof(struct stream_heap));
+    heap->limited = limited;
+    heap->streams = (struct server_stream**)calloc(max(num_streams, 1), sizeof(struct server_stream*));
+    if (!heap->streams)
+    {
+        perror("Error: calloc streams in init_stream_heap()");
+        return false;
+    }
+
+    for (i = 0; i < num_streams; i++)
+    {
+        if (!limited || streams[i].num_left > 0)
+            heap->streams[heap->len++] = &streams[i];
+    }
+
+    for (i = heap->len / 2; i > 0; i--)
+        sift_down_stream(heap, i - 1);
+
+    return true;
+}
+
+/* free a heap of streams */
+void free_stream_heap(struct stream_heap *heap)
+{
+    free(heap->streams);
+    heap->streams = NULL;
+    heap->len = 0;
+}
+
+/*
+ * Sample the earliest request of the streams of a heap. Requests arriving after total_us
+ * (if total_us > 0) are not sampled. Return false if there is no request left.
+ */
+bool sample_request(struct stream_heap *heap, struct client_config *config, double avg_rate,
+                    unsigned long long total_us, struct sampled_request *req)
+{
+    struct server_stream *stream = NULL;
+
+    if (heap->len == 0)
+        return false;
+
+    /* the server with the earliest arrival */
+    stream = heap->streams[0];
+    if (total_us > 0 && stream->next_us > total_us)
+        return false;
+
+    req->time_us = stream->next_us;
+    req->server_id = stream->server_id;
+    req->size = gen_random_cdf(config->req_size_dist, &(stream->rng));  /* flow size */
+    req->dscp = gen_value_weight(config->dscp_value, config->dscp_prob, config->num_dscp, config->dscp_prob_total, &(stream->rng));
+    req->rate = gen_value_weight(config->rate_value, config->rate_prob, config->num_rate, config->rate_prob_total, &(stream->rng));
+
+    /* sleep interval based on poission process */
+    stream->next_us += (unsigned int)poission_gen_interval(avg_rate, &(stream->rng));
+    if (heap->limited && --(stream->num_left) == 0)
+        heap->streams[0] = heap->streams[--(heap->len)];
+    sift_down_stream(heap, 0);
+
+    return true;
+}
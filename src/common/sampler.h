@@ -0,0 +1,85 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+
+#include "cdf.h"
+#include "rng.h"
+
+/* number of DSCP values */
+#define TG_DSCP_VALUES 64
+
+/* servers, request size distribution, DSCP values and sending rates of a client configuration file */
+struct client_config
+{
+    unsigned int num_server;    /* total number of servers */
+    char (*server_addr)[20];    /* IP addresses of servers */
+    unsigned int *server_port;  /* ports of servers */
+    struct cdf_table *req_size_dist;    /* NULL if the file has no request size distribution */
+    unsigned int num_dscp;  /* number of DSCP */
+    unsigned int *dscp_value;
+    unsigned int *dscp_prob;
+    unsigned int dscp_prob_total;
+    unsigned int num_rate;  /* number of sending rates */
+    unsigned int *rate_value;
+    unsigned int *rate_prob;
+    unsigned int rate_prob_total;
+};
+
+/* requests to a server, which form a Poisson process sampled from the random stream of the server */
+struct server_stream
+{
+    unsigned int server_id;
+    struct rng_state rng;
+    unsigned long long next_us; /* scheduled time of its next request arrival */
+    unsigned int num_left;  /* number of requests left to generate (with -n) */
+};
+
+/* streams ordered by their next request arrival (min-heap, ties go to the lower server ID) */
+struct stream_heap
+{
+    struct server_stream **streams;
+    unsigned int len;
+    bool limited;   /* whether streams stop after num_left requests (with -n) */
+};
+
+/* a request sampled from a server stream */
+struct sampled_request
+{
+    unsigned long long time_us; /* arrival time (us since the beginning) */
+    unsigned int server_id;
+    unsigned long long size;    /* request size (bytes) */
+    unsigned int dscp;  /* DSCP value */
+    unsigned int rate;  /* sending rate (Mbps) */
+};
+
+/*
+ * Read a client configuration file. If need_dist is true, the file must provide exactly
+ * one request size distribution. Return true if it succeeds.
+ */
+bool read_client_config(struct client_config *config, char *file_name, bool need_dist, bool verbose);
+
+/* free the variables of a client configuration */
+void free_client_config(struct client_config *config);
+
+/*
+ * Initialize the stream of a server. Requests arrive at avg_rate (per us). With -n (req_total_num > 0),
+ * each of the num_server servers gets an equal share of the requests.
+ */
+void init_server_stream(struct server_stream *stream, unsigned int server_id, int seed, double avg_rate,
+                        unsigned int num_server, unsigned int req_total_num);
+
+/* build the heap of streams with requests left. Return true if it succeeds. */
+bool init_stream_heap(struct stream_heap *heap, struct server_stream *streams, unsigned int num_streams, bool limited);
+
+/* free a heap of streams */
+void free_stream_heap(struct stream_heap *heap);
+
+/*
+ * Sample the earliest request of the streams of a heap. Requests arriving after total_us
+ * (if total_us > 0) are not sampled. Return false if there is no request left.
+ */
+bool sample_request(struct stream_heap *heap, struct client_config *config, double avg_rate,
+                    unsigned long long total_us, struct sampled_request *req);
+
+#endif
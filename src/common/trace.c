@@ -0,0 +1,442 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/* FNV-1a hash of a string */
+static unsigned int hash_trace_addr(char *str)
+{
+    unsigned int i, hash = 2166136261U;
+
+    for (i = 0; str[i] != '\0'; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 16777619U;
+    return hash;
+}
+
+/* find the entry of an address in the hash table, or the free entry to insert it */
+static struct trace_addr *find_trace_addr(struct flow_trace *trace, char *addr)
+{
+    unsigned int i = hash_trace_addr(addr) & trace->addr_mask;
+
+    /* linear probing: the table is at most 1/2 full */
+    while (trace->addrs[i].addr[0] != '\0' && strcmp(trace->addrs[i].addr, addr) != 0)
+        i = (i + 1) & trace->addr_mask;
+    return &(trace->addrs[i]);
+}
+
+/* add an address of a server to the hash table. The first server with an address keeps it. */
+static void add_trace_addr(struct flow_trace *trace, char *addr, unsigned int server_id)
+{
+    struct trace_addr *entry = find_trace_addr(trace, addr);
+
+    if (entry->addr[0] != '\0')
+        return;
+    snprintf(entry->addr, sizeof(entry->addr), "%s", addr);
+    entry->server_id = server_id;
+}
+
+/* build the hash table of the IP and IP:port of server entries. Return true if it succeeds. */
+static bool init_trace_addrs(struct flow_trace *trace)
+{
+    char addr[32] = {0};
+    unsigned int size = 1;
+    unsigned int i;
+
+    /* two addresses per server */
+    while (size < 4 * trace->num_server)
+        size <<= 1;
+
+    trace->addrs = (struct trace_addr*)calloc(size, sizeof(struct trace_addr));
+    if (!trace->addrs)
+    {
+        perror("Error: calloc addresses in init_trace_addrs()");
+        return false;
+    }
+    trace->addr_mask = size - 1;
+
+    for (i = 0; i < trace->num_server; i++)
+    {
+        snprintf(addr, sizeof(addr), "%s:%u", trace->server_addr[i], trace->server_port[i]);
+        add_trace_addr(trace, addr, i);
+        add_trace_addr(trace, trace->server_addr[i], i);
+    }
+
+    return true;
+}
+
+/* map the destination of a CSV record onto a server entry */
+static unsigned int map_trace_server(struct flow_trace *trace, char *dst)
+{
+    struct trace_addr *entry = NULL;
+    unsigned int i;
+
+    /* a server index */
+    for (i = 0; isdigit((unsigned char)dst[i]); i++);
+    if (i > 0 && dst[i] == '\0')
+        return (unsigned int)(strtoul(dst, NULL, 10) % trace->num_server);
+
+    /* IP or IP:port of a server entry */
+    entry = find_trace_addr(trace, dst);
+    if (entry->addr[0] != '\0')
+        return entry->server_id;
+
+    /* other destinations are spread over servers by their FNV-1a hash */
+    return hash_trace_addr(dst) % trace->num_server;
+}
+
+/* parse a time in seconds with up to 9 decimals into nanoseconds (exact for epoch times) */
+static bool parse_trace_time(char *str, unsigned long long *time_ns)
+{
+    unsigned long long scale = 100000000ULL;
+    char *p = str;
+
+    *time_ns = 0;
+    for (; isdigit((unsigned char)*p); p++)
+        *time_ns = *time_ns * 10 + (*p - '0');
+    *time_ns *= 1000000000ULL;
+
+    if (*p == '.')
+    {
+        for (p++; isdigit((unsigned char)*p); p++, scale /= 10)
+            *time_ns += (*p - '0') * scale;
+    }
+
+    return p > str;
+}
+
+/* parse a CSV line: time (s), destination, size (bytes)[, DSCP[, sending rate (Mbps)]]. Return false if it is not a record. */
+static bool parse_trace_line(struct flow_trace *trace, char *line, struct trace_record *r)
+{
+    char *fields[5] = {NULL};
+    unsigned int num_fields = 0;
+    char *p = line;
+
+    /* skip comments, headers and empty lines */
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (!isdigit((unsigned char)*p) && *p != '.')
+        return false;
+
+    while (num_fields < 5)
+    {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        fields[num_fields++] = p;
+        p = strchr(p, ',');
+        if (!p)
+            break;
+        *(p++) = '\0';
+    }
+    if (num_fields < 3)
+        return false;
+
+    /* trim trailing spaces of the destination */
+    for (p = fields[1] + strlen(fields[1]); p > fields[1] && (p[-1] == ' ' || p[-1] == '\t'); p--)
+        p[-1] = '\0';
+
+    memset(r, 0, sizeof(struct trace_record));
+    if (!parse_trace_time(fields[0], &(r->time_ns)))
+        return false;
+    r->server_id = map_trace_server(trace, fields[1]);
+    r->size = strtoull(fields[2], NULL, 10);
+    if (num_fields > 3)
+        r->dscp = (unsigned char)(strtoul(fields[3], NULL, 10) % 64);
+    if (num_fields > 4)
+        r->rate = (unsigned int)strtoul(fields[4], NULL, 10);
+
+    return true;
+}
+
+/* map a trace file into memory. Return true if it succeeds. */
+bool open_trace(struct flow_trace *trace, char *file_name, char (*server_addr)[20], unsigned int *server_port, unsigned int num_server)
+{
+    struct trace_header header;
+    struct stat st;
+    int fd;
+
+    memset(trace, 0, sizeof(struct flow_trace));
+    trace->server_addr = server_addr;
+    trace->server_port = server_port;
+    trace->num_server = num_server;
+
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror("Error: open the trace file in open_trace()");
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    trace->len = st.st_size;
+    if (trace->len > 0)
+    {
+        trace->data = (char*)mmap(NULL, trace->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (trace->data == MAP_FAILED)
+        {
+            perror("Error: mmap the trace file in open_trace()");
+            trace->data = NULL;
+            close(fd);
+            return false;
+        }
+        /* records are read once in order */
+        madvise(trace->data, trace->len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    /* binary trace files start with a header, and CSV trace files are text */
+    if (trace->len >= sizeof(header))
+    {
+        memcpy(&header, trace->data, sizeof(header));
+        if (memcmp(header.magic, TG_TRACE_MAGIC, sizeof(header.magic)) == 0)
+        {
+            if (header.version != TG_TRACE_VERSION || header.record_size != sizeof(struct trace_record))
+            {
+                printf("Error: unsupported binary trace version %u (record size %u)\n", header.version, header.record_size);
+                close_trace(trace);
+                return false;
+            }
+            trace->binary = true;
+            trace->num_records = (trace->len - sizeof(header)) / sizeof(struct trace_record);
+        }
+    }
+
+    if (!trace->binary && !init_trace_addrs(trace))
+    {
+        close_trace(trace);
+        return false;
+    }
+
+    return true;
+}
+
+/* unmap a trace file */
+void close_trace(struct flow_trace *trace)
+{
+    if (!trace)
+        return;
+
+    if (trace->data)
+    {
+        munmap(trace->data, trace->len);
+        trace->data = NULL;
+    }
+    free(trace->addrs);
+    trace->addrs = NULL;
+}
+
+/* initialize a cursor at the beginning of a trace */
+void init_trace_cursor(struct flow_trace *trace, struct trace_cursor *cursor)
+{
+    memset(cursor, 0, sizeof(struct trace_cursor));
+    if (trace->binary)
+        cursor->pos = sizeof(struct trace_header);
+}
+
+/* read the next record of a trace and return false at the end */
+bool next_trace_record(struct flow_trace *trace, struct trace_cursor *cursor, struct trace_record *r)
+{
+    char line[256];
+    char *start, *newline;
+    size_t len;
+
+    if (trace->binary)
+    {
+        if (cursor->pos + sizeof(struct trace_record) > trace->len)
+            return false;
+        memcpy(r, trace->data + cursor->pos, sizeof(struct trace_record));
+        cursor->pos += sizeof(struct trace_record);
+        cursor->index++;
+        return true;
+    }
+
+    /* parse CSV lines on demand, so the startup time does not depend on the trace length */
+    while (cursor->pos < trace->len)
+    {
+        start = trace->data + cursor->pos;
+        newline = (char*)memchr(start, '\n', trace->len - cursor->pos);
+        len = newline ? (size_t)(newline - start) : trace->len - cursor->pos;
+        cursor->pos += newline ? len + 1 : len;
+
+        len = (len < sizeof(line)) ? len : sizeof(line) - 1;
+        memcpy(line, start, len);
+        line[len] = '\0';
+        if (len > 0 && line[len - 1] == '\r')
+            line[len - 1] = '\0';
+
+        if (!parse_trace_line(trace, line, r))
+            continue;
+
+        /* times of CSV traces are relative to the first record */
+        if (cursor->index == 0)
+            cursor->base_ns = r->time_ns;
+        r->time_ns = (r->time_ns > cursor->base_ns) ? r->time_ns - cursor->base_ns : 0;
+        cursor->index++;
+        return true;
+    }
+
+    return false;
+}
+
+/* initialize a splitter of a trace into parts. Return true if it succeeds. */
+bool init_trace_splitter(struct trace_splitter *s, struct flow_trace *trace, unsigned int num_parts, unsigned long long max_records)
+{
+    memset(s, 0, sizeof(struct trace_splitter));
+    s->parts = (struct trace_batch*)calloc(num_parts, sizeof(struct trace_batch));
+    s->left = (bool*)calloc(num_parts, sizeof(bool));
+    if (!s->parts || !s->left)
+    {
+        perror("Error: calloc parts in init_trace_splitter()");
+        free(s->parts);
+        free(s->left);
+        return false;
+    }
+
+    s->trace = trace;
+    s->num_parts = num_parts;
+    s->max_records = max_records;
+    init_trace_cursor(trace, &(s->cursor));
+    pthread_mutex_init(&(s->lock), NULL);
+    pthread_cond_init(&(s->cond), NULL);
+    return true;
+}
+
+/* free a splitter */
+void free_trace_splitter(struct trace_splitter *s)
+{
+    unsigned int i;
+
+    if (!s || !s->parts)
+        return;
+
+    for (i = 0; i < s->num_parts; i++)
+        free(s->parts[i].records);
+    free(s->parts);
+    free(s->left);
+    s->parts = NULL;
+    s->left = NULL;
+    pthread_mutex_destroy(&(s->lock));
+    pthread_cond_destroy(&(s->cond));
+}
+
+/* append a record to a batch. Return true if it succeeds. */
+static bool append_trace_batch(struct trace_batch *batch, struct trace_record *r)
+{
+    struct trace_record *records = NULL;
+    unsigned int cap;
+
+    if (batch->len == batch->cap)
+    {
+        cap = (batch->cap > 0) ? 2 * batch->cap : TG_TRACE_CHUNK;
+        records = (struct trace_record*)realloc(batch->records, cap * sizeof(struct trace_record));
+        if (!records)
+        {
+            perror("Error: realloc records in append_trace_batch()");
+            return false;
+        }
+        batch->records = records;
+        batch->cap = cap;
+    }
+
+    batch->records[batch->len++] = *r;
+    return true;
+}
+
+/*
+ * Read the next TG_TRACE_CHUNK records into the parts owning their servers (with the lock held).
+ * Stop early when a part becomes full.
+ */
+static void split_trace_chunk(struct trace_splitter *s)
+{
+    struct trace_record r;
+    unsigned int i, part;
+
+    for (i = 0; i < TG_TRACE_CHUNK; i++)
+    {
+        if ((s->max_records > 0 && s->cursor.index >= s->max_records) || !next_trace_record(s->trace, &(s->cursor), &r))
+        {
+            s->done = true;
+            return;
+        }
+
+        part = (r.server_id % s->trace->num_server) % s->num_parts;
+        if (s->left[part])
+            continue;
+        if (!append_trace_batch(&(s->parts[part]), &r))
+        {
+            s->done = true;
+            return;
+        }
+        if (s->parts[part].len == TG_TRACE_PART_MAX)
+        {
+            s->num_full++;
+            return;
+        }
+    }
+}
+
+/*
+ * Take the records queued for a part into batch. The buffers of the part and the batch are
+ * swapped, so the previous records of the batch are dropped. If no record is queued for the
+ * part, read more of the trace, or wait while another part is full so that queues stay
+ * bounded. Return false at the end of the trace.
+ */
+bool take_trace_batch(struct trace_splitter *s, unsigned int part, struct trace_batch *batch)
+{
+    struct trace_batch tmp;
+
+    pthread_mutex_lock(&(s->lock));
+    while (s->parts[part].len == 0 && !s->done)
+    {
+        if (s->num_full > 0)
+            pthread_cond_wait(&(s->cond), &(s->lock));
+        else
+            split_trace_chunk(s);
+    }
+
+    if (s->parts[part].len == TG_TRACE_PART_MAX)
+    {
+        s->num_full--;
+        pthread_cond_broadcast(&(s->cond));
+    }
+
+    tmp = s->parts[part];
+    s->parts[part] = *batch;
+    s->parts[part].len = 0;
+    *batch = tmp;
+    pthread_mutex_unlock(&(s->lock));
+
+    return batch->len > 0;
+}
+
+/* stop taking records for a part, so that reading does not wait for it any more */
+void leave_trace_splitter(struct trace_splitter *s, unsigned int part)
+{
+    pthread_mutex_lock(&(s->lock));
+    s->left[part] = true;
+    if (s->parts[part].len == TG_TRACE_PART_MAX)
+    {
+        s->num_full--;
+        pthread_cond_broadcast(&(s->cond));
+    }
+    s->parts[part].len = 0;
+    pthread_mutex_unlock(&(s->lock));
+}
+
+/* write the header of a binary trace file. Return true if it succeeds. */
+bool write_trace_header(FILE *fd)
+{
+    struct trace_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TG_TRACE_MAGIC, sizeof(header.magic));
+    header.version = TG_TRACE_VERSION;
+    header.record_size = sizeof(struct trace_record);
+
+    return fwrite(&header, sizeof(header), 1, fd) == 1;
+}
@@ -0,0 +1,121 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* binary trace files start with a header */
+#define TG_TRACE_MAGIC "TGTRACE\0"
+#define TG_TRACE_VERSION 1
+/* number of records a trace splitter parses at a time */
+#define TG_TRACE_CHUNK 1024
+/* maximum number of records queued for a part. Reading stops until a full part is taken. */
+#define TG_TRACE_PART_MAX (4 * TG_TRACE_CHUNK)
+
+/* header of binary trace files */
+struct trace_header
+{
+    char magic[8];  /* TG_TRACE_MAGIC */
+    unsigned int version;   /* TG_TRACE_VERSION */
+    unsigned int record_size;   /* sizeof(struct trace_record) */
+};
+
+/* fixed-width record of a flow to replay (host byte order) */
+struct trace_record
+{
+    unsigned long long time_ns; /* arrival time (ns since the beginning of the trace) */
+    unsigned long long size;    /* flow size (bytes) */
+    unsigned int server_id; /* index of the server entry */
+    unsigned int rate;  /* sending rate (Mbps, 0 for no rate limiting) */
+    unsigned char dscp; /* DSCP value */
+};
+
+/* an entry of the table from addresses (IP or IP:port) to server indexes */
+struct trace_addr
+{
+    char addr[32];  /* empty if the entry is free */
+    unsigned int server_id;
+};
+
+/* a memory-mapped trace file, in the binary or CSV format */
+struct flow_trace
+{
+    char *data;
+    size_t len;
+    bool binary;
+    unsigned long long num_records; /* number of records (binary traces only) */
+    /* destinations of CSV traces are mapped onto these servers */
+    char (*server_addr)[20];
+    unsigned int *server_port;
+    unsigned int num_server;
+    /* open addressing hash table of server addresses (CSV traces only) */
+    struct trace_addr *addrs;
+    unsigned int addr_mask;
+};
+
+/* position of a reader in a trace. Each thread reads a trace with its own cursor. */
+struct trace_cursor
+{
+    size_t pos;   /* offset of the next line or record */
+    unsigned long long index;   /* number of records read */
+    unsigned long long base_ns; /* time of the first record of a CSV trace */
+};
+
+/* records of a trace for one consumer */
+struct trace_batch
+{
+    struct trace_record *records;
+    unsigned int len;
+    unsigned int cap;
+};
+
+/*
+ * A reader shared by several consumers, e.g., generator threads. Each record is parsed once and
+ * queued for the part owning its server (server index modulo the number of parts).
+ */
+struct trace_splitter
+{
+    struct flow_trace *trace;
+    struct trace_cursor cursor;
+    unsigned long long max_records; /* records after the first max_records are not read (0 for no limit) */
+    bool done;  /* whether all the records are read */
+    unsigned int num_parts;
+    struct trace_batch *parts;  /* records read but not taken by each part */
+    bool *left; /* whether each part has left (its records are dropped) */
+    unsigned int num_full;  /* number of parts with TG_TRACE_PART_MAX records */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* signaled when a full part is taken */
+};
+
+/* map a trace file into memory. Return true if it succeeds. */
+bool open_trace(struct flow_trace *trace, char *file_name, char (*server_addr)[20], unsigned int *server_port, unsigned int num_server);
+
+/* unmap a trace file */
+void close_trace(struct flow_trace *trace);
+
+/* initialize a cursor at the beginning of a trace */
+void init_trace_cursor(struct flow_trace *trace, struct trace_cursor *cursor);
+
+/* read the next record of a trace and return false at the end */
+bool next_trace_record(struct flow_trace *trace, struct trace_cursor *cursor, struct trace_record *r);
+
+/* initialize a splitter of a trace into parts. Return true if it succeeds. */
+bool init_trace_splitter(struct trace_splitter *s, struct flow_trace *trace, unsigned int num_parts, unsigned long long max_records);
+
+/* free a splitter */
+void free_trace_splitter(struct trace_splitter *s);
+
+/*
+ * Take the records queued for a part into batch (reading more if there is none). Return false at the end.
+ * While another part is full, the caller waits for it to be taken instead of reading more.
+ */
+bool take_trace_batch(struct trace_splitter *s, unsigned int part, struct trace_batch *batch);
+
+/* stop taking records for a part, so that reading does not wait for it any more */
+void leave_trace_splitter(struct trace_splitter *s, unsigned int part);
+
+/* write the header of a binary trace file. Return true if it succeeds. */
+bool write_trace_header(FILE *fd);
+
+#endif
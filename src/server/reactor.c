@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <pthread.h>
+
+#include "reactor.h"
+#include "../common/common.h"
+
+/* state of a connection */
+enum reactor_state
+{
+    TG_READ_METADATA,   /* read the metadata of a flow request */
+    TG_WRITE_METADATA,  /* echo back the metadata */
+    TG_WRITE_FLOW,  /* generate the flow response */
+    TG_WAIT_PACING  /* wait for the pacing timer (with rate limiting) */
+};
+
+struct reactor;
+struct reactor_conn;
+
+/* an event source (socket or pacing timer) registered to epoll */
+struct reactor_source
+{
+    int fd;
+    bool is_timer;
+    struct reactor_conn *conn;
+};
+
+struct reactor_conn
+{
+    struct reactor_source sock; /* socket */
+    struct reactor_source timer;    /* pacing timer (created for the first rate-limited flow) */
+    enum reactor_state state;
+    bool closed;    /* whether the connection is closed (freed after the current epoll_wait batch) */
+    unsigned int events;    /* epoll events the socket is registered for */
+    char buf[TG_METADATA_MAX_SIZE]; /* metadata of the request */
+    unsigned int buf_len;   /* number of metadata bytes read or written */
+    unsigned int meta_size; /* number of metadata bytes to write */
+    unsigned long long rx_us;   /* kernel receive timestamp of the request (0 if not timestamped) */
+    unsigned int version;   /* protocol version of the connection */
+    struct flow_metadata flow;  /* current flow */
+    unsigned long long bytes_sent;  /* number of flow bytes written */
+    unsigned int zc_pending;    /* zero-copy sends without completion notifications */
+    bool paced; /* whether the reactor (rather than the kernel) enforces the sending rate */
+    struct timeval flow_start;  /* time when the flow starts */
+    struct reactor *reactor;    /* reactor owning this connection */
+};
+
+struct reactor
+{
+    int epoll_fd;
+    int cpu;    /* CPU to pin the reactor (-1: not pinned) */
+    pthread_t thread;
+};
+
+static bool reactor_verbose = false;
+
+/* thread to run a reactor */
+static void *run_reactor(void *ptr);
+
+void run_reactor_server(int listen_fd, unsigned int num_threads, int *cpus, unsigned int num_cpus, bool verbose)
+{
+    unsigned int i = 0;
+    unsigned int next = 0;
+    int sockfd;
+    struct reactor *reactors = NULL;
+    struct reactor_conn *conn = NULL;
+    struct epoll_event ev;
+
+    if (num_threads == 0)
+        return;
+
+    reactor_verbose = verbose;
+    reactors = (struct reactor*)calloc(num_threads, sizeof(struct reactor));
+    if (!reactors)
+        error("Error: calloc reactors");
+
+    for (i = 0; i < num_threads; i++)
+    {
+        reactors[i].epoll_fd = epoll_create1(0);
+        if (reactors[i].epoll_fd < 0)
+            error("Error: epoll_create1");
+        reactors[i].cpu = (num_cpus > 0) ? cpus[i % num_cpus] : -1;
+        if (pthread_create(&reactors[i].thread, NULL, run_reactor, (void*)&reactors[i]) != 0)
+            error("Error: create reactor pthread");
+    }
+
+    while (1)
+    {
+        sockfd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (sockfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            close(listen_fd);
+            error("Error: accept");
+        }
+
+        conn = (struct reactor_conn*)calloc(1, sizeof(struct reactor_conn));
+        if (!conn)
+        {
+            close(listen_fd);
+            error("Error: calloc connection");
+        }
+
+        if (!init_payload_socket(sockfd))
+        {
+            close(sockfd);
+            free(conn);
+            continue;
+        }
+
+        conn->sock.fd = sockfd;
+        conn->sock.is_timer = false;
+        conn->sock.conn = conn;
+        conn->timer.fd = -1;
+        conn->timer.is_timer = true;
+        conn->timer.conn = conn;
+        conn->state = TG_READ_METADATA;
+        conn->version = TG_PROTO_V1;
+        conn->events = EPOLLIN;
+        conn->reactor = &reactors[next];
+        next = (next + 1) % num_threads;
+
+        /* hand over the connection to a reactor in a round robin manner */
+        ev.events = conn->events;
+        ev.data.ptr = &(conn->sock);
+        if (epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_ADD, sockfd, &ev) < 0)
+        {
+            perror("Error: epoll_ctl add connection");
+            close(sockfd);
+            free(conn);
+        }
+    }
+}
+
+/* close a connection. Its memory is released by the caller after the current epoll_wait batch. */
+static void close_conn(struct reactor_conn *conn)
+{
+    if (conn->timer.fd >= 0)
+        close(conn->timer.fd);
+    /* close() also removes the fds from the epoll set */
+    close(conn->sock.fd);
+    conn->closed = true;
+}
+
+/* register the socket for a given set of epoll events */
+static bool set_conn_events(struct reactor_conn *conn, unsigned int events)
+{
+    struct epoll_event ev;
+
+    if (conn->events == events)
+        return true;
+
+    ev.events = events;
+    ev.data.ptr = &(conn->sock);
+    if (epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_MOD, conn->sock.fd, &ev) < 0)
+    {
+        perror("Error: epoll_ctl modify connection");
+        return false;
+    }
+
+    conn->events = events;
+    return true;
+}
+
+/* arm the pacing timer to fire after delay_us microseconds */
+static bool arm_conn_timer(struct reactor_conn *conn, unsigned long long delay_us)
+{
+    struct itimerspec its;
+    struct epoll_event ev;
+
+    if (conn->timer.fd < 0)
+    {
+        conn->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (conn->timer.fd < 0)
+        {
+            perror("Error: timerfd_create");
+            return false;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &(conn->timer);
+        if (epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_ADD, conn->timer.fd, &ev) < 0)
+        {
+            perror("Error: epoll_ctl add timer");
+            return false;
+        }
+    }
+
+    memset(&its, 0, sizeof(its));
+    /* a zero it_value disarms the timer */
+    delay_us = max(delay_us, 1);
+    its.it_value.tv_sec = delay_us / 1000000;
+    its.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+    if (timerfd_settime(conn->timer.fd, 0, &its, NULL) < 0)
+    {
+        perror("Error: timerfd_settime");
+        return false;
+    }
+
+    return true;
+}
+
+/* microseconds to wait before the next write to enforce the sending rate of the flow */
+static unsigned long long get_pacing_delay_us(struct reactor_conn *conn)
+{
+    struct timeval now;
+    unsigned long long elapsed_us, target_us;
+
+    if (!conn->paced)
+        return 0;
+
+    gettimeofday(&now, NULL);
+    elapsed_us = (now.tv_sec - conn->flow_start.tv_sec) * 1000000 + now.tv_usec - conn->flow_start.tv_usec;
+    target_us = conn->bytes_sent * 8 / conn->flow.rate;
+
+    return (target_us > elapsed_us) ? target_us - elapsed_us : 0;
+}
+
+/*
+ * Make as much progress as possible on a connection without blocking. ready_us is
+ * the time when epoll reports the connection as ready.
+ * Return false if the connection should be closed.
+ */
+static bool process_conn(struct reactor_conn *conn, unsigned long long ready_us)
+{
+    ssize_t n;
+    char *write_buf = NULL;
+    size_t max_per_write = 0;
+    unsigned long long delay_us = 0;
+    unsigned int rate_mbps = 0;
+    struct timeval now;
+
+    while (true)
+    {
+        switch (conn->state)
+        {
+            case TG_READ_METADATA:
+                if (conn->buf_len == 0)
+                    conn->rx_us = 0;
+                n = recv_timestamped(conn->sock.fd, conn->buf + conn->buf_len,
+                                     get_metadata_size(conn->version) - conn->buf_len, &(conn->rx_us));
+                if (n == 0)
+                {
+                    if (reactor_verbose)
+                        printf("Cannot read metadata from the request\n");
+                    return false;
+                }
+                else if (n < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return set_conn_events(conn, EPOLLIN);
+                    else if (errno == EINTR)
+                        continue;
+                    if (reactor_verbose)
+                        printf("Cannot read metadata from the request\n");
+                    return false;
+                }
+
+                conn->buf_len += n;
+                if (conn->buf_len < get_metadata_size(conn->version))
+                    break;
+
+                unpack_flow_metadata(conn->buf, &(conn->flow), conn->version);
+                conn->buf_len = 0;
+                conn->state = TG_WRITE_METADATA;
+
+                /* answer a version negotiation request with TG_PROTO_V1 */
+                if (accept_proto_hello(&(conn->flow), &(conn->version)))
+                {
+                    pack_flow_metadata(conn->buf, &(conn->flow), TG_PROTO_V1);
+                    conn->meta_size = TG_METADATA_SIZE;
+                    break;
+                }
+
+                /* fall back to the readiness time if the kernel does not timestamp the request */
+                conn->flow.server_recv_us = (conn->rx_us > 0) ? conn->rx_us : ready_us;
+                if (reactor_verbose)
+                    printf("Flow request: ID: %u Size: %llu bytes ToS: %u Rate: %u Mbps\n",
+                           conn->flow.id, conn->flow.size, conn->flow.tos, conn->flow.rate);
+
+                if (setsockopt(conn->sock.fd, IPPROTO_IP, IP_TOS, &(conn->flow.tos), sizeof(conn->flow.tos)) < 0)
+                    printf("Error: set IP_TOS option in process_conn()");
+
+                /* set the pacing rate of this flow before its metadata is echoed back */
+                conn->paced = set_flow_pacing(conn->sock.fd, conn->flow.rate);
+
+                conn->meta_size = get_metadata_size(conn->version);
+                break;
+
+            case TG_WRITE_METADATA:
+                /* the metadata is echoed back with the time when its first byte is handed to the socket */
+                if (conn->buf_len == 0 && conn->flow.id != TG_HELLO_ACK_ID)
+                {
+                    conn->flow.server_send_us = get_realtime_us();
+                    pack_flow_metadata(conn->buf, &(conn->flow), conn->version);
+                }
+                n = write(conn->sock.fd, conn->buf + conn->buf_len, conn->meta_size - conn->buf_len);
+                if (n < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return set_conn_events(conn, EPOLLOUT);
+                    else if (errno == EINTR)
+                        continue;
+                    if (reactor_verbose)
+                        printf("Cannot generate the response\n");
+                    return false;
+                }
+
+                conn->buf_len += n;
+                if (conn->buf_len < conn->meta_size)
+                    break;
+
+                if (conn->flow.id == TG_HELLO_ACK_ID)
+                {
+                    conn->buf_len = 0;
+                    conn->state = TG_READ_METADATA;
+                    break;
+                }
+
+                conn->bytes_sent = 0;
+                gettimeofday(&(conn->flow_start), NULL);
+                conn->state = TG_WRITE_FLOW;
+                break;
+
+            case TG_WRITE_FLOW:
+                if (conn->bytes_sent >= conn->flow.size)
+                {
+                    gettimeofday(&now, NULL);
+                    rate_mbps = record_flow_rate(conn->sock.fd, conn->flow.size, conn->flow.rate,
+                                                 (now.tv_sec - conn->flow_start.tv_sec) * 1000000 + now.tv_usec - conn->flow_start.tv_usec);
+                    if (reactor_verbose && conn->flow.rate > 0)
+                        printf("Flow %u: requested rate %u Mbps, achieved rate %u Mbps\n", conn->flow.id, conn->flow.rate, rate_mbps);
+
+                    conn->buf_len = 0;
+                    conn->state = TG_READ_METADATA;
+                    break;
+                }
+
+                delay_us = get_pacing_delay_us(conn);
+                if (delay_us > 0)
+                {
+                    /* stop polling the socket until the pacing timer fires */
+                    conn->state = TG_WAIT_PACING;
+                    return set_conn_events(conn, 0) && arm_conn_timer(conn, delay_us);
+                }
+
+                write_buf = get_flow_write_buf(conn->paced, &max_per_write);
+                n = write_payload(conn->sock.fd, write_buf, min(conn->flow.size - conn->bytes_sent, max_per_write), &(conn->zc_pending));
+                if (n < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return set_conn_events(conn, EPOLLOUT);
+                    else if (errno == EINTR)
+                        continue;
+                    if (reactor_verbose)
+                        printf("Cannot generate the response\n");
+                    return false;
+                }
+
+                conn->bytes_sent += n;
+                break;
+
+            case TG_WAIT_PACING:
+                return true;
+        }
+    }
+}
+
+/* thread to run a reactor */
+static void *run_reactor(void *ptr)
+{
+    struct reactor *r = (struct reactor*)ptr;
+    struct epoll_event events[TG_REACTOR_EVENTS];
+    struct reactor_source *src = NULL;
+    struct reactor_conn *conn = NULL;
+    struct reactor_conn *closed_conns[TG_REACTOR_EVENTS];
+    int num_closed = 0;
+    uint64_t expirations;
+    unsigned long long ready_us;    /* time when epoll_wait returns */
+    int i, n;
+
+    if (r->cpu >= 0)
+    {
+        if (!pin_thread_cpu(r->cpu))
+            printf("Error: pin reactor to CPU %d\n", r->cpu);
+        else if (reactor_verbose)
+            printf("Pin reactor to CPU %d\n", r->cpu);
+    }
+
+    while (true)
+    {
+        n = epoll_wait(r->epoll_fd, events, TG_REACTOR_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Error: epoll_wait");
+            break;
+        }
+        ready_us = get_realtime_us();
+
+        num_closed = 0;
+        for (i = 0; i < n; i++)
+        {
+            src = (struct reactor_source*)events[i].data.ptr;
+            conn = src->conn;
+            /* both the socket and the timer of a closed connection may be in this batch */
+            if (conn->closed)
+                continue;
+
+            /* zero-copy completions are reported as EPOLLERR */
+            if (!src->is_timer && (events[i].events & EPOLLERR) && conn->zc_pending > 0)
+                reap_payload_completions(src->fd, &(conn->zc_pending), false);
+
+            if (src->is_timer)
+            {
+                if (read(src->fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    perror("Error: read timerfd");
+                if (conn->state == TG_WAIT_PACING)
+                    conn->state = TG_WRITE_FLOW;
+            }
+            /* the peer resets the connection while we are waiting for the pacing timer */
+            else if (conn->state == TG_WAIT_PACING && (events[i].events & EPOLLHUP))
+            {
+                close_conn(conn);
+                closed_conns[num_closed++] = conn;
+                continue;
+            }
+
+            if (!process_conn(conn, ready_us))
+            {
+                close_conn(conn);
+                closed_conns[num_closed++] = conn;
+            }
+        }
+
+        for (i = 0; i < num_closed; i++)
+            free(closed_conns[i]);
+    }
+
+    return (void*)0;
+}
@@ -0,0 +1,19 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdbool.h>
+
+/* default number of epoll reactor threads */
+#define TG_REACTOR_THREADS 4
+/* maximum number of events returned by an epoll_wait() call */
+#define TG_REACTOR_EVENTS 64
+
+/*
+ * Serve all connections accepted on listen_fd with num_threads epoll reactor threads.
+ * Each reactor parses flow requests and generates flow responses incrementally on
+ * non-blocking sockets. Reactor i is pinned to cpus[i % num_cpus] (not pinned if num_cpus is 0).
+ * This function only returns if it fails to start.
+ */
+void run_reactor_server(int listen_fd, unsigned int num_threads, int *cpus, unsigned int num_cpus, bool verbose);
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,20 +11,63 @@
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sched.h>
+#include <signal.h>
 
 #include <pthread.h>
 
 #include "../common/common.h"
+#include "reactor.h"
+#include "uring.h"
+
+/* server engines */
+enum server_engine
+{
+    TG_ENGINE_THREAD,   /* one thread per connection */
+    TG_ENGINE_EPOLL,    /* a fixed set of epoll reactor threads */
+    TG_ENGINE_URING /* a fixed set of io_uring instances */
+};
+
+/* a listening socket with its own engine */
+struct shard
+{
+    int listen_fd;  /* listening socket */
+    int *cpus;  /* CPUs to pin the shard */
+    unsigned int num_cpus;  /* number of CPUs of the shard (0: not pinned) */
+    pthread_t thread;
+};
 
 int server_port = TG_SERVER_PORT;
 unsigned int sleep_overhead_us = 50;
 bool verbose_mode = false;  /* by default, we don't give more detailed output */
 bool daemon_mode = false;   /* by default, we don't run the server as a daemon */
+enum server_engine engine = TG_ENGINE_THREAD;   /* by default, we use one thread per connection */
+unsigned int num_reactors = TG_REACTOR_THREADS; /* number of epoll reactor threads or io_uring instances */
+enum payload_mode payload = TG_PAYLOAD_COPY;   /* by default, we copy payload from a static buffer */
+enum pacing_mode pacing = TG_PACING_USLEEP; /* by default, we enforce sending rates with usleep() */
+unsigned int num_shards = 1;    /* number of listening sockets sharing the port */
+struct shard *shards = NULL;
+int cpu_list[CPU_SETSIZE];  /* CPUs to pin shards */
+unsigned int num_cpus = 0;  /* number of CPUs in cpu_list (0: shards are not pinned) */
+unsigned int cpu_set_start[CPU_SETSIZE + 1];   /* CPU set i is cpu_list[cpu_set_start[i]] to cpu_list[cpu_set_start[i + 1] - 1] */
+unsigned int num_cpu_sets = 0;  /* number of CPU sets in cpu_list */
 
 /* print usage of the program */
 void print_usage(char *program);
 /* read command line arguments */
 void read_args(int argc, char *argv[]);
+/* print statistics on SIGUSR1, and print statistics and exit on SIGINT/SIGTERM */
+void *handle_signals(void *ptr);
+/* parse a CPU list like "0-3,8" or per-shard CPU sets like "0-3:4-7" */
+bool parse_cpu_list(char *str);
+/* assign CPUs of the CPU sets to a shard */
+void set_shard_cpus(struct shard *s, unsigned int index);
+/* initialize a listening socket */
+int init_listen_socket(int cpu);
+/* run the server engine on a shard */
+void *run_shard(void *ptr);
+/* accept connections and start a thread to handle each of them */
+void run_thread_server(int listen_fd);
 /* handle an incomming connection */
 void* handle_connection(void* ptr);
 /* get usleep overhead in microsecond (us) */
@@ -31,13 +76,9 @@ unsigned int get_sleep_overhead(int iter_num);
 int main(int argc, char *argv[])
 {
     pid_t pid, sid;
-    int listen_fd;
-    struct sockaddr_in serv_addr;   /* local server address */
-    struct sockaddr_in cli_addr;    /* remote client address */
-    int sock_opt = 1;
-    pthread_t serv_thread;  /* server thread */
-    int* sockfd_ptr = NULL;
-    socklen_t len = sizeof(struct sockaddr_in);
+    unsigned int i = 0;
+    pthread_t signal_thread;
+    sigset_t sigset;
 
     /* read arguments */
     read_args(argc, argv);
@@ -47,30 +88,28 @@ int main(int argc, char *argv[])
     if (verbose_mode)
         printf("usleep() overhead is around %u us\n", sleep_overhead_us);
 
-    /* initialize local server address */
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;    
-    serv_addr.sin_port = htons(server_port);
-
-    /* initialize server socket */
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0)
-        error("Error: initialize socket");
+    /* prepare the payload source */
+    if (!set_payload_mode(payload))
+        error("Error: set_payload_mode");
+    if (payload != TG_PAYLOAD_COPY && engine == TG_ENGINE_URING)
+        printf("The uring engine always writes payload from registered buffers\n");
+    set_pacing_mode(pacing);
 
-    /* set socket options */
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt)) < 0)
-        error("Error: set SO_REUSEADDR option");
-    if (setsockopt(listen_fd, IPPROTO_TCP, TCP_NODELAY, &sock_opt, sizeof(sock_opt)) < 0)
-        error("ERROR: set TCP_NODELAY option");
+    shards = (struct shard*)calloc(num_shards, sizeof(struct shard));
+    if (!shards)
+        error("Error: calloc shards");
 
-    if (bind(listen_fd,(struct sockaddr *)&serv_addr,sizeof(struct sockaddr)) < 0)
-        error("Error: bind");
-
-    if (listen(listen_fd, TG_SERVER_BACKLOG_CONN) < 0)
-        error("Error: listen");
+    /* initialize a listening socket for each shard */
+    for (i = 0; i < num_shards; i++)
+    {
+        set_shard_cpus(&shards[i], i);
+        shards[i].listen_fd = init_listen_socket((shards[i].num_cpus > 0) ? shards[i].cpus[0] : -1);
+    }
 
-    printf("Traffic Generator Server listens on 0.0.0.0:%d\n", server_port);
+    if (num_shards > 1)
+        printf("Traffic Generator Server listens on 0.0.0.0:%d with %u shards\n", server_port, num_shards);
+    else
+        printf("Traffic Generator Server listens on 0.0.0.0:%d\n", server_port);
 
     /* if we run the server as a daemon */
     if (daemon_mode)
@@ -106,6 +145,214 @@ int main(int argc, char *argv[])
         close(STDERR_FILENO);
     }
 
+    /* all threads inherit the signal mask, so only handle_signals() receives these signals */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+    if (pthread_create(&signal_thread, NULL, handle_signals, NULL) != 0)
+        error("Error: create signal pthread");
+
+    if (verbose_mode)
+    {
+        if (engine == TG_ENGINE_EPOLL)
+            printf("Use %u epoll reactor threads per shard\n", num_reactors);
+        else if (engine == TG_ENGINE_URING)
+            printf("Use %u io_uring instances per shard\n", num_reactors);
+    }
+
+    /* the main thread runs the only shard if it is not pinned to any CPU */
+    if (num_shards == 1 && num_cpus == 0)
+    {
+        run_shard((void*)&shards[0]);
+        return 0;
+    }
+
+    for (i = 0; i < num_shards; i++)
+    {
+        if (pthread_create(&(shards[i].thread), NULL, run_shard, (void*)&shards[i]) != 0)
+            error("Error: create shard pthread");
+    }
+    for (i = 0; i < num_shards; i++)
+        pthread_join(shards[i].thread, NULL);
+
+    return 0;
+}
+
+/* print statistics on SIGUSR1, and print statistics and exit on SIGINT/SIGTERM */
+void *handle_signals(void *ptr)
+{
+    sigset_t sigset;
+    int sig;
+
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+
+    while (true)
+    {
+        if (sigwait(&sigset, &sig) != 0)
+            continue;
+
+        print_payload_stats();
+        fflush(stdout);
+        if (sig != SIGUSR1)
+            exit(EXIT_SUCCESS);
+    }
+
+    return (void*)0;
+}
+
+/* initialize a listening socket. If cpu >= 0, prefer connections whose packets are received on this CPU. */
+int init_listen_socket(int cpu)
+{
+    int listen_fd;
+    struct sockaddr_in serv_addr;   /* local server address */
+    int sock_opt = 1;
+
+    /* initialize local server address */
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(server_port);
+
+    /* initialize server socket */
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        error("Error: initialize socket");
+
+    /* set socket options */
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt)) < 0)
+        error("Error: set SO_REUSEADDR option");
+    if (setsockopt(listen_fd, IPPROTO_TCP, TCP_NODELAY, &sock_opt, sizeof(sock_opt)) < 0)
+        error("ERROR: set TCP_NODELAY option");
+    /* several shards listen on the same port */
+    if (num_shards > 1 && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &sock_opt, sizeof(sock_opt)) < 0)
+        error("Error: set SO_REUSEPORT option");
+    if (cpu >= 0 && setsockopt(listen_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)
+        perror("Error: set SO_INCOMING_CPU option");
+    /* accepted connections inherit kernel receive timestamps of flow requests */
+    enable_rx_timestamps(listen_fd);
+
+    if (bind(listen_fd,(struct sockaddr *)&serv_addr,sizeof(struct sockaddr)) < 0)
+        error("Error: bind");
+
+    if (listen(listen_fd, TG_SERVER_BACKLOG_CONN) < 0)
+        error("Error: listen");
+
+    return listen_fd;
+}
+
+/* run the server engine on a shard */
+void *run_shard(void *ptr)
+{
+    struct shard *s = (struct shard*)ptr;
+    cpu_set_t cpuset;
+    unsigned int i;
+
+    /* threads created by the engine inherit the CPU set, and reactors are pinned to its CPUs one by one */
+    if (s->num_cpus > 0)
+    {
+        CPU_ZERO(&cpuset);
+        for (i = 0; i < s->num_cpus; i++)
+            CPU_SET(s->cpus[i], &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+            printf("Error: pin shard to %u CPUs from CPU %d\n", s->num_cpus, s->cpus[0]);
+        else if (verbose_mode)
+            printf("Pin shard to %u CPUs from CPU %d\n", s->num_cpus, s->cpus[0]);
+    }
+
+    if (engine == TG_ENGINE_EPOLL)
+        run_reactor_server(s->listen_fd, num_reactors, s->cpus, s->num_cpus, verbose_mode);
+    else if (engine == TG_ENGINE_URING)
+        run_uring_server(s->listen_fd, num_reactors, s->cpus, s->num_cpus, verbose_mode);
+    else
+        run_thread_server(s->listen_fd);
+
+    return (void*)0;
+}
+
+/* parse a CPU list like "0-3,8" or per-shard CPU sets like "0-3:4-7" and return true if it succeeds */
+bool parse_cpu_list(char *str)
+{
+    char *set = NULL, *token = NULL;
+    char *set_saveptr = NULL, *saveptr = NULL;
+    int first, last, cpu;
+
+    num_cpus = 0;
+    num_cpu_sets = 0;
+    for (set = strtok_r(str, ":", &set_saveptr); set; set = strtok_r(NULL, ":", &set_saveptr))
+    {
+        cpu_set_start[num_cpu_sets] = num_cpus;
+        for (token = strtok_r(set, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr))
+        {
+            /* a single CPU or a range of CPUs */
+            if (sscanf(token, "%d-%d", &first, &last) != 2)
+            {
+                if (sscanf(token, "%d", &first) != 1)
+                    return false;
+                last = first;
+            }
+
+            if (first < 0 || last < first || last >= CPU_SETSIZE)
+                return false;
+
+            for (cpu = first; cpu <= last && num_cpus < CPU_SETSIZE; cpu++)
+                cpu_list[num_cpus++] = cpu;
+        }
+
+        /* every set has at least one CPU */
+        if (num_cpus == cpu_set_start[num_cpu_sets] || num_cpu_sets == CPU_SETSIZE)
+            return false;
+        cpu_set_start[++num_cpu_sets] = num_cpus;
+    }
+
+    return num_cpus > 0;
+}
+
+/*
+ * Assign CPUs to shard i. With several CPU sets, shard i uses set i (modulo the number of sets).
+ * A single list is split into a contiguous block of CPUs per shard, or each shard uses one
+ * CPU of the list if there are fewer CPUs than shards.
+ */
+void set_shard_cpus(struct shard *s, unsigned int index)
+{
+    unsigned int set, first;
+
+    if (num_cpus == 0)
+    {
+        s->cpus = NULL;
+        s->num_cpus = 0;
+    }
+    else if (num_cpu_sets > 1)
+    {
+        set = index % num_cpu_sets;
+        s->cpus = &cpu_list[cpu_set_start[set]];
+        s->num_cpus = cpu_set_start[set + 1] - cpu_set_start[set];
+    }
+    else if (num_cpus >= num_shards)
+    {
+        first = index * num_cpus / num_shards;
+        s->cpus = &cpu_list[first];
+        s->num_cpus = (index + 1) * num_cpus / num_shards - first;
+    }
+    else
+    {
+        s->cpus = &cpu_list[index % num_cpus];
+        s->num_cpus = 1;
+    }
+}
+
+/* accept connections and start a thread to handle each of them */
+void run_thread_server(int listen_fd)
+{
+    struct sockaddr_in cli_addr;    /* remote client address */
+    socklen_t len = sizeof(struct sockaddr_in);
+    pthread_t serv_thread;  /* server thread */
+    int* sockfd_ptr = NULL;
+
     while (1)
     {
         sockfd_ptr = (int*)malloc(sizeof(int));
@@ -126,39 +373,66 @@ int main(int argc, char *argv[])
             error("Error: create pthread");
         }
     }
-
-    return 0;
 }
 
 /* handle an incomming connection */
 void* handle_connection(void* ptr)
 {
     struct flow_metadata flow;
+    struct timeval tv_start, tv_end;
+    unsigned int rate_mbps = 0;
+    unsigned int version = TG_PROTO_V1; /* protocol version of the connection */
+    unsigned int zc_pending = 0;    /* zero-copy sends without completion notifications */
     int sockfd = *(int*)ptr;
     free(ptr);
 
+    if (!init_payload_socket(sockfd))
+    {
+        close(sockfd);
+        return (void*)0;
+    }
+
     while (1)
     {
         /* read meta data from the request */
-        if (!read_flow_metadata(sockfd, &flow))
+        if (!read_flow_request(sockfd, &flow, version))
         {
             if (verbose_mode)
                 printf("Cannot read metadata from the request\n");
             break;
         }
 
+        /* answer a version negotiation request with TG_PROTO_V1 */
+        if (accept_proto_hello(&flow, &version))
+        {
+            if (!write_flow_req(sockfd, &flow, TG_PROTO_V1))
+                break;
+            continue;
+        }
+
         if (verbose_mode)
-            printf("Flow request: ID: %u Size: %u bytes ToS: %u Rate: %u Mbps\n", flow.id, flow.size, flow.tos, flow.rate);
+            printf("Flow request: ID: %u Size: %llu bytes ToS: %u Rate: %u Mbps\n", flow.id, flow.size, flow.tos, flow.rate);
 
         /* generate the flow response */
-        if (!write_flow(sockfd, &flow, sleep_overhead_us))
+        gettimeofday(&tv_start, NULL);
+        if (!write_flow(sockfd, &flow, version, sleep_overhead_us, &zc_pending))
         {
             if (verbose_mode)
                 printf("Cannot generate the response\n");
             break;
         }
+        gettimeofday(&tv_end, NULL);
+
+        rate_mbps = record_flow_rate(sockfd, flow.size, flow.rate,
+                                     (tv_end.tv_sec - tv_start.tv_sec) * 1000000 + tv_end.tv_usec - tv_start.tv_usec);
+        if (verbose_mode && flow.rate > 0)
+            printf("Flow %u: requested rate %u Mbps, achieved rate %u Mbps\n", flow.id, flow.rate, rate_mbps);
     }
 
+    /* collect the remaining notifications once no flow waits for them */
+    if (zc_pending > 0)
+        reap_payload_completions(sockfd, &zc_pending, true);
+
     close(sockfd);
     return (void*)0;
 }
@@ -168,7 +442,13 @@ void print_usage(char *program)
 {
     printf("Usage: %s [options]\n", program);
     printf("-p <port>   port number (default %d)\n", TG_SERVER_PORT);
-    printf("-v          give more detailed output (verbose)\n");
+    printf("-e <engine> server engine: thread (one thread per connection), epoll or uring (default thread)\n");
+    printf("-w <num>    number of epoll reactor threads or io_uring instances (default %d)\n", TG_REACTOR_THREADS);
+    printf("-m <mode>   payload mode: copy (write from a buffer), sendfile (from a memfd) or zerocopy (MSG_ZEROCOPY) (default copy)\n");
+    printf("-r <pacing> rate limiting: usleep, bucket (token bucket) or kernel (SO_MAX_PACING_RATE) (default usleep)\n");
+    printf("-s <num>    number of listener shards sharing the port with SO_REUSEPORT (default 1)\n");
+    printf("-c <cpus>   CPUs to pin shards, e.g., 0-3,8 (split among shards) or 0-3:4-7 (a set per shard) (default not pinned)\n");
+    printf("-v          give more detailed output (verbose), e.g., the achieved rate of each rate-limited flow\n");
     printf("-d          run the server as a daemon\n");
     printf("-h          display help information\n");
 }
@@ -197,6 +477,138 @@ void read_args(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
         }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-e") == 0)
+        {
+            if (i+1 < argc)
+            {
+                if (strcmp(argv[i+1], "thread") == 0)
+                    engine = TG_ENGINE_THREAD;
+                else if (strcmp(argv[i+1], "epoll") == 0)
+                    engine = TG_ENGINE_EPOLL;
+                else if (strcmp(argv[i+1], "uring") == 0)
+                    engine = TG_ENGINE_URING;
+                else
+                {
+                    printf("Invalid server engine %s\n", argv[i+1]);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            /* cannot read server engine */
+            else
+            {
+                printf("Cannot read server engine\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-w") == 0)
+        {
+            if (i+1 < argc)
+            {
+                num_reactors = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                if (num_reactors == 0)
+                    error("Invalid number of event loop threads");
+                i += 2;
+            }
+            /* cannot read number of event loop threads */
+            else
+            {
+                printf("Cannot read number of event loop threads\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-m") == 0)
+        {
+            if (i+1 < argc)
+            {
+                if (strcmp(argv[i+1], "copy") == 0)
+                    payload = TG_PAYLOAD_COPY;
+                else if (strcmp(argv[i+1], "sendfile") == 0)
+                    payload = TG_PAYLOAD_SENDFILE;
+                else if (strcmp(argv[i+1], "zerocopy") == 0)
+                    payload = TG_PAYLOAD_ZEROCOPY;
+                else
+                {
+                    printf("Invalid payload mode %s\n", argv[i+1]);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            /* cannot read payload mode */
+            else
+            {
+                printf("Cannot read payload mode\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-r") == 0)
+        {
+            if (i+1 < argc)
+            {
+                if (strcmp(argv[i+1], "usleep") == 0)
+                    pacing = TG_PACING_USLEEP;
+                else if (strcmp(argv[i+1], "bucket") == 0)
+                    pacing = TG_PACING_BUCKET;
+                else if (strcmp(argv[i+1], "kernel") == 0)
+                    pacing = TG_PACING_KERNEL;
+                else
+                {
+                    printf("Invalid rate limiting mode %s\n", argv[i+1]);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            /* cannot read rate limiting mode */
+            else
+            {
+                printf("Cannot read rate limiting mode\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-s") == 0)
+        {
+            if (i+1 < argc)
+            {
+                num_shards = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                if (num_shards == 0)
+                    error("Invalid number of shards");
+                i += 2;
+            }
+            /* cannot read number of shards */
+            else
+            {
+                printf("Cannot read number of shards\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-c") == 0)
+        {
+            if (i+1 < argc)
+            {
+                if (!parse_cpu_list(argv[i+1]))
+                {
+                    printf("Invalid CPU list %s\n", argv[i+1]);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            /* cannot read CPU list */
+            else
+            {
+                printf("Cannot read CPU list\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
         else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-v") == 0)
         {
             verbose_mode = true;
@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+
+#include "uring.h"
+#include "../common/common.h"
+
+/* index of registered buffers */
+#define TG_URING_MAX_BUF 0  /* max_write_buf (w/o rate limiting) */
+#define TG_URING_MIN_BUF 1  /* min_write_buf (with rate limiting) */
+
+/* user_data of the multishot accept request */
+#define TG_URING_ACCEPT 0
+
+/* state of a connection. Each connection has at most one request in flight. */
+enum uring_state
+{
+    TG_URING_READ_METADATA, /* receive the metadata of a flow request */
+    TG_URING_WRITE_METADATA,    /* echo back the metadata */
+    TG_URING_WRITE_FLOW,    /* generate the flow response */
+    TG_URING_WAIT_PACING    /* wait for the pacing timeout (with rate limiting) */
+};
+
+struct uring_conn
+{
+    int sockfd;
+    enum uring_state state;
+    char buf[TG_METADATA_MAX_SIZE]; /* metadata of the request */
+    unsigned int buf_len;   /* number of metadata bytes received or sent */
+    unsigned int meta_size; /* number of metadata bytes to send */
+    struct msghdr msg;  /* message to receive the metadata with its kernel receive timestamp */
+    struct iovec iov;
+    char control[TG_RX_CONTROL_SIZE];
+    unsigned long long rx_us;   /* kernel receive timestamp of the request (0 if not timestamped) */
+    unsigned int version;   /* protocol version of the connection */
+    struct flow_metadata flow;  /* current flow */
+    unsigned long long bytes_sent;  /* number of flow bytes written */
+    bool paced; /* whether the ring (rather than the kernel) enforces the sending rate */
+    struct timeval flow_start;  /* time when the flow starts */
+    struct __kernel_timespec timeout;   /* pacing timeout */
+};
+
+/* an io_uring instance with its submission and completion rings */
+struct uring
+{
+    int ring_fd;
+    int listen_fd;
+    bool fixed_buf; /* whether the write buffers are registered */
+    int cpu;    /* CPU to pin the instance (-1: not pinned) */
+    pthread_t thread;
+    /* submission queue */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail; /* tail including prepared but not yet submitted entries */
+    struct io_uring_sqe *sqes;
+    /* completion queue */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static bool uring_verbose = false;
+
+/* thread to run an io_uring instance */
+static void *run_uring(void *ptr);
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* set up an io_uring instance and return true if it succeeds */
+static bool init_uring(struct uring *ring, int listen_fd)
+{
+    struct io_uring_params p;
+    struct iovec iov[2];
+    size_t sq_size, cq_size;
+    size_t len = 0;
+    char *sq_ptr = NULL, *cq_ptr = NULL;
+
+    memset(&p, 0, sizeof(p));
+    ring->listen_fd = listen_fd;
+    ring->ring_fd = sys_io_uring_setup(TG_URING_ENTRIES, &p);
+    if (ring->ring_fd < 0)
+    {
+        perror("Error: io_uring_setup");
+        return false;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size = cq_size = max(sq_size, cq_size);
+
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+    {
+        perror("Error: mmap submission queue");
+        return false;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        cq_ptr = sq_ptr;
+    else
+    {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+        {
+            perror("Error: mmap completion queue");
+            return false;
+        }
+    }
+
+    ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        perror("Error: mmap submission queue entries");
+        return false;
+    }
+
+    ring->sq_head = (unsigned int*)(sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned int*)(sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned int*)(sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(sq_ptr + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *(ring->sq_tail);
+    ring->cq_head = (unsigned int*)(cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned int*)(cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned int*)(cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq_ptr + p.cq_off.cqes);
+
+    /* register the dummy write buffers so that the kernel does not map them for every write */
+    iov[TG_URING_MAX_BUF].iov_base = get_flow_write_buf(false, &len);
+    iov[TG_URING_MAX_BUF].iov_len = len;
+    iov[TG_URING_MIN_BUF].iov_base = get_flow_write_buf(true, &len);
+    iov[TG_URING_MIN_BUF].iov_len = len;
+    ring->fixed_buf = (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iov, 2) == 0);
+    if (!ring->fixed_buf)
+        perror("Error: io_uring_register buffers (fall back to unregistered buffers)");
+
+    return true;
+}
+
+/* submit all prepared entries, wait for at least min_complete completions */
+static bool submit_uring(struct uring *ring, unsigned int min_complete)
+{
+    unsigned int to_submit = ring->sq_local_tail - *(ring->sq_tail);
+
+    /* publish prepared entries to the kernel */
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    while (sys_io_uring_enter(ring->ring_fd, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            perror("Error: io_uring_enter");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* get a free submission queue entry. Submit pending entries if the queue is full. */
+static struct io_uring_sqe *get_sqe(struct uring *ring)
+{
+    unsigned int index;
+    struct io_uring_sqe *sqe = NULL;
+
+    while (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        if (!submit_uring(ring, 0))
+            return NULL;
+    }
+
+    index = ring->sq_local_tail & *(ring->sq_mask);
+    sqe = &(ring->sqes[index]);
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+/* post a multishot accept request on the listening socket */
+static bool prep_accept(struct uring *ring)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = ring->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = TG_URING_ACCEPT;
+    return true;
+}
+
+/* microseconds to wait before the next write to enforce the sending rate of the flow */
+static unsigned long long get_pacing_delay_us(struct uring_conn *conn)
+{
+    struct timeval now;
+    unsigned long long elapsed_us, target_us;
+
+    if (!conn->paced)
+        return 0;
+
+    gettimeofday(&now, NULL);
+    elapsed_us = (now.tv_sec - conn->flow_start.tv_sec) * 1000000 + now.tv_usec - conn->flow_start.tv_usec;
+    target_us = conn->bytes_sent * 8 / conn->flow.rate;
+
+    return (target_us > elapsed_us) ? target_us - elapsed_us : 0;
+}
+
+/* prepare the next request of a connection based on its state */
+static bool prep_conn(struct uring *ring, struct uring_conn *conn)
+{
+    struct io_uring_sqe *sqe = NULL;
+    unsigned long long delay_us = 0;
+    size_t max_per_write = 0;
+    char *write_buf = NULL;
+    unsigned int rate_mbps = 0;
+    struct timeval now;
+
+    /* a finished flow: wait for the next request */
+    if (conn->state == TG_URING_WRITE_FLOW && conn->bytes_sent >= conn->flow.size)
+    {
+        gettimeofday(&now, NULL);
+        rate_mbps = record_flow_rate(conn->sockfd, conn->flow.size, conn->flow.rate,
+                                     (now.tv_sec - conn->flow_start.tv_sec) * 1000000 + now.tv_usec - conn->flow_start.tv_usec);
+        if (uring_verbose && conn->flow.rate > 0)
+            printf("Flow %u: requested rate %u Mbps, achieved rate %u Mbps\n", conn->flow.id, conn->flow.rate, rate_mbps);
+
+        conn->buf_len = 0;
+        conn->state = TG_URING_READ_METADATA;
+    }
+
+    /* enforce the sending rate */
+    if (conn->state == TG_URING_WRITE_FLOW && (delay_us = get_pacing_delay_us(conn)) > 0)
+        conn->state = TG_URING_WAIT_PACING;
+
+    sqe = get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    sqe->user_data = (unsigned long long)(uintptr_t)conn;
+
+    switch (conn->state)
+    {
+        case TG_URING_READ_METADATA:
+            if (conn->buf_len == 0)
+                conn->rx_us = 0;
+            conn->iov.iov_base = conn->buf + conn->buf_len;
+            conn->iov.iov_len = get_metadata_size(conn->version) - conn->buf_len;
+            memset(&(conn->msg), 0, sizeof(conn->msg));
+            conn->msg.msg_iov = &(conn->iov);
+            conn->msg.msg_iovlen = 1;
+            conn->msg.msg_control = conn->control;
+            conn->msg.msg_controllen = sizeof(conn->control);
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = conn->sockfd;
+            sqe->addr = (unsigned long long)(uintptr_t)&(conn->msg);
+            sqe->len = 1;
+            break;
+
+        case TG_URING_WRITE_METADATA:
+            /* the metadata is echoed back with the time when its first byte is submitted */
+            if (conn->buf_len == 0 && conn->flow.id != TG_HELLO_ACK_ID)
+            {
+                conn->flow.server_send_us = get_realtime_us();
+                pack_flow_metadata(conn->buf, &(conn->flow), conn->version);
+            }
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = conn->sockfd;
+            sqe->addr = (unsigned long long)(uintptr_t)(conn->buf + conn->buf_len);
+            sqe->len = conn->meta_size - conn->buf_len;
+            break;
+
+        case TG_URING_WRITE_FLOW:
+            write_buf = get_flow_write_buf(conn->paced, &max_per_write);
+            sqe->opcode = (ring->fixed_buf) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe->fd = conn->sockfd;
+            sqe->addr = (unsigned long long)(uintptr_t)write_buf;
+            sqe->len = (unsigned int)min(conn->flow.size - conn->bytes_sent, max_per_write);
+            sqe->buf_index = (max_per_write == TG_MIN_WRITE) ? TG_URING_MIN_BUF : TG_URING_MAX_BUF;
+            break;
+
+        case TG_URING_WAIT_PACING:
+            conn->timeout.tv_sec = delay_us / 1000000;
+            conn->timeout.tv_nsec = (delay_us % 1000000) * 1000;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (unsigned long long)(uintptr_t)&(conn->timeout);
+            sqe->len = 1;
+            break;
+    }
+
+    return true;
+}
+
+/*
+ * Handle the completion of a connection request. ready_us is the time when the
+ * completion is reaped. Return false if the connection should be closed.
+ */
+static bool complete_conn(struct uring_conn *conn, int res, unsigned long long ready_us)
+{
+    unsigned long long ts_us;
+
+    switch (conn->state)
+    {
+        case TG_URING_READ_METADATA:
+            if (res <= 0)
+            {
+                if (uring_verbose)
+                    printf("Cannot read metadata from the request\n");
+                return false;
+            }
+
+            if ((ts_us = get_rx_timestamp_us(&(conn->msg))) > 0)
+                conn->rx_us = ts_us;
+            conn->buf_len += res;
+            if (conn->buf_len < get_metadata_size(conn->version))
+                return true;
+
+            unpack_flow_metadata(conn->buf, &(conn->flow), conn->version);
+            conn->buf_len = 0;
+            conn->state = TG_URING_WRITE_METADATA;
+
+            /* answer a version negotiation request with TG_PROTO_V1 */
+            if (accept_proto_hello(&(conn->flow), &(conn->version)))
+            {
+                pack_flow_metadata(conn->buf, &(conn->flow), TG_PROTO_V1);
+                conn->meta_size = TG_METADATA_SIZE;
+                return true;
+            }
+
+            /* fall back to the completion time if the kernel does not timestamp the request */
+            conn->flow.server_recv_us = (conn->rx_us > 0) ? conn->rx_us : ready_us;
+            if (uring_verbose)
+                printf("Flow request: ID: %u Size: %llu bytes ToS: %u Rate: %u Mbps\n",
+                       conn->flow.id, conn->flow.size, conn->flow.tos, conn->flow.rate);
+
+            if (setsockopt(conn->sockfd, IPPROTO_IP, IP_TOS, &(conn->flow.tos), sizeof(conn->flow.tos)) < 0)
+                printf("Error: set IP_TOS option in complete_conn()");
+
+            /* set the pacing rate of this flow before its metadata is echoed back */
+            conn->paced = set_flow_pacing(conn->sockfd, conn->flow.rate);
+
+            conn->meta_size = get_metadata_size(conn->version);
+            return true;
+
+        case TG_URING_WRITE_METADATA:
+            if (res < 0)
+            {
+                if (uring_verbose)
+                    printf("Cannot generate the response\n");
+                return false;
+            }
+
+            conn->buf_len += res;
+            if (conn->buf_len < conn->meta_size)
+                return true;
+
+            if (conn->flow.id == TG_HELLO_ACK_ID)
+            {
+                conn->buf_len = 0;
+                conn->state = TG_URING_READ_METADATA;
+                return true;
+            }
+
+            conn->bytes_sent = 0;
+            gettimeofday(&(conn->flow_start), NULL);
+            conn->state = TG_URING_WRITE_FLOW;
+            return true;
+
+        case TG_URING_WRITE_FLOW:
+            if (res <= 0)
+            {
+                if (uring_verbose)
+                    printf("Cannot generate the response\n");
+                return false;
+            }
+
+            conn->bytes_sent += res;
+            return true;
+
+        case TG_URING_WAIT_PACING:
+            /* the timeout completes with -ETIME */
+            conn->state = TG_URING_WRITE_FLOW;
+            return true;
+    }
+
+    return false;
+}
+
+/* thread to run an io_uring instance */
+static void *run_uring(void *ptr)
+{
+    struct uring *ring = (struct uring*)ptr;
+    struct io_uring_cqe *cqe = NULL;
+    struct uring_conn *conn = NULL;
+    unsigned int head, tail;
+    unsigned long long ready_us;    /* time when the completions are reaped */
+    int res;
+
+    if (ring->cpu >= 0)
+    {
+        if (!pin_thread_cpu(ring->cpu))
+            printf("Error: pin io_uring instance to CPU %d\n", ring->cpu);
+        else if (uring_verbose)
+            printf("Pin io_uring instance to CPU %d\n", ring->cpu);
+    }
+
+    if (!prep_accept(ring))
+        return (void*)0;
+
+    while (true)
+    {
+        /* submit requests of all the connections in a batch */
+        if (!submit_uring(ring, 1))
+            break;
+
+        ready_us = get_realtime_us();
+        head = *(ring->cq_head);
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++)
+        {
+            cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+            res = cqe->res;
+
+            if (cqe->user_data == TG_URING_ACCEPT)
+            {
+                /* the kernel stops a multishot accept on errors */
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    prep_accept(ring);
+
+                if (res < 0)
+                {
+                    if (res != -ECONNABORTED && res != -EINTR)
+                        fprintf(stderr, "Error: accept: %s\n", strerror(-res));
+                    continue;
+                }
+
+                conn = (struct uring_conn*)calloc(1, sizeof(struct uring_conn));
+                if (!conn)
+                {
+                    perror("Error: calloc connection");
+                    close(res);
+                    continue;
+                }
+                conn->sockfd = res;
+                conn->state = TG_URING_READ_METADATA;
+                conn->version = TG_PROTO_V1;
+            }
+            else
+            {
+                conn = (struct uring_conn*)(uintptr_t)cqe->user_data;
+                if (!complete_conn(conn, res, ready_us))
+                {
+                    close(conn->sockfd);
+                    free(conn);
+                    continue;
+                }
+            }
+
+            if (!prep_conn(ring, conn))
+            {
+                close(conn->sockfd);
+                free(conn);
+            }
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return (void*)0;
+}
+
+void run_uring_server(int listen_fd, unsigned int num_threads, int *cpus, unsigned int num_cpus, bool verbose)
+{
+    struct uring *rings = NULL;
+    unsigned int i = 0;
+
+    if (num_threads == 0)
+        return;
+
+    uring_verbose = verbose;
+    rings = (struct uring*)calloc(num_threads, sizeof(struct uring));
+    if (!rings)
+        error("Error: calloc rings");
+
+    for (i = 0; i < num_threads; i++)
+    {
+        if (!init_uring(&rings[i], listen_fd))
+            error("Error: init_uring");
+        rings[i].cpu = (num_cpus > 0) ? cpus[i % num_cpus] : -1;
+    }
+
+    /* the calling thread runs the first instance */
+    for (i = 1; i < num_threads; i++)
+    {
+        if (pthread_create(&rings[i].thread, NULL, run_uring, (void*)&rings[i]) != 0)
+            error("Error: create io_uring pthread");
+    }
+    run_uring((void*)&rings[0]);
+}
@@ -0,0 +1,18 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+
+/* number of submission queue entries of each io_uring instance */
+#define TG_URING_ENTRIES 4096
+
+/*
+ * Serve all connections accepted on listen_fd with num_threads io_uring instances
+ * (one thread per instance). Connections are accepted with multishot accept, and
+ * flow responses are generated from registered buffers. Submissions are batched
+ * across connections. Instance i is pinned to cpus[i % num_cpus] (not pinned if num_cpus is 0).
+ * This function only returns if it fails to start.
+ */
+void run_uring_server(int listen_fd, unsigned int num_threads, int *cpus, unsigned int num_cpus, bool verbose);
+
+#endif
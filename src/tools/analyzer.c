@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../common/common.h"
+#include "../common/fctlog.h"
+#include "../common/hist.h"
+
+/* maximum number of log files */
+#define TG_ANALYZER_FILES 256
+/* maximum number of size bucket bounds */
+#define TG_ANALYZER_BOUNDS 16
+/* maximum number of percentiles */
+#define TG_ANALYZER_PERCENTILES 16
+/* number of DSCP values */
+#define TG_ANALYZER_DSCP 64
+
+/* a log file of client or incast-client, in the text or binary format */
+struct log_reader
+{
+    FILE *fd;
+    unsigned int record_size;   /* size of binary records (0 for text) */
+    unsigned long long line;    /* current line of a text log */
+};
+
+/* statistics of a group of flows (requests), e.g., a size bucket */
+struct group_stats
+{
+    char name[64];
+    struct hist_table hist; /* completion times (us) */
+    unsigned long long goodput_total;   /* sum of goodput (Mbps) */
+    /* the rank-th smallest value of a percentile is the bucket_rank-th smallest value in its bucket */
+    unsigned int bucket[TG_ANALYZER_PERCENTILES];
+    unsigned long long bucket_rank[TG_ANALYZER_PERCENTILES];
+    unsigned long long *values[TG_ANALYZER_PERCENTILES];    /* values in the bucket (second pass) */
+    unsigned long long num_values[TG_ANALYZER_PERCENTILES];
+    unsigned long long result[TG_ANALYZER_PERCENTILES]; /* value at each percentile */
+};
+
+char *file_names[TG_ANALYZER_FILES];
+unsigned int num_files = 0;
+unsigned long long size_bounds[TG_ANALYZER_BOUNDS] = {100 * 1024, 10 * 1024 * 1024};   /* same as result.py */
+unsigned int num_bounds = 2;
+double percentiles[TG_ANALYZER_PERCENTILES] = {50, 99, 99.9};
+unsigned int num_percentiles = 3;
+bool dscp_breakdown = false;
+char json_file_name[256] = {0};
+
+/* overall, size buckets and DSCP values */
+struct group_stats *groups = NULL;
+unsigned int num_groups = 0;
+unsigned long long num_records = 0;
+unsigned long long file_records[TG_ANALYZER_FILES]; /* number of records of each file in the first pass */
+
+/* print usage of the program */
+void print_usage(char *program);
+/* read command line arguments */
+void read_args(int argc, char *argv[]);
+/* open a log file and detect its format */
+bool open_log(struct log_reader *reader, char *file_name);
+/* read the next record of a log file into r (with room for struct fct_record_ext) and return false at the end */
+bool read_log(struct log_reader *reader, struct fct_record *r);
+/* get the groups of a record, and return the number of groups */
+unsigned int get_groups(struct fct_record *r, unsigned int *ids);
+/* read all log files once. In the first pass, fill histograms. In the second pass, collect values of percentile buckets. */
+bool scan_logs(bool second_pass);
+/* prepare the second pass after the first pass */
+bool prepare_second_pass();
+/* select the k-th smallest value (0-based) of an array */
+unsigned long long select_value(unsigned long long *values, unsigned long long num, unsigned long long k);
+/* format a size bound, e.g., 100KB */
+void format_size(char *buf, size_t len, unsigned long long size);
+/* print the summary as text */
+void print_text();
+/* write the summary as JSON */
+void write_json(FILE *fd);
+/* clean up resources */
+void cleanup();
+
+int main(int argc, char *argv[])
+{
+    unsigned int i, k = 0;
+    char lo[16], hi[16];
+    FILE *fd = NULL;
+
+    read_args(argc, argv);
+
+    num_groups = 1 + num_bounds + 1 + (dscp_breakdown ? TG_ANALYZER_DSCP : 0);
+    groups = (struct group_stats*)calloc(num_groups, sizeof(struct group_stats));
+    if (!groups)
+        error("Error: calloc groups");
+
+    for (i = 0; i < num_groups; i++)
+        init_hist(&groups[i].hist);
+
+    snprintf(groups[0].name, sizeof(groups[0].name), "Overall");
+    for (i = 0; i <= num_bounds; i++)
+    {
+        if (i > 0)
+            format_size(lo, sizeof(lo), size_bounds[i - 1]);
+        else
+            snprintf(lo, sizeof(lo), "0");
+        format_size(hi, sizeof(hi), (i < num_bounds) ? size_bounds[i] : 0);
+        snprintf(groups[1 + i].name, sizeof(groups[1 + i].name), "%s%s, %s)", (i > 0) ? "[" : "(", lo, hi);
+    }
+    if (dscp_breakdown)
+    {
+        for (i = 0; i < TG_ANALYZER_DSCP; i++)
+            snprintf(groups[2 + num_bounds + i].name, sizeof(groups[0].name), "DSCP %u", i);
+    }
+
+    if (!scan_logs(false) || !prepare_second_pass() || !scan_logs(true))
+    {
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_groups; i++)
+    {
+        for (k = 0; k < num_percentiles; k++)
+        {
+            if (groups[i].hist.num_value == 0)
+                continue;
+            /* records of the first pass were rewritten before the second pass */
+            if (groups[i].num_values[k] < groups[i].bucket_rank[k])
+            {
+                printf("Error: log files changed between the two passes\n");
+                cleanup();
+                exit(EXIT_FAILURE);
+            }
+            groups[i].result[k] = select_value(groups[i].values[k], groups[i].num_values[k], groups[i].bucket_rank[k] - 1);
+        }
+    }
+
+    print_text();
+
+    if (strlen(json_file_name) > 0)
+    {
+        fd = (strcmp(json_file_name, "-") == 0) ? stdout : fopen(json_file_name, "w");
+        if (!fd)
+            perror("Error: open the JSON file");
+        else
+        {
+            write_json(fd);
+            if (fd != stdout)
+            {
+                fclose(fd);
+                printf("Write the JSON summary to %s\n", json_file_name);
+            }
+        }
+    }
+
+    cleanup();
+    return 0;
+}
+
+/* print usage of the program */
+void print_usage(char *program)
+{
+    printf("Usage: %s [options] <log file> [log file ...]\n", program);
+    printf("Summarize flow (request) completion times of text or binary log files of client and incast-client.\n");
+    printf("-b <bounds>     size bucket bounds in bytes, e.g., 100K,10M (default 100K,10M)\n");
+    printf("-p <list>       percentiles, e.g., 50,99,99.9 (default 50,99,99.9)\n");
+    printf("-d              break down by DSCP value\n");
+    printf("-j <file>       write the summary as JSON to a file (- for the standard output)\n");
+    printf("-h              display help information\n");
+}
+
+/* parse a size with an optional K, M or G suffix (powers of 1024) */
+static bool parse_size(char *str, unsigned long long *size)
+{
+    char *end = NULL;
+
+    *size = strtoull(str, &end, 10);
+    if (end == str)
+        return false;
+
+    switch (*end)
+    {
+        case 'K': case 'k':
+            *size <<= 10;
+            end++;
+            break;
+        case 'M': case 'm':
+            *size <<= 20;
+            end++;
+            break;
+        case 'G': case 'g':
+            *size <<= 30;
+            end++;
+            break;
+    }
+
+    return *end == '\0' || *end == 'B';
+}
+
+/* read command line arguments */
+void read_args(int argc, char *argv[])
+{
+    int i = 1;
+    char *tok = NULL;
+
+    if (argc == 1)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+    }
+
+    while (i < argc)
+    {
+        if (strlen(argv[i]) == 2 && strcmp(argv[i], "-b") == 0)
+        {
+            if (i+1 < argc)
+            {
+                num_bounds = 0;
+                for (tok = strtok(argv[i+1], ","); tok; tok = strtok(NULL, ","))
+                {
+                    if (num_bounds == TG_ANALYZER_BOUNDS || !parse_size(tok, &size_bounds[num_bounds]) ||
+                        size_bounds[num_bounds] == 0 || (num_bounds > 0 && size_bounds[num_bounds] <= size_bounds[num_bounds - 1]))
+                    {
+                        printf("Invalid size bucket bounds\n");
+                        print_usage(argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    num_bounds++;
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read size bucket bounds\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-p") == 0)
+        {
+            if (i+1 < argc)
+            {
+                num_percentiles = 0;
+                for (tok = strtok(argv[i+1], ","); tok; tok = strtok(NULL, ","))
+                {
+                    if (num_percentiles == TG_ANALYZER_PERCENTILES)
+                        break;
+                    percentiles[num_percentiles] = atof(tok);
+                    if (percentiles[num_percentiles] < 0 || percentiles[num_percentiles] > 100)
+                    {
+                        printf("Invalid percentile %s\n", tok);
+                        print_usage(argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    num_percentiles++;
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read percentiles\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-d") == 0)
+        {
+            dscp_breakdown = true;
+            i++;
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-j") == 0)
+        {
+            if (i+1 < argc && strlen(argv[i+1]) < sizeof(json_file_name))
+            {
+                sprintf(json_file_name, "%s", argv[i+1]);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read JSON file name\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-h") == 0)
+        {
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else if (argv[i][0] == '-')
+        {
+            printf("Invalid option %s\n", argv[i]);
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        else if (num_files < TG_ANALYZER_FILES)
+        {
+            file_names[num_files++] = argv[i];
+            i++;
+        }
+        else
+        {
+            printf("Too many log files\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (num_files == 0 || num_percentiles == 0)
+    {
+        printf("You need to specify at least one log file\n");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* open a log file and detect its format */
+bool open_log(struct log_reader *reader, char *file_name)
+{
+    memset(reader, 0, sizeof(struct log_reader));
+    reader->fd = fopen(file_name, "rb");
+    if (!reader->fd)
+    {
+        perror("Error: open the log file");
+        return false;
+    }
+
+    /* binary log files start with a header, and text log files start with a digit */
+    reader->record_size = read_fct_log_header(reader->fd);
+    if (reader->record_size == 0)
+        rewind(reader->fd);
+
+    return true;
+}
+
+/* read the next record of a log file into r (with room for struct fct_record_ext) and return false at the end */
+bool read_log(struct log_reader *reader, struct fct_record *r)
+{
+    char line[256] = {0};
+    unsigned long long size, fct_us;
+    unsigned int dscp, rate;
+
+    if (reader->record_size > 0)
+        return fread(r, reader->record_size, 1, reader->fd) == 1;
+
+    while (fgets(line, sizeof(line), reader->fd))
+    {
+        reader->line++;
+        /* size, FCT (us), DSCP, sending rate (Mbps), ... */
+        if (sscanf(line, "%llu %llu %u %u", &size, &fct_us, &dscp, &rate) != 4)
+            continue;
+
+        memset(r, 0, sizeof(struct fct_record));
+        r->size = size;
+        r->fct_us = fct_us;
+        r->dscp = dscp;
+        r->rate = rate;
+        return true;
+    }
+
+    return false;
+}
+
+/* get the groups of a record, and return the number of groups */
+unsigned int get_groups(struct fct_record *r, unsigned int *ids)
+{
+    unsigned int n = 0;
+    unsigned int i = 0;
+
+    ids[n++] = 0;
+    while (i < num_bounds && r->size >= size_bounds[i])
+        i++;
+    ids[n++] = 1 + i;
+    if (dscp_breakdown)
+        ids[n++] = 2 + num_bounds + (r->dscp % TG_ANALYZER_DSCP);
+
+    return n;
+}
+
+/* read all log files once. In the first pass, fill histograms. In the second pass, collect values of percentile buckets. */
+bool scan_logs(bool second_pass)
+{
+    struct log_reader reader;
+    struct fct_record_ext r;    /* room for the largest record */
+    struct group_stats *g = NULL;
+    unsigned int ids[3];
+    unsigned int i, j, k, n, bucket;
+    unsigned long long fct_us;
+    unsigned long long num_read;
+
+    for (i = 0; i < num_files; i++)
+    {
+        if (!open_log(&reader, file_names[i]))
+            return false;
+
+        /* the second pass only reads the records seen in the first pass */
+        for (num_read = 0; (!second_pass || num_read < file_records[i]) && read_log(&reader, &(r.base)); num_read++)
+        {
+            fct_us = r.base.fct_us;
+            bucket = get_hist_bucket(fct_us);
+            n = get_groups(&(r.base), ids);
+
+            for (j = 0; j < n; j++)
+            {
+                g = &groups[ids[j]];
+                if (!second_pass)
+                {
+                    record_hist(&g->hist, fct_us);
+                    g->goodput_total += (fct_us > 0) ? r.base.size * 8 / fct_us : 0;
+                    continue;
+                }
+
+                for (k = 0; k < num_percentiles; k++)
+                {
+                    if (g->bucket[k] == bucket && g->num_values[k] < g->hist.counts[bucket])
+                        g->values[k][g->num_values[k]++] = fct_us;
+                }
+            }
+        }
+
+        if (!second_pass)
+        {
+            file_records[i] = num_read;
+            num_records += num_read;
+        }
+        else if (num_read < file_records[i])
+        {
+            printf("Error: %s has %llu records in the second pass and %llu in the first pass\n", file_names[i], num_read, file_records[i]);
+            fclose(reader.fd);
+            return false;
+        }
+        else if (read_log(&reader, &(r.base)))
+            printf("Warning: %s changed between the two passes, and new records are ignored\n", file_names[i]);
+
+        fclose(reader.fd);
+    }
+
+    return true;
+}
+
+/* prepare the second pass after the first pass */
+bool prepare_second_pass()
+{
+    struct group_stats *g = NULL;
+    unsigned long long rank;
+    unsigned int i, k;
+
+    for (i = 0; i < num_groups; i++)
+    {
+        g = &groups[i];
+        if (g->hist.num_value == 0)
+            continue;
+
+        for (k = 0; k < num_percentiles; k++)
+        {
+            /* same as result.py: the value at index floor(percentile * n) of the sorted values */
+            rank = min((unsigned long long)(percentiles[k] / 100 * g->hist.num_value) + 1, g->hist.num_value);
+            g->bucket[k] = find_rank_hist(&g->hist, rank, &(g->bucket_rank[k]));
+            g->values[k] = (unsigned long long*)malloc(g->hist.counts[g->bucket[k]] * sizeof(unsigned long long));
+            if (!g->values[k])
+            {
+                perror("Error: malloc values of a percentile bucket");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* select the k-th smallest value (0-based) of an array */
+unsigned long long select_value(unsigned long long *values, unsigned long long num, unsigned long long k)
+{
+    long long lo = 0, hi = (long long)num - 1;
+    long long i, j;
+    unsigned long long pivot, tmp;
+
+    /* quickselect with Hoare partitioning */
+    while (lo < hi)
+    {
+        pivot = values[lo + (hi - lo) / 2];
+        i = lo;
+        j = hi;
+        while (i <= j)
+        {
+            while (values[i] < pivot)
+                i++;
+            while (values[j] > pivot)
+                j--;
+            if (i <= j)
+            {
+                tmp = values[i];
+                values[i++] = values[j];
+                values[j--] = tmp;
+            }
+        }
+
+        /* values[lo..j] <= pivot <= values[i..hi], and values between j and i equal pivot */
+        if ((long long)k <= j)
+            hi = j;
+        else if ((long long)k >= i)
+            lo = i;
+        else
+            break;
+    }
+
+    return values[k];
+}
+
+/* format a size bound, e.g., 100KB */
+void format_size(char *buf, size_t len, unsigned long long size)
+{
+    if (size == 0)
+        buf[0] = '\0';
+    else if (size % (1 << 30) == 0)
+        snprintf(buf, len, "%lluGB", size >> 30);
+    else if (size % (1 << 20) == 0)
+        snprintf(buf, len, "%lluMB", size >> 20);
+    else if (size % (1 << 10) == 0)
+        snprintf(buf, len, "%lluKB", size >> 10);
+    else
+        snprintf(buf, len, "%lluB", size);
+}
+
+/* print the summary as text */
+void print_text()
+{
+    struct group_stats *g = NULL;
+    unsigned int i, k;
+
+    printf("Parse %u file%s, %llu flows/requests\n", num_files, (num_files > 1) ? "s" : "", num_records);
+    for (i = 0; i < num_groups; i++)
+    {
+        g = &groups[i];
+        /* skip DSCP values without any flow */
+        if (i >= 2 + num_bounds && g->hist.num_value == 0)
+            continue;
+
+        printf("%s: %llu flows/requests, average %.0f us", g->name, g->hist.num_value, avg_hist(&g->hist));
+        for (k = 0; k < num_percentiles; k++)
+            printf(", p%g %llu us", percentiles[k], g->result[k]);
+        printf(", average goodput %llu Mbps\n", (g->hist.num_value > 0) ? g->goodput_total / g->hist.num_value : 0);
+    }
+}
+
+/* write the summary as JSON */
+void write_json(FILE *fd)
+{
+    struct group_stats *g = NULL;
+    unsigned int i, k;
+    bool first = true;
+
+    fprintf(fd, "{\"files\": %u, \"records\": %llu, \"groups\": [", num_files, num_records);
+    for (i = 0; i < num_groups; i++)
+    {
+        g = &groups[i];
+        if (i >= 2 + num_bounds && g->hist.num_value == 0)
+            continue;
+
+        fprintf(fd, "%s\n  {\"name\": \"%s\", \"count\": %llu, \"avg_us\": %.2f, \"min_us\": %llu, \"max_us\": %llu, \"percentiles_us\": {",
+                first ? "" : ",", g->name, g->hist.num_value, avg_hist(&g->hist),
+                (g->hist.num_value > 0) ? g->hist.min_value : 0, g->hist.max_value);
+        for (k = 0; k < num_percentiles; k++)
+            fprintf(fd, "%s\"%g\": %llu", (k > 0) ? ", " : "", percentiles[k], g->result[k]);
+        fprintf(fd, "}, \"avg_goodput_mbps\": %llu}", (g->hist.num_value > 0) ? g->goodput_total / g->hist.num_value : 0);
+        first = false;
+    }
+    fprintf(fd, "\n]}\n");
+}
+
+/* clean up resources */
+void cleanup()
+{
+    unsigned int i, k;
+
+    if (!groups)
+        return;
+
+    for (i = 0; i < num_groups; i++)
+        for (k = 0; k < num_percentiles; k++)
+            free(groups[i].values[k]);
+    free(groups);
+    groups = NULL;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/fctlog.h"
+
+/* number of records to read at a time */
+#define TG_LOG2TEXT_RECORDS 4096
+
+/* print usage of the program */
+void print_usage(char *program);
+
+int main(int argc, char *argv[])
+{
+    FILE *in = NULL;
+    FILE *out = stdout;
+    char *records = NULL;
+    unsigned int record_size = 0;
+    size_t num, i;
+    unsigned long long total = 0;
+
+    if (argc < 2 || argc > 3 || strcmp(argv[1], "-h") == 0)
+    {
+        print_usage(argv[0]);
+        exit(argc < 2 || argc > 3 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        perror("Error: open the binary log file");
+        exit(EXIT_FAILURE);
+    }
+
+    record_size = read_fct_log_header(in);
+    if (record_size == 0)
+    {
+        printf("%s is not a binary log file of this version\n", argv[1]);
+        fclose(in);
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc == 3)
+    {
+        out = fopen(argv[2], "w");
+        if (!out)
+        {
+            perror("Error: open the text log file");
+            fclose(in);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    records = (char*)malloc((size_t)TG_LOG2TEXT_RECORDS * record_size);
+    if (!records)
+    {
+        perror("Error: malloc records");
+        exit(EXIT_FAILURE);
+    }
+
+    while ((num = fread(records, record_size, TG_LOG2TEXT_RECORDS, in)) > 0)
+    {
+        for (i = 0; i < num; i++)
+            print_fct_record(out, (struct fct_record*)(records + i * record_size));
+        total += num;
+    }
+
+    if (out != stdout)
+    {
+        fclose(out);
+        printf("Convert %llu records from %s to %s\n", total, argv[1], argv[2]);
+    }
+    fclose(in);
+    free(records);
+    return 0;
+}
+
+/* print usage of the program */
+void print_usage(char *program)
+{
+    printf("Usage: %s <binary log> [text log]\n", program);
+    printf("Convert a binary log file of client or incast-client (-f binary) to the text format.\n");
+    printf("Without a text log file, the text is written to the standard output.\n");
+}
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "../common/common.h"
+#include "../common/cdf.h"
+#include "../common/rng.h"
+#include "../common/trace.h"
+#include "../common/sampler.h"
+
+char config_file_name[80] = {0};    /* configuration file */
+char schedule_file_name[80] = "schedule.bin";   /* output file */
+double load = -1;   /* network load (Mbps) */
+unsigned int req_total_num = 0; /* total number of requests to generate */
+unsigned int req_total_time = 0;    /* total time to generate requests (in seconds) */
+int seed = 0;   /* random seed */
+
+struct client_config config;    /* servers, request size distribution, DSCP values and sending rates */
+
+/* print usage of the program */
+void print_usage(char *program);
+/* read command line arguments */
+void read_args(int argc, char *argv[]);
+/* sample all requests and write them to the schedule file */
+void write_schedule(unsigned int period_us);
+/* clean up resources */
+void cleanup();
+
+int main(int argc, char *argv[])
+{
+    struct timeval tv;
+    unsigned int period_us;
+
+    read_args(argc, argv);
+
+    /* same seed as client */
+    if (seed == 0)
+    {
+        gettimeofday(&tv, NULL);
+        seed = (tv.tv_sec*1000000) + tv.tv_usec;
+    }
+
+    if (!read_client_config(&config, config_file_name, true, false))
+    {
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
+
+    period_us = avg_cdf(config.req_size_dist) * 8 / load / TG_GOODPUT_RATIO;
+    if (period_us <= 0)
+    {
+        cleanup();
+        error("Error: period_us is not positive");
+    }
+
+    printf("The seed is %d\n", seed);
+    printf("The average request arrival interval is %u us\n", period_us);
+    write_schedule(period_us);
+
+    cleanup();
+    return 0;
+}
+
+/* print usage of the program */
+void print_usage(char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("Sample the requests of client into a schedule file, which client replays with -T.\n");
+    printf("-b <bandwidth>  expected average RX bandwidth in Mbits/sec\n");
+    printf("-c <file>       configuration file of client (required)\n");
+    printf("-n <number>     number of requests (instead of -t)\n");
+    printf("-t <time>       time in seconds (instead of -n)\n");
+    printf("-s <seed>       seed to generate random numbers (default current time)\n");
+    printf("-o <file>       schedule file (default %s)\n", schedule_file_name);
+    printf("-h              display help information\n");
+}
+
+/* read command line arguments */
+void read_args(int argc, char *argv[])
+{
+    int i = 1;
+    bool error = false;
+
+    if (argc == 1)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+    }
+
+    while (i < argc)
+    {
+        if (strlen(argv[i]) == 2 && strcmp(argv[i], "-b") == 0)
+        {
+            if (i+1 < argc)
+            {
+                load = atof(argv[i+1]);
+                if (load <= 0)
+                {
+                    printf("Invalid average RX bandwidth: %f\n", load);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read average RX bandwidth\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-c") == 0)
+        {
+            if (i+1 < argc && strlen(argv[i+1]) < sizeof(config_file_name))
+            {
+                sprintf(config_file_name, "%s", argv[i+1]);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read configuration file name\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-n") == 0)
+        {
+            if (i+1 < argc)
+            {
+                req_total_num = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read number of requests\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-t") == 0)
+        {
+            if (i+1 < argc)
+            {
+                req_total_time = (unsigned int)strtoul(argv[i+1], NULL, 10);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read time to generate requests\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-s") == 0)
+        {
+            if (i+1 < argc)
+            {
+                seed = atoi(argv[i+1]);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read seed value\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-o") == 0)
+        {
+            if (i+1 < argc && strlen(argv[i+1]) < sizeof(schedule_file_name))
+            {
+                sprintf(schedule_file_name, "%s", argv[i+1]);
+                i += 2;
+            }
+            else
+            {
+                printf("Cannot read schedule file name\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-h") == 0)
+        {
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else
+        {
+            printf("Invalid option %s\n", argv[i]);
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (strlen(config_file_name) == 0)
+    {
+        printf("You need to specify the configuration file (-c)\n");
+        error = true;
+    }
+
+    if (load < 0)
+    {
+        printf("You need to specify the average RX bandwidth (-b)\n");
+        error = true;
+    }
+
+    if (req_total_num == 0 && req_total_time == 0)
+    {
+        printf("You need to specify either the number of requests (-n) or the time to generate requests (-t)\n");
+        error = true;
+    }
+    else if (req_total_num > 0 && req_total_time > 0)
+    {
+        printf("You cannot specify both the number of requests (-n) and the time to generate requests (-t)\n");
+        error = true;
+    }
+
+    if (error)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Sample all requests and write them to the schedule file. Client uses the same sampler, where
+ * the requests to server i form a Poisson process sampled from stream i of the seed, so client -T replays
+ * the same requests as client with the same seed, configuration file and -b, -n or -t.
+ */
+void write_schedule(unsigned int period_us)
+{
+    struct server_stream *streams = NULL;
+    struct stream_heap heap;
+    struct sampled_request req;
+    struct trace_record r;
+    double avg_rate = 1.0 / config.num_server / period_us;
+    unsigned long long total_us = (unsigned long long)req_total_time * 1000000;
+    unsigned long long num_records = 0;
+    unsigned int i;
+    FILE *fd = NULL;
+
+    streams = (struct server_stream*)calloc(config.num_server, sizeof(struct server_stream));
+    if (!streams)
+    {
+        cleanup();
+        error("Error: calloc server streams");
+    }
+
+    for (i = 0; i < config.num_server; i++)
+        init_server_stream(&streams[i], i, seed, avg_rate, config.num_server, req_total_num);
+
+    if (!init_stream_heap(&heap, streams, config.num_server, req_total_num > 0))
+    {
+        free(streams);
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
+
+    fd = fopen(schedule_file_name, "wb");
+    if (!fd || !write_trace_header(fd))
+    {
+        perror("Error: write the schedule file");
+        if (fd)
+            fclose(fd);
+        free_stream_heap(&heap);
+        free(streams);
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
+
+    while (sample_request(&heap, &config, avg_rate, total_us, &req))
+    {
+        memset(&r, 0, sizeof(r));
+        r.time_ns = req.time_us * 1000;
+        r.server_id = req.server_id;
+        r.size = req.size;
+        r.dscp = req.dscp;
+        r.rate = req.rate;
+
+        if (fwrite(&r, sizeof(r), 1, fd) != 1)
+        {
+            perror("Error: write the schedule file");
+            break;
+        }
+        num_records++;
+    }
+
+    fclose(fd);
+    free_stream_heap(&heap);
+    free(streams);
+    printf("Write %llu requests (%.3f s) to %s\n", num_records, (double)(num_records > 0 ? r.time_ns : 0) / 1000000000, schedule_file_name);
+}
+
+/* clean up resources */
+void cleanup()
+{
+    free_client_config(&config);
+}